@@ -0,0 +1,196 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "buffer_pool.h"
+
+/* Class 0 is one cache line, then POOL_STEPS classes per power of two */
+#define POOL_MIN_SHIFT 6
+#define POOL_STEPS 4
+#define POOL_CLASSES ((sizeof(size_t) * 8 - POOL_MIN_SHIFT) * POOL_STEPS + 1)
+
+/* A cached buffer, linked through its own first bytes */
+struct pool_free {
+	struct pool_free *next;
+};
+
+/* Taken from the capture thread through the shared frames, and the GUI */
+G_LOCK_DEFINE_STATIC(buffer_pool);
+static struct pool_free *free_lists[POOL_CLASSES];
+/* class + 1 of every buffer the pool allocated, cached or not */
+static GHashTable *owners;
+static struct buffer_pool_stats pool_stats;
+
+static unsigned int pool_class(size_t size)
+{
+	unsigned int shift = POOL_MIN_SHIFT;
+	size_t step;
+
+	if (size <= (1 << POOL_MIN_SHIFT))
+		return 0;
+
+	while (((size_t)1 << (shift + 1)) < size)
+		shift++;
+
+	step = ((size_t)1 << shift) / POOL_STEPS;
+
+	return (shift - POOL_MIN_SHIFT) * POOL_STEPS +
+		(size - ((size_t)1 << shift) + step - 1) / step;
+}
+
+static size_t pool_class_size(unsigned int c)
+{
+	unsigned int shift;
+
+	if (!c)
+		return 1 << POOL_MIN_SHIFT;
+
+	shift = POOL_MIN_SHIFT + (c - 1) / POOL_STEPS;
+
+	return ((size_t)1 << shift) +
+		((c - 1) % POOL_STEPS + 1) * (((size_t)1 << shift) / POOL_STEPS);
+}
+
+static void pool_account_peak(void)
+{
+	pool_stats.peak = MAX(pool_stats.peak,
+			pool_stats.in_use + pool_stats.cached);
+}
+
+/* Contents are undefined, as with malloc() */
+void * buffer_pool_alloc(size_t size)
+{
+	unsigned int c = pool_class(size);
+	size_t csize = pool_class_size(c);
+	struct pool_free *buf;
+	void *mem;
+
+	G_LOCK(buffer_pool);
+	buf = free_lists[c];
+	if (buf) {
+		free_lists[c] = buf->next;
+		pool_stats.hits++;
+		pool_stats.cached -= csize;
+		pool_stats.in_use += csize;
+		G_UNLOCK(buffer_pool);
+		return buf;
+	}
+	G_UNLOCK(buffer_pool);
+
+	if (posix_memalign(&mem, csize >= BUFFER_POOL_PAGE ?
+				BUFFER_POOL_PAGE : BUFFER_POOL_CACHE_LINE, csize))
+		return NULL;
+
+	G_LOCK(buffer_pool);
+	if (!owners)
+		owners = g_hash_table_new(g_direct_hash, g_direct_equal);
+	g_hash_table_insert(owners, mem, GUINT_TO_POINTER(c + 1));
+	pool_stats.misses++;
+	pool_stats.in_use += csize;
+	pool_account_peak();
+	G_UNLOCK(buffer_pool);
+
+	return mem;
+}
+
+void * buffer_pool_alloc0(size_t size)
+{
+	void *buf = buffer_pool_alloc(size);
+
+	if (buf)
+		memset(buf, 0, size);
+
+	return buf;
+}
+
+/*
+ * A buffer of at least @size bytes in place of @buf, which may be NULL.
+ * @buf is kept if it is big enough without wasting half of it, else it
+ * goes back to the pool. Contents are not preserved either way.
+ */
+void * buffer_pool_resize(void *buf, size_t size)
+{
+	unsigned int c, want = pool_class(size);
+
+	if (buf) {
+		G_LOCK(buffer_pool);
+		c = owners ? GPOINTER_TO_UINT(g_hash_table_lookup(owners, buf)) : 0;
+		G_UNLOCK(buffer_pool);
+
+		if (c && c - 1 >= want && c - 1 < want + POOL_STEPS)
+			return buf;
+
+		buffer_pool_free(buf);
+	}
+
+	return buffer_pool_alloc(size);
+}
+
+void buffer_pool_free(void *buf)
+{
+	struct pool_free *entry = buf;
+	unsigned int c;
+	size_t csize;
+
+	if (!buf)
+		return;
+
+	G_LOCK(buffer_pool);
+	c = owners ? GPOINTER_TO_UINT(g_hash_table_lookup(owners, buf)) : 0;
+	if (!c) {
+		G_UNLOCK(buffer_pool);
+		fprintf(stderr, "%s: %p is not from the pool\n", __func__, buf);
+		return;
+	}
+
+	c--;
+	csize = pool_class_size(c);
+	pool_stats.in_use -= csize;
+
+	if (pool_stats.cached + csize <= BUFFER_POOL_MAX_CACHED) {
+		entry->next = free_lists[c];
+		free_lists[c] = entry;
+		pool_stats.cached += csize;
+		G_UNLOCK(buffer_pool);
+		return;
+	}
+
+	g_hash_table_remove(owners, buf);
+	G_UNLOCK(buffer_pool);
+
+	free(buf);
+}
+
+/* Give every cached buffer back to the system */
+void buffer_pool_trim(void)
+{
+	struct pool_free *buf, *next;
+	unsigned int c;
+
+	G_LOCK(buffer_pool);
+	for (c = 0; c < POOL_CLASSES; c++) {
+		for (buf = free_lists[c]; buf; buf = next) {
+			next = buf->next;
+			g_hash_table_remove(owners, buf);
+			free(buf);
+		}
+		free_lists[c] = NULL;
+	}
+	pool_stats.cached = 0;
+	G_UNLOCK(buffer_pool);
+}
+
+void buffer_pool_get_stats(struct buffer_pool_stats *stats)
+{
+	G_LOCK(buffer_pool);
+	*stats = pool_stats;
+	G_UNLOCK(buffer_pool);
+}
@@ -0,0 +1,50 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __BUFFER_POOL_H__
+#define __BUFFER_POOL_H__
+
+#include <stddef.h>
+#include <glib.h>
+
+/*
+ * Frames and channel arrays are allocated again on every capture start,
+ * domain change and plugin request, mostly in the same few sizes. Freed
+ * buffers are kept in size classes, four per power of two so that no
+ * more than a quarter is wasted, and handed out again for any request
+ * that fits the class. Buffers are cache line aligned, and page aligned
+ * from a page up. Up to BUFFER_POOL_MAX_CACHED bytes are kept around;
+ * past that, freed buffers go back to the system.
+ */
+#define BUFFER_POOL_CACHE_LINE 64
+#define BUFFER_POOL_PAGE 4096
+#define BUFFER_POOL_MAX_CACHED (256 << 20)
+
+/**
+ * struct buffer_pool_stats - how well the pool does
+ * @hits: requests served from a cached buffer
+ * @misses: requests that needed a new buffer
+ * @in_use: bytes handed out and not freed yet
+ * @cached: bytes freed and kept for reuse
+ * @peak: highest @in_use plus @cached so far
+ **/
+struct buffer_pool_stats {
+	guint64 hits;
+	guint64 misses;
+	guint64 in_use;
+	guint64 cached;
+	guint64 peak;
+};
+
+void * buffer_pool_alloc(size_t size);
+void * buffer_pool_alloc0(size_t size);
+void * buffer_pool_resize(void *buf, size_t size);
+void buffer_pool_free(void *buf);
+void buffer_pool_trim(void);
+void buffer_pool_get_stats(struct buffer_pool_stats *stats);
+
+#endif
@@ -0,0 +1,190 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <glib.h>
+
+#include "chunk_store.h"
+
+void chunk_store_init(struct chunk_store *cs, const char *dir)
+{
+	memset(cs, 0, sizeof(*cs));
+	cs->dir = dir ? g_strdup(dir) : NULL;
+	cs->fd = -1;
+}
+
+void chunk_store_free(struct chunk_store *cs)
+{
+	unsigned int i;
+
+	for (i = 0; i < cs->num_chunks; i++)
+		munmap(cs->chunks[i], CHUNK_STORE_CHUNK_SIZE);
+	g_free(cs->chunks);
+	if (cs->fd >= 0)
+		close(cs->fd);
+	g_free(cs->dir);
+	memset(cs, 0, sizeof(*cs));
+	cs->fd = -1;
+}
+
+/* Backing file in @dir, unlinked as soon as it is created */
+static int chunk_store_backing(const char *dir)
+{
+	char *path;
+	int fd;
+
+	path = g_strdup_printf("%s/osc-deep-XXXXXX", dir);
+	fd = mkstemp(path);
+	if (fd < 0)
+		fd = -errno;
+	else
+		unlink(path);
+	g_free(path);
+
+	return fd;
+}
+
+/*
+ * Make room for @size bytes of a stream of @unit byte units. Chunks mapped
+ * for an earlier capture are kept, so a store that already is deep enough
+ * costs nothing.
+ */
+int chunk_store_reserve(struct chunk_store *cs, unsigned int unit,
+		uint64_t size)
+{
+	unsigned int num, i;
+	int8_t **chunks;
+	void *addr;
+	int ret;
+
+	if (!unit || unit > CHUNK_STORE_CHUNK_SIZE)
+		return -EINVAL;
+
+	cs->unit = unit;
+	cs->chunk_used = CHUNK_STORE_CHUNK_SIZE / unit * unit;
+
+	num = (size + cs->chunk_used - 1) / cs->chunk_used;
+	if (num <= cs->num_chunks)
+		return 0;
+
+	if (cs->dir && cs->fd < 0) {
+		cs->fd = chunk_store_backing(cs->dir);
+		if (cs->fd < 0) {
+			fprintf(stderr, "Failed to create deep memory file in %s: %s\n",
+					cs->dir, strerror(-cs->fd));
+			return cs->fd;
+		}
+	}
+
+	if (cs->fd >= 0 && ftruncate(cs->fd,
+				(off_t)num * CHUNK_STORE_CHUNK_SIZE) < 0)
+		return -errno;
+
+	chunks = g_renew(int8_t *, cs->chunks, num);
+	if (!chunks)
+		return -ENOMEM;
+	cs->chunks = chunks;
+
+	for (i = cs->num_chunks; i < num; i++) {
+		if (cs->fd >= 0)
+			addr = mmap(NULL, CHUNK_STORE_CHUNK_SIZE,
+					PROT_READ | PROT_WRITE, MAP_SHARED,
+					cs->fd, (off_t)i * CHUNK_STORE_CHUNK_SIZE);
+		else
+			addr = mmap(NULL, CHUNK_STORE_CHUNK_SIZE,
+					PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+					-1, 0);
+		if (addr == MAP_FAILED) {
+			ret = -errno;
+			fprintf(stderr, "Failed to map deep memory chunk %u: %s\n",
+					i, strerror(-ret));
+			return ret;
+		}
+		cs->chunks[i] = addr;
+		cs->num_chunks = i + 1;
+	}
+
+	return 0;
+}
+
+/* Bytes the store can hold with the current unit */
+uint64_t chunk_store_capacity(const struct chunk_store *cs)
+{
+	return (uint64_t)cs->num_chunks * cs->chunk_used;
+}
+
+/*
+ * Address of stream position @pos, which must be within the capacity, and
+ * in @len how many bytes from there on are contiguous.
+ */
+void * chunk_store_at(const struct chunk_store *cs, uint64_t pos, size_t *len)
+{
+	unsigned int chunk = pos / cs->chunk_used;
+	size_t offset = pos % cs->chunk_used;
+
+	if (len)
+		*len = cs->chunk_used - offset;
+
+	return cs->chunks[chunk] + offset;
+}
+
+/*
+ * Copy @len bytes of @data to stream position @pos. Returns how many fit
+ * in the store.
+ */
+size_t chunk_store_write(struct chunk_store *cs, uint64_t pos,
+		const void *data, size_t len)
+{
+	const int8_t *src = data;
+	size_t done = 0, room;
+	void *dst;
+
+	if (pos >= chunk_store_capacity(cs))
+		return 0;
+	len = MIN(len, chunk_store_capacity(cs) - pos);
+
+	while (done < len) {
+		dst = chunk_store_at(cs, pos + done, &room);
+		room = MIN(room, len - done);
+		memcpy(dst, src + done, room);
+		done += room;
+	}
+
+	return done;
+}
+
+void chunk_iter_init(struct chunk_iter *it, const struct chunk_store *cs,
+		uint64_t start, uint64_t end)
+{
+	it->store = cs;
+	it->pos = start;
+	it->end = MIN(end, chunk_store_capacity(cs));
+}
+
+/*
+ * Point @data at the next contiguous span of the range. Returns its length,
+ * a whole number of units if the range boundaries are, or 0 at the end.
+ */
+size_t chunk_iter_next(struct chunk_iter *it, const void **data)
+{
+	size_t len;
+
+	if (it->pos >= it->end)
+		return 0;
+
+	*data = chunk_store_at(it->store, it->pos, &len);
+	len = MIN(len, it->end - it->pos);
+	it->pos += len;
+
+	return len;
+}
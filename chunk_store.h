@@ -0,0 +1,68 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __CHUNK_STORE_H__
+#define __CHUNK_STORE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A byte stream too long for one allocation, kept in fixed-size chunks
+ * mapped one at a time, either anonymous or backed by a file so the
+ * kernel can page the stream out to disk. Chunks are only ever added:
+ * the store grows to the deepest capture asked for and is then reused.
+ * Each chunk holds a whole number of units (samples, for a capture), so
+ * that no unit is ever split between two chunks.
+ */
+#define CHUNK_STORE_CHUNK_SIZE (4 << 20)
+
+/**
+ * struct chunk_store - a stream of bytes in fixed-size chunks
+ * @dir: directory of the backing file, NULL for anonymous memory
+ * @fd: backing file, once created, else -1
+ * @chunks: address of each chunk
+ * @num_chunks: number of chunks mapped
+ * @unit: size of the units the stream is made of
+ * @chunk_used: bytes of each chunk in use, a multiple of @unit
+ **/
+struct chunk_store {
+	char *dir;
+	int fd;
+	int8_t **chunks;
+	unsigned int num_chunks;
+	unsigned int unit;
+	size_t chunk_used;
+};
+
+/**
+ * struct chunk_iter - walks part of a store a contiguous span at a time
+ * @store: the store walked
+ * @pos: stream position of the next span
+ * @end: stream position to stop at
+ **/
+struct chunk_iter {
+	const struct chunk_store *store;
+	uint64_t pos;
+	uint64_t end;
+};
+
+void chunk_store_init(struct chunk_store *cs, const char *dir);
+void chunk_store_free(struct chunk_store *cs);
+int chunk_store_reserve(struct chunk_store *cs, unsigned int unit,
+		uint64_t size);
+uint64_t chunk_store_capacity(const struct chunk_store *cs);
+void * chunk_store_at(const struct chunk_store *cs, uint64_t pos,
+		size_t *len);
+size_t chunk_store_write(struct chunk_store *cs, uint64_t pos,
+		const void *data, size_t len);
+
+void chunk_iter_init(struct chunk_iter *it, const struct chunk_store *cs,
+		uint64_t start, uint64_t end);
+size_t chunk_iter_next(struct chunk_iter *it, const void **data);
+
+#endif
@@ -0,0 +1,440 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <endian.h>
+#include <glib.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(HAVE_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "iio_utils.h"
+#include "demux.h"
+
+static int sign_extend(unsigned int val, unsigned int bits)
+{
+	unsigned int shift = 32 - bits;
+	return ((int)(val << shift)) >> shift;
+}
+
+/*
+ * Handles every layout: the storage size, endianness and sign of each
+ * sample are looked at one by one.
+ */
+static void demux_generic(const struct demux_plan *plan,
+		const void *data_in, gfloat **data_out,
+		unsigned int offset, unsigned int num_sam)
+{
+	struct iio_channel_info *channels = plan->channels;
+	unsigned int i, j, n;
+	unsigned int val;
+	unsigned int k;
+
+	for (i = 0; i < num_sam; i++) {
+		n = offset + i;
+		k = 0;
+		for (j = 0; j < plan->num_channels; j++) {
+			if (!channels[j].enabled)
+				continue;
+			switch (channels[j].bytes) {
+			case 1:
+				val = *(uint8_t *)data_in;
+				break;
+			case 2:
+				switch (channels[j].endianness) {
+				case IIO_BE:
+					val = be16toh(*(uint16_t *)data_in);
+					break;
+				case IIO_LE:
+					val = le16toh(*(uint16_t *)data_in);
+					break;
+				default:
+					val = 0;
+					break;
+				}
+				break;
+			case 4:
+				switch (channels[j].endianness) {
+				case IIO_BE:
+					val = be32toh(*(uint32_t *)data_in);
+					break;
+				case IIO_LE:
+					val = le32toh(*(uint32_t *)data_in);
+					break;
+				default:
+					val = 0;
+					break;
+				}
+				break;
+			default:
+				continue;
+			}
+			data_in += channels[j].bytes;
+			val >>= channels[j].shift;
+			val &= channels[j].mask;
+			if (channels[j].is_signed)
+				data_out[k][n] = sign_extend(val, channels[j].bits_used);
+			else
+				data_out[k][n] = val;
+			if (plan->convert)
+				data_out[k][n] = (data_out[k][n] + channels[j].offset) *
+					channels[j].scale;
+			k++;
+		}
+	}
+}
+
+/*
+ * The specialized kernels below all expect 1, 2 or 4 signed little endian
+ * channels sharing the same storage size, width and shift. A sample is
+ * sign extended by shifting its sign bit up to the storage MSB, then
+ * arithmetic shifting it back down. It is always multiplied by mul and
+ * added add, which are 1 and 0 unless converting: two more instructions
+ * per vector are cheaper than a second set of loops.
+ */
+
+#if defined(__AVX2__)
+
+/* 8 converted samples, interleaved over @nch channels, written to @out */
+static inline void store8_avx2(const struct demux_plan *plan, __m256 f,
+		gfloat **out, unsigned int s, unsigned int nch)
+{
+	__m256 t;
+
+	f = _mm256_add_ps(_mm256_mul_ps(f, _mm256_loadu_ps(plan->mul)),
+			_mm256_loadu_ps(plan->add));
+
+	switch (nch) {
+	case 1:
+		_mm256_storeu_ps(out[0] + s, f);
+		break;
+	case 2:
+		t = _mm256_permutevar8x32_ps(f,
+				_mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7));
+		_mm_storeu_ps(out[0] + s, _mm256_castps256_ps128(t));
+		_mm_storeu_ps(out[1] + s, _mm256_extractf128_ps(t, 1));
+		break;
+	case 4:
+		t = _mm256_permutevar8x32_ps(f,
+				_mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+		_mm_storel_pi((__m64 *)(out[0] + s), _mm256_castps256_ps128(t));
+		_mm_storeh_pi((__m64 *)(out[1] + s), _mm256_castps256_ps128(t));
+		_mm_storel_pi((__m64 *)(out[2] + s), _mm256_extractf128_ps(t, 1));
+		_mm_storeh_pi((__m64 *)(out[3] + s), _mm256_extractf128_ps(t, 1));
+		break;
+	}
+}
+
+#elif defined(__SSE2__)
+
+static inline void store8_sse2(const struct demux_plan *plan, __m128 a,
+		__m128 b, gfloat **out, unsigned int s, unsigned int nch)
+{
+	__m128 mul = _mm_loadu_ps(plan->mul), add = _mm_loadu_ps(plan->add);
+	__m128 lo, hi;
+
+	/* the lane pattern repeats every 4, since nch divides 4 */
+	a = _mm_add_ps(_mm_mul_ps(a, mul), add);
+	b = _mm_add_ps(_mm_mul_ps(b, mul), add);
+
+	switch (nch) {
+	case 1:
+		_mm_storeu_ps(out[0] + s, a);
+		_mm_storeu_ps(out[0] + s + 4, b);
+		break;
+	case 2:
+		_mm_storeu_ps(out[0] + s, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps(out[1] + s, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+		break;
+	case 4:
+		lo = _mm_unpacklo_ps(a, b);
+		hi = _mm_unpackhi_ps(a, b);
+		_mm_storel_pi((__m64 *)(out[0] + s), lo);
+		_mm_storeh_pi((__m64 *)(out[1] + s), lo);
+		_mm_storel_pi((__m64 *)(out[2] + s), hi);
+		_mm_storeh_pi((__m64 *)(out[3] + s), hi);
+		break;
+	}
+}
+
+#elif defined(__ARM_NEON) && defined(HAVE_NEON)
+
+/* The NEON kernels deinterleave first, so @k is the channel of all lanes */
+static inline void store_s16_neon(const struct demux_plan *plan,
+		unsigned int k, int16x8_t v, gfloat *out,
+		int16x8_t lsh, int16x8_t rsh)
+{
+	float32x4_t mul = vdupq_n_f32(plan->mul[k]);
+	float32x4_t add = vdupq_n_f32(plan->add[k]);
+
+	v = vshlq_s16(vshlq_s16(v, lsh), rsh);
+	vst1q_f32(out, vmlaq_f32(add,
+			vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), mul));
+	vst1q_f32(out + 4, vmlaq_f32(add,
+			vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), mul));
+}
+
+static inline void store_s32_neon(const struct demux_plan *plan,
+		unsigned int k, int32x4_t v, gfloat *out,
+		int32x4_t lsh, int32x4_t rsh)
+{
+	v = vshlq_s32(vshlq_s32(v, lsh), rsh);
+	vst1q_f32(out, vmlaq_f32(vdupq_n_f32(plan->add[k]),
+			vcvtq_f32_s32(v), vdupq_n_f32(plan->mul[k])));
+}
+
+#endif
+
+static void demux_s16(const struct demux_plan *plan,
+		const void *data_in, gfloat **data_out,
+		unsigned int offset, unsigned int num_sam)
+{
+	const int16_t *src = data_in;
+	unsigned int nch = plan->num_enabled;
+	unsigned int total = num_sam * nch;
+	unsigned int i = 0, k;
+
+#if defined(__AVX2__) || defined(__SSE2__)
+	__m128i lsh = _mm_cvtsi32_si128(plan->lshift);
+	__m128i rsh = _mm_cvtsi32_si128(plan->rshift);
+	__m128i v;
+
+	for (; i + 8 <= total; i += 8) {
+		v = _mm_loadu_si128((const __m128i *)(src + i));
+		v = _mm_sra_epi16(_mm_sll_epi16(v, lsh), rsh);
+#if defined(__AVX2__)
+		store8_avx2(plan, _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v)),
+				data_out, offset + i / nch, nch);
+#else
+		store8_sse2(plan, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)),
+				_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)),
+				data_out, offset + i / nch, nch);
+#endif
+	}
+#elif defined(__ARM_NEON) && defined(HAVE_NEON)
+	int16x8_t lsh = vdupq_n_s16(plan->lshift);
+	int16x8_t rsh = vdupq_n_s16(-plan->rshift);
+	unsigned int s;
+
+	for (; i + 8 * nch <= total; i += 8 * nch) {
+		s = offset + i / nch;
+		if (nch == 1) {
+			store_s16_neon(plan, 0, vld1q_s16(src + i), data_out[0] + s,
+					lsh, rsh);
+		} else if (nch == 2) {
+			int16x8x2_t v = vld2q_s16(src + i);
+
+			store_s16_neon(plan, 0, v.val[0], data_out[0] + s, lsh, rsh);
+			store_s16_neon(plan, 1, v.val[1], data_out[1] + s, lsh, rsh);
+		} else {
+			int16x8x4_t v = vld4q_s16(src + i);
+
+			store_s16_neon(plan, 0, v.val[0], data_out[0] + s, lsh, rsh);
+			store_s16_neon(plan, 1, v.val[1], data_out[1] + s, lsh, rsh);
+			store_s16_neon(plan, 2, v.val[2], data_out[2] + s, lsh, rsh);
+			store_s16_neon(plan, 3, v.val[3], data_out[3] + s, lsh, rsh);
+		}
+	}
+#endif
+
+	for (; i < total; i++) {
+		k = i % nch;
+		data_out[k][offset + i / nch] = (gfloat)((int16_t)((uint16_t)
+				le16toh(src[i]) << plan->lshift) >> plan->rshift) *
+			plan->mul[k] + plan->add[k];
+	}
+}
+
+static void demux_s32(const struct demux_plan *plan,
+		const void *data_in, gfloat **data_out,
+		unsigned int offset, unsigned int num_sam)
+{
+	const int32_t *src = data_in;
+	unsigned int nch = plan->num_enabled;
+	unsigned int total = num_sam * nch;
+	unsigned int i = 0, k;
+
+#if defined(__AVX2__)
+	__m128i lsh = _mm_cvtsi32_si128(plan->lshift);
+	__m128i rsh = _mm_cvtsi32_si128(plan->rshift);
+	__m256i v;
+
+	for (; i + 8 <= total; i += 8) {
+		v = _mm256_loadu_si256((const __m256i *)(src + i));
+		v = _mm256_sra_epi32(_mm256_sll_epi32(v, lsh), rsh);
+		store8_avx2(plan, _mm256_cvtepi32_ps(v), data_out,
+				offset + i / nch, nch);
+	}
+#elif defined(__SSE2__)
+	__m128i lsh = _mm_cvtsi32_si128(plan->lshift);
+	__m128i rsh = _mm_cvtsi32_si128(plan->rshift);
+	__m128i a, b;
+
+	for (; i + 8 <= total; i += 8) {
+		a = _mm_loadu_si128((const __m128i *)(src + i));
+		b = _mm_loadu_si128((const __m128i *)(src + i + 4));
+		a = _mm_sra_epi32(_mm_sll_epi32(a, lsh), rsh);
+		b = _mm_sra_epi32(_mm_sll_epi32(b, lsh), rsh);
+		store8_sse2(plan, _mm_cvtepi32_ps(a), _mm_cvtepi32_ps(b),
+				data_out, offset + i / nch, nch);
+	}
+#elif defined(__ARM_NEON) && defined(HAVE_NEON)
+	int32x4_t lsh = vdupq_n_s32(plan->lshift);
+	int32x4_t rsh = vdupq_n_s32(-plan->rshift);
+	unsigned int s;
+
+	for (; i + 4 * nch <= total; i += 4 * nch) {
+		s = offset + i / nch;
+		if (nch == 1) {
+			store_s32_neon(plan, 0, vld1q_s32(src + i), data_out[0] + s,
+					lsh, rsh);
+		} else if (nch == 2) {
+			int32x4x2_t v = vld2q_s32(src + i);
+
+			store_s32_neon(plan, 0, v.val[0], data_out[0] + s, lsh, rsh);
+			store_s32_neon(plan, 1, v.val[1], data_out[1] + s, lsh, rsh);
+		} else {
+			int32x4x4_t v = vld4q_s32(src + i);
+
+			store_s32_neon(plan, 0, v.val[0], data_out[0] + s, lsh, rsh);
+			store_s32_neon(plan, 1, v.val[1], data_out[1] + s, lsh, rsh);
+			store_s32_neon(plan, 2, v.val[2], data_out[2] + s, lsh, rsh);
+			store_s32_neon(plan, 3, v.val[3], data_out[3] + s, lsh, rsh);
+		}
+	}
+#endif
+
+	for (; i < total; i++) {
+		k = i % nch;
+		data_out[k][offset + i / nch] = (gfloat)((int32_t)((uint32_t)
+				le32toh(src[i]) << plan->lshift) >> plan->rshift) *
+			plan->mul[k] + plan->add[k];
+	}
+}
+
+/*
+ * Look at the enabled channels once, and pick the fastest kernel that
+ * can handle their layout. Anything unusual gets the generic one.
+ */
+void demux_plan_build(struct demux_plan *plan,
+		struct iio_channel_info *channels, unsigned int num_channels)
+{
+	struct iio_channel_info *first = NULL;
+	unsigned int i, storage_bits;
+
+	plan->kernel = demux_generic;
+	plan->name = "generic";
+	plan->channels = channels;
+	plan->num_channels = num_channels;
+	plan->num_enabled = 0;
+	plan->lshift = 0;
+	plan->rshift = 0;
+	demux_plan_convert(plan, false);
+
+	for (i = 0; i < num_channels; i++) {
+		if (!channels[i].enabled)
+			continue;
+		plan->num_enabled++;
+		if (!first) {
+			first = &channels[i];
+			continue;
+		}
+		if (channels[i].bytes != first->bytes ||
+				channels[i].bits_used != first->bits_used ||
+				channels[i].shift != first->shift ||
+				channels[i].is_signed != first->is_signed ||
+				channels[i].endianness != first->endianness)
+			return;
+	}
+
+	if (!first || __BYTE_ORDER != __LITTLE_ENDIAN)
+		return;
+	if (first->endianness != IIO_LE || !first->is_signed)
+		return;
+	if (plan->num_enabled != 1 && plan->num_enabled != 2 &&
+			plan->num_enabled != 4)
+		return;
+
+	storage_bits = first->bytes * 8;
+	if (first->bits_used == 0 ||
+			first->bits_used + first->shift > storage_bits)
+		return;
+
+	plan->lshift = storage_bits - first->bits_used - first->shift;
+	plan->rshift = storage_bits - first->bits_used;
+
+	switch (first->bytes) {
+	case 2:
+		plan->kernel = demux_s16;
+		plan->name = "s16";
+		break;
+	case 4:
+		plan->kernel = demux_s32;
+		plan->name = "s32";
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Have the plan turn raw codes into (raw + offset) * scale of each channel,
+ * or leave them alone. Must be called again if the plan is rebuilt.
+ */
+void demux_plan_convert(struct demux_plan *plan, bool convert)
+{
+	struct iio_channel_info *chn[4];
+	unsigned int i, k = 0;
+
+	plan->convert = convert;
+
+	for (i = 0; i < plan->num_channels && k < 4; i++)
+		if (plan->channels[i].enabled)
+			chn[k++] = &plan->channels[i];
+
+	for (i = 0; i < 8; i++) {
+		if (!convert || !k) {
+			plan->mul[i] = 1.0f;
+			plan->add[i] = 0.0f;
+			continue;
+		}
+		plan->mul[i] = chn[i % k]->scale;
+		plan->add[i] = chn[i % k]->offset * chn[i % k]->scale;
+	}
+}
+
+/*
+ * Split @num_sam samples from @data_in into one array per enabled channel,
+ * starting at @offset and wrapping around at @data_out_size.
+ */
+void demux_run(const struct demux_plan *plan, const void *data_in,
+		gfloat **data_out, unsigned int num_sam, unsigned int offset,
+		unsigned int data_out_size)
+{
+	unsigned int bytes_per_sample = 0;
+	unsigned int first, i;
+
+	offset %= data_out_size;
+	if (offset + num_sam <= data_out_size) {
+		plan->kernel(plan, data_in, data_out, offset, num_sam);
+		return;
+	}
+
+	for (i = 0; i < plan->num_channels; i++)
+		if (plan->channels[i].enabled)
+			bytes_per_sample += plan->channels[i].bytes;
+
+	first = data_out_size - offset;
+	plan->kernel(plan, data_in, data_out, offset, first);
+	demux_run(plan, (const int8_t *)data_in + first * bytes_per_sample,
+			data_out, num_sam - first, 0, data_out_size);
+}
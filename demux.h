@@ -0,0 +1,54 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __DEMUX_H__
+#define __DEMUX_H__
+
+#include <stdbool.h>
+#include <glib.h>
+
+struct iio_channel_info;
+struct demux_plan;
+
+typedef void (*demux_kernel)(const struct demux_plan *plan,
+		const void *data_in, gfloat **data_out,
+		unsigned int offset, unsigned int num_sam);
+
+/**
+ * struct demux_plan - how to split a capture buffer into channels
+ * @kernel: the function doing the work, picked for the channel layout
+ * @name: name of the kernel, for diagnostics
+ * @channels: the channel array the plan was built from
+ * @num_channels: number of entries in @channels
+ * @num_enabled: number of channels present in the stream
+ * @lshift: left shift moving the sign bit of a sample to the storage MSB
+ * @rshift: arithmetic right shift bringing the sample back down
+ * @convert: whether samples are converted to SI units
+ * @mul: per lane scale of the specialized kernels, channels repeating
+ * @add: per lane offset times scale, laid out like @mul
+ **/
+struct demux_plan {
+	demux_kernel kernel;
+	const char *name;
+	struct iio_channel_info *channels;
+	unsigned int num_channels;
+	unsigned int num_enabled;
+	int lshift;
+	int rshift;
+	bool convert;
+	gfloat mul[8];
+	gfloat add[8];
+};
+
+void demux_plan_build(struct demux_plan *plan,
+		struct iio_channel_info *channels, unsigned int num_channels);
+void demux_plan_convert(struct demux_plan *plan, bool convert);
+void demux_run(const struct demux_plan *plan, const void *data_in,
+		gfloat **data_out, unsigned int num_sam, unsigned int offset,
+		unsigned int data_out_size);
+
+#endif
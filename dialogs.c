@@ -22,7 +22,6 @@
 
 extern GtkWidget *plot_domain;
 extern gfloat **channel_data;
-extern unsigned int num_samples;
 extern unsigned int num_active_channels;
 extern const char *current_device;
 extern double adc_freq;
@@ -385,11 +384,31 @@ G_MODULE_EXPORT void cb_show_about(GtkButton *button, Dialogs *data)
 	gtk_widget_hide(data->about);
 }
 
+/*
+ * The @len samples of channel @ch of the last capture, gathered in an
+ * array for the caller to g_free(), or NULL if there isn't enough memory.
+ */
+static gfloat * capture_channel_copy(unsigned int ch, unsigned int len)
+{
+	gfloat **data, *samples;
+	unsigned int pos, n;
+
+	samples = g_try_new(gfloat, len);
+	if (!samples)
+		return NULL;
+
+	for (pos = 0; pos < len && (n = capture_data_read(pos, &data)); pos += n)
+		memcpy(samples + pos, data[ch], MIN(n, len - pos) * sizeof(gfloat));
+
+	return samples;
+}
+
 G_MODULE_EXPORT void save_as(const char *filename, int type)
 {
 
 	FILE *fp;
-	unsigned int i, j;
+	unsigned int i, j, pos, n;
+	gfloat **data, *samples;
 	double freq;
 	mat_t *mat;
 	matvar_t *matvar;
@@ -446,13 +465,15 @@ G_MODULE_EXPORT void save_as(const char *filename, int type)
 			fprintf(fp, "FreqValidMin\t-%e\n", freq / 2);
 			fprintf(fp, "Y\n");
 
-			for (j = 0; j < num_samples; j++) {
-				for (i = 0; i < num_active_channels ; i++) {
-					fprintf(fp, "%g", channel_data[i][j]);
-					if (i < (num_active_channels - 1))
-						fprintf(fp, "\t");
+			for (pos = 0; (n = capture_data_read(pos, &data)); pos += n) {
+				for (j = 0; j < n; j++) {
+					for (i = 0; i < num_active_channels ; i++) {
+						fprintf(fp, "%g", data[i][j]);
+						if (i < (num_active_channels - 1))
+							fprintf(fp, "\t");
+					}
+					fprintf(fp, "\n");
 				}
-				fprintf(fp, "\n");
 			}
 			fprintf(fp, "\n");
 			fclose(fp);
@@ -474,20 +495,26 @@ G_MODULE_EXPORT void save_as(const char *filename, int type)
 				sprintf(name, "%s.mat", filename);
 
 			dims[1] = 1;
-			dims[0] = num_samples;
+			dims[0] = capture_data_samples();
 
 			mat = Mat_Open(name, MAT_ACC_RDWR);
 			if(mat) {
 				for (i = 0; i < num_active_channels; i++) {
 					sprintf(tmp, "in_voltage%d", i);
+					samples = capture_channel_copy(i, dims[0]);
+					if (!samples) {
+						printf("out of memory saving channel %i\n", i);
+						continue;
+					}
 					matvar = Mat_VarCreate(tmp, MAT_C_SINGLE,
-						MAT_T_SINGLE , 2, dims, channel_data[i], 0);
+						MAT_T_SINGLE , 2, dims, samples, 0);
 					if (!matvar)
 						printf("error creating matvar on channel %i\n", i);
 					else {
 						Mat_VarWrite(mat, matvar, 0);
 						Mat_VarFree(matvar);
 					}
+					g_free(samples);
 				}
 				Mat_Close(mat);
 			}
@@ -509,13 +536,15 @@ G_MODULE_EXPORT void save_as(const char *filename, int type)
 			if (!fp)
 				break;
 
-			for (j = 0; j < num_samples; j++) {
-				for (i = 0; i < num_active_channels ; i++) {
-					fprintf(fp, "%g", channel_data[i][j]);
-					if (i < (num_active_channels - 1))
-						fprintf(fp, ", ");
+			for (pos = 0; (n = capture_data_read(pos, &data)); pos += n) {
+				for (j = 0; j < n; j++) {
+					for (i = 0; i < num_active_channels ; i++) {
+						fprintf(fp, "%g", data[i][j]);
+						if (i < (num_active_channels - 1))
+							fprintf(fp, ", ");
+					}
+					fprintf(fp, "\n");
 				}
-				fprintf(fp, "\n");
 			}
 			fprintf(fp, "\n");
 			fclose(fp);
@@ -584,6 +613,55 @@ G_MODULE_EXPORT void cb_saveas(GtkButton *button, Dialogs *data)
 	gtk_widget_hide(data->saveas);
 }
 
+G_MODULE_EXPORT void cb_record(GtkCheckMenuItem *item, Dialogs *data)
+{
+	static char *filename = NULL;
+	GtkWidget *chooser;
+	gint ret;
+
+	if (!gtk_check_menu_item_get_active(item)) {
+		capture_record_stop();
+		return;
+	}
+
+	if (capture_record_active())
+		return;
+
+	chooser = gtk_file_chooser_dialog_new("Record to Disk", NULL,
+			GTK_FILE_CHOOSER_ACTION_SAVE,
+			GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+			GTK_STOCK_MEDIA_RECORD, GTK_RESPONSE_ACCEPT,
+			NULL);
+	gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(chooser), TRUE);
+
+	if (!filename) {
+		gtk_file_chooser_set_current_folder(GTK_FILE_CHOOSER(chooser), getenv("HOME"));
+		gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(chooser), "capture.rec");
+	} else {
+		gtk_file_chooser_set_filename(GTK_FILE_CHOOSER(chooser), filename);
+	}
+
+	ret = gtk_dialog_run(GTK_DIALOG(chooser));
+	if (ret == GTK_RESPONSE_ACCEPT) {
+		g_free(filename);
+		filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(chooser));
+	}
+	gtk_widget_destroy(chooser);
+
+	if (ret != GTK_RESPONSE_ACCEPT || !filename) {
+		gtk_check_menu_item_set_active(item, FALSE);
+		return;
+	}
+
+	ret = capture_record_start(filename);
+	if (ret < 0) {
+		create_blocking_popup(GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
+				"Record to Disk", "Failed to start recording: %s",
+				ret == -ENODEV ? "start a capture first" : strerror(-ret));
+		gtk_check_menu_item_set_active(item, FALSE);
+	}
+}
+
 G_MODULE_EXPORT void load_save_profile_cb(GtkButton *button, Dialogs *data)
 {
 	/* Save as Dialog */
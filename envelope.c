@@ -0,0 +1,519 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <math.h>
+#include <glib.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(HAVE_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "envelope.h"
+
+/* Smallest and largest of @n (at least one) samples at @data */
+static void envelope_min_max(const gfloat *data, unsigned int n,
+		gfloat *min, gfloat *max)
+{
+	unsigned int i = 0;
+	gfloat lo = data[0], hi = data[0];
+
+#if defined(__SSE2__)
+	if (n >= 4) {
+		__m128 vlo = _mm_loadu_ps(data);
+		__m128 vhi = vlo;
+		__m128 v;
+		gfloat t[4];
+
+		for (i = 4; i + 4 <= n; i += 4) {
+			v = _mm_loadu_ps(data + i);
+			vlo = _mm_min_ps(vlo, v);
+			vhi = _mm_max_ps(vhi, v);
+		}
+
+		_mm_storeu_ps(t, vlo);
+		lo = MIN(MIN(t[0], t[1]), MIN(t[2], t[3]));
+		_mm_storeu_ps(t, vhi);
+		hi = MAX(MAX(t[0], t[1]), MAX(t[2], t[3]));
+	}
+#elif defined(__ARM_NEON) && defined(HAVE_NEON)
+	if (n >= 4) {
+		float32x4_t vlo = vld1q_f32(data);
+		float32x4_t vhi = vlo;
+		float32x4_t v;
+		float32x2_t t;
+
+		for (i = 4; i + 4 <= n; i += 4) {
+			v = vld1q_f32(data + i);
+			vlo = vminq_f32(vlo, v);
+			vhi = vmaxq_f32(vhi, v);
+		}
+
+		t = vpmin_f32(vget_low_f32(vlo), vget_high_f32(vlo));
+		lo = vget_lane_f32(vpmin_f32(t, t), 0);
+		t = vpmax_f32(vget_low_f32(vhi), vget_high_f32(vhi));
+		hi = vget_lane_f32(vpmax_f32(t, t), 0);
+	}
+#endif
+
+	for (; i < n; i++) {
+		if (data[i] < lo)
+			lo = data[i];
+		if (data[i] > hi)
+			hi = data[i];
+	}
+
+	*min = lo;
+	*max = hi;
+}
+
+/*
+ * @out[j] = min (or max) of @in[4j] to @in[4j + 3], for the @n groups of
+ * four in @in.
+ */
+static void envelope_reduce4(const gfloat *in, gfloat *out, unsigned int n,
+		bool max)
+{
+	unsigned int j = 0;
+
+#if defined(__SSE2__)
+	__m128 a, b, c, d;
+
+	/* transposed, each vector holds one sample of four groups */
+	for (; j + 4 <= n; j += 4) {
+		a = _mm_loadu_ps(in + 4 * j);
+		b = _mm_loadu_ps(in + 4 * j + 4);
+		c = _mm_loadu_ps(in + 4 * j + 8);
+		d = _mm_loadu_ps(in + 4 * j + 12);
+		_MM_TRANSPOSE4_PS(a, b, c, d);
+		if (max)
+			a = _mm_max_ps(_mm_max_ps(a, b), _mm_max_ps(c, d));
+		else
+			a = _mm_min_ps(_mm_min_ps(a, b), _mm_min_ps(c, d));
+		_mm_storeu_ps(out + j, a);
+	}
+#elif defined(__ARM_NEON) && defined(HAVE_NEON)
+	float32x4x4_t v;
+
+	for (; j + 4 <= n; j += 4) {
+		v = vld4q_f32(in + 4 * j);
+		if (max)
+			vst1q_f32(out + j, vmaxq_f32(vmaxq_f32(v.val[0], v.val[1]),
+					vmaxq_f32(v.val[2], v.val[3])));
+		else
+			vst1q_f32(out + j, vminq_f32(vminq_f32(v.val[0], v.val[1]),
+					vminq_f32(v.val[2], v.val[3])));
+	}
+#endif
+
+	for (; j < n; j++) {
+		if (max)
+			out[j] = MAX(MAX(in[4 * j], in[4 * j + 1]),
+					MAX(in[4 * j + 2], in[4 * j + 3]));
+		else
+			out[j] = MIN(MIN(in[4 * j], in[4 * j + 1]),
+					MIN(in[4 * j + 2], in[4 * j + 3]));
+	}
+}
+
+/*
+ * Where the raw samples come from: an array, or for data that isn't in
+ * memory as floats, a callback copying pieces of it out.
+ */
+struct envelope_samples {
+	const gfloat *data;
+	envelope_fetch fetch;
+	void *priv;
+};
+
+/* Samples fetched at a time when there is no array to point into */
+#define ENVELOPE_FETCH 1024
+
+/*
+ * Leave out the @skip lowest levels: the samples under an entry of the
+ * lowest kept level are then read again when a span doesn't line up with
+ * it, which saves 4^@skip times the memory.
+ */
+int envelope_pyramid_init_coarse(struct envelope_pyramid *pyr,
+		unsigned int len, unsigned int skip)
+{
+	unsigned int size = len, l;
+
+	if (skip > ENVELOPE_MAX_SKIP)
+		return -EINVAL;
+
+	memset(pyr, 0, sizeof(*pyr));
+	pyr->len = len;
+	pyr->skip = skip;
+
+	for (l = 0; l < ENVELOPE_MAX_LEVELS && size > 1; l++) {
+		size = (size + 3) >> ENVELOPE_LEVEL_SHIFT;
+		pyr->size[l] = size;
+		pyr->num_levels = l + 1;
+		if (l < skip)
+			continue;
+		pyr->min[l] = g_new(gfloat, size);
+		pyr->max[l] = g_new(gfloat, size);
+		if (!pyr->min[l] || !pyr->max[l]) {
+			envelope_pyramid_free(pyr);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+int envelope_pyramid_init(struct envelope_pyramid *pyr, unsigned int len)
+{
+	int ret = envelope_pyramid_init_coarse(pyr, len, 0);
+
+	/* filled in at random with envelope_pyramid_update() */
+	pyr->filled = len;
+
+	return ret;
+}
+
+void envelope_pyramid_free(struct envelope_pyramid *pyr)
+{
+	unsigned int l;
+
+	for (l = 0; l < pyr->num_levels; l++) {
+		g_free(pyr->min[l]);
+		g_free(pyr->max[l]);
+	}
+	memset(pyr, 0, sizeof(*pyr));
+}
+
+/*
+ * Recompute entries @from to @to (excluded) of level @l from the first
+ * @in_size entries, or samples, of the level below.
+ */
+static void envelope_level_update(struct envelope_pyramid *pyr, unsigned int l,
+		const gfloat *in_min, const gfloat *in_max, unsigned int in_size,
+		unsigned int from, unsigned int to)
+{
+	unsigned int j, k, full;
+
+	/* the last group of a level may be short */
+	full = MIN(to, in_size >> ENVELOPE_LEVEL_SHIFT);
+	if (full > from) {
+		envelope_reduce4(in_min + 4 * from, pyr->min[l] + from,
+				full - from, false);
+		envelope_reduce4(in_max + 4 * from, pyr->max[l] + from,
+				full - from, true);
+	}
+	for (j = MAX(full, from); j < to; j++) {
+		pyr->min[l][j] = in_min[4 * j];
+		pyr->max[l][j] = in_max[4 * j];
+		for (k = 4 * j + 1; k < MIN(4 * j + 4, in_size); k++) {
+			pyr->min[l][j] = MIN(pyr->min[l][j], in_min[k]);
+			pyr->max[l][j] = MAX(pyr->max[l][j], in_max[k]);
+		}
+	}
+}
+
+/*
+ * Samples @from to @to (excluded) of @data changed: refresh the entries
+ * of each level covering them. Meant to be called on each new piece of a
+ * capture while it is still in the cache.
+ */
+void envelope_pyramid_update(struct envelope_pyramid *pyr,
+		const gfloat *data, unsigned int from, unsigned int to)
+{
+	const gfloat *in_min = data, *in_max = data;
+	unsigned int in_size = pyr->len;
+	unsigned int l;
+
+	to = MIN(to, pyr->len);
+	if (from >= to || pyr->skip)
+		return;
+
+	for (l = 0; l < pyr->num_levels; l++) {
+		from >>= ENVELOPE_LEVEL_SHIFT;
+		to = (to + 3) >> ENVELOPE_LEVEL_SHIFT;
+
+		envelope_level_update(pyr, l, in_min, in_max, in_size, from, to);
+
+		in_min = pyr->min[l];
+		in_max = pyr->max[l];
+		in_size = pyr->size[l];
+	}
+}
+
+/*
+ * Reduce the @n entries at @in_min / @in_max by four into @out_min /
+ * @out_max, which may be the same arrays.
+ */
+static void envelope_reduce_level(const gfloat *in_min, const gfloat *in_max,
+		unsigned int n, gfloat *out_min, gfloat *out_max)
+{
+	unsigned int full = n >> ENVELOPE_LEVEL_SHIFT, k;
+
+	envelope_reduce4(in_min, out_min, full, false);
+	envelope_reduce4(in_max, out_max, full, true);
+	if (4 * full == n)
+		return;
+
+	out_min[full] = in_min[4 * full];
+	out_max[full] = in_max[4 * full];
+	for (k = 4 * full + 1; k < n; k++) {
+		out_min[full] = MIN(out_min[full], in_min[k]);
+		out_max[full] = MAX(out_max[full], in_max[k]);
+	}
+}
+
+/* One piece of envelope_pyramid_append(), @n at most ENVELOPE_APPEND_ALIGN */
+static void envelope_pyramid_append_piece(struct envelope_pyramid *pyr,
+		const gfloat *data, unsigned int n)
+{
+	gfloat tmp_min[ENVELOPE_APPEND_ALIGN / 4], tmp_max[ENVELOPE_APPEND_ALIGN / 4];
+	const gfloat *in_min = data, *in_max = data;
+	unsigned int first = pyr->filled, l, k, j, full, lo, hi;
+
+	pyr->filled += n;
+	if (pyr->skip >= pyr->num_levels)
+		return;
+
+	/* The levels left out only live as long as the piece */
+	for (l = 0; l < pyr->skip; l++) {
+		envelope_reduce_level(in_min, in_max, n, tmp_min, tmp_max);
+		n = (n + 3) >> ENVELOPE_LEVEL_SHIFT;
+		in_min = tmp_min;
+		in_max = tmp_max;
+	}
+
+	/*
+	 * The entries of the lowest kept level may have been started by the
+	 * previous piece: fold into those, start the others afresh.
+	 */
+	l = pyr->skip;
+	first >>= ENVELOPE_LEVEL_SHIFT * l;
+	lo = first >> ENVELOPE_LEVEL_SHIFT;
+	hi = (first + n + 3) >> ENVELOPE_LEVEL_SHIFT;
+	for (k = 0; k < n; ) {
+		j = (first + k) >> ENVELOPE_LEVEL_SHIFT;
+		if (!((first + k) & 3) && n - k >= 4) {
+			full = (n - k) >> ENVELOPE_LEVEL_SHIFT;
+			envelope_reduce4(in_min + k, pyr->min[l] + j, full, false);
+			envelope_reduce4(in_max + k, pyr->max[l] + j, full, true);
+			k += 4 * full;
+		} else if (!((first + k) & 3)) {
+			pyr->min[l][j] = in_min[k];
+			pyr->max[l][j] = in_max[k];
+			k++;
+		} else {
+			pyr->min[l][j] = MIN(pyr->min[l][j], in_min[k]);
+			pyr->max[l][j] = MAX(pyr->max[l][j], in_max[k]);
+			k++;
+		}
+	}
+
+	/* Above it, the entries touched are rebuilt from the valid ones below */
+	for (l++; l < pyr->num_levels; l++) {
+		lo >>= ENVELOPE_LEVEL_SHIFT;
+		hi = (hi + 3) >> ENVELOPE_LEVEL_SHIFT;
+		k = ENVELOPE_LEVEL_SHIFT * l;
+		envelope_level_update(pyr, l, pyr->min[l - 1], pyr->max[l - 1],
+				(pyr->filled + (1U << k) - 1) >> k, lo, hi);
+	}
+}
+
+/*
+ * Fold the @n samples at @data, the ones following those appended so far,
+ * into the pyramid. @n must be a multiple of ENVELOPE_APPEND_ALIGN unless
+ * the capture ends with them.
+ */
+void envelope_pyramid_append(struct envelope_pyramid *pyr,
+		const gfloat *data, unsigned int n)
+{
+	unsigned int len;
+
+	n = MIN(n, pyr->len - pyr->filled);
+	for (; n; n -= len, data += len) {
+		len = MIN(n, ENVELOPE_APPEND_ALIGN);
+		envelope_pyramid_append_piece(pyr, data, len);
+	}
+}
+
+/* Min and max of samples @start to @end (excluded), folded into @min and @max */
+static void envelope_samples_min_max(const struct envelope_samples *src,
+		unsigned int start, unsigned int end, gfloat *min, gfloat *max)
+{
+	gfloat buf[ENVELOPE_FETCH], lo, hi;
+	unsigned int n;
+
+	if (src->data) {
+		envelope_min_max(src->data + start, end - start, &lo, &hi);
+		*min = MIN(*min, lo);
+		*max = MAX(*max, hi);
+		return;
+	}
+
+	for (; start < end; start += n) {
+		n = MIN(end - start, ENVELOPE_FETCH);
+		src->fetch(src->priv, start, n, buf);
+		envelope_min_max(buf, n, &lo, &hi);
+		*min = MIN(*min, lo);
+		*max = MAX(*max, hi);
+	}
+}
+
+static gfloat envelope_sample(const struct envelope_samples *src,
+		unsigned int i)
+{
+	gfloat v;
+
+	if (src->data)
+		return src->data[i];
+
+	src->fetch(src->priv, i, 1, &v);
+	return v;
+}
+
+/*
+ * Min and max of samples @start to @end (excluded), from the entries of
+ * @level and below that fit in the span, folded into @min and @max.
+ */
+static void envelope_pyramid_min_max(const struct envelope_pyramid *pyr,
+		const struct envelope_samples *src, unsigned int start,
+		unsigned int end, int level, gfloat *min, gfloat *max)
+{
+	unsigned int shift, s, e, j;
+
+	if (start >= end)
+		return;
+
+	for (; level >= (int)pyr->skip; level--) {
+		shift = ENVELOPE_LEVEL_SHIFT * (level + 1);
+		s = (start + (1U << shift) - 1) >> shift;
+		e = end >> shift;
+		if (s < e)
+			break;
+	}
+
+	if (level < (int)pyr->skip) {
+		envelope_samples_min_max(src, start, end, min, max);
+		return;
+	}
+
+	for (j = s; j < e; j++) {
+		*min = MIN(*min, pyr->min[level][j]);
+		*max = MAX(*max, pyr->max[level][j]);
+	}
+
+	envelope_pyramid_min_max(pyr, src, start, s << shift, level - 1, min, max);
+	envelope_pyramid_min_max(pyr, src, e << shift, end, level - 1, min, max);
+}
+
+static void envelope_reduce_samples(const struct envelope_pyramid *pyr,
+		const struct envelope_samples *src, unsigned int len,
+		gfloat left, gfloat right, unsigned int columns,
+		gfloat *x, gfloat *y)
+{
+	unsigned int points = ENVELOPE_POINTS(columns);
+	unsigned int first, last, span, start, end, c, i, n = 0;
+	gfloat t;
+
+	if (!len) {
+		for (; n < points; n++)
+			x[n] = y[n] = 0.0f;
+		return;
+	}
+
+	if (left > right) {
+		t = left;
+		left = right;
+		right = t;
+	}
+
+	first = left > 0 ? MIN((unsigned int)floorf(left), len - 1) : 0;
+	last = right > 0 ? MIN((unsigned int)ceilf(right), len - 1) : 0;
+	if (first > 0)
+		first--;
+	if (last < len - 1)
+		last++;
+	span = last - first + 1;
+
+	/* a pyramid only helps with the samples it was filled with */
+	if (pyr && (pyr->len < len || pyr->filled < len))
+		pyr = NULL;
+
+	if (span <= points) {
+		if (src->data)
+			memcpy(y, src->data + first, span * sizeof(*y));
+		else
+			src->fetch(src->priv, first, span, y);
+		for (i = first; i <= last; i++, n++)
+			x[n] = i;
+	} else {
+		x[n] = first;
+		y[n++] = envelope_sample(src, first);
+
+		/* the columns share out the samples between the two edge ones */
+		span -= 2;
+		for (c = 0; c < columns; c++) {
+			start = first + 1 + (guint64)span * c / columns;
+			end = first + 1 + (guint64)span * (c + 1) / columns;
+			y[n] = G_MAXFLOAT;
+			y[n + 1] = -G_MAXFLOAT;
+			if (pyr)
+				envelope_pyramid_min_max(pyr, src, start, end,
+						pyr->num_levels - 1, &y[n], &y[n + 1]);
+			else
+				envelope_samples_min_max(src, start, end,
+						&y[n], &y[n + 1]);
+			x[n] = x[n + 1] = start;
+			n += 2;
+		}
+
+		x[n] = last;
+		y[n++] = envelope_sample(src, last);
+	}
+
+	for (; n < points; n++) {
+		x[n] = x[n - 1];
+		y[n] = y[n - 1];
+	}
+}
+
+/*
+ * Reduce the samples of @data (sample i being at x = i) between @left and
+ * @right to @columns min / max pairs, filling ENVELOPE_POINTS(@columns)
+ * points of @x and @y. One sample on either side of the range is kept, so
+ * the trace runs off the edges of the plot the way the real one would.
+ * When the range holds fewer samples than that, they are copied as they
+ * are. The unused tail repeats the last point, which draws nothing.
+ * With @pyr summarising @data, each column costs a few entries of it
+ * rather than a pass over its samples.
+ */
+void envelope_reduce(const struct envelope_pyramid *pyr,
+		const gfloat *data, unsigned int len,
+		gfloat left, gfloat right, unsigned int columns,
+		gfloat *x, gfloat *y)
+{
+	struct envelope_samples src = { .data = data };
+
+	envelope_reduce_samples(pyr, &src, len, left, right, columns, x, y);
+}
+
+/*
+ * Same as envelope_reduce(), for a channel that is only reachable through
+ * @fetch. Best used with a pyramid, so that few samples need fetching.
+ */
+void envelope_reduce_fetch(const struct envelope_pyramid *pyr,
+		envelope_fetch fetch, void *priv, unsigned int len,
+		gfloat left, gfloat right, unsigned int columns,
+		gfloat *x, gfloat *y)
+{
+	struct envelope_samples src = { .fetch = fetch, .priv = priv };
+
+	envelope_reduce_samples(pyr, &src, len, left, right, columns, x, y);
+}
@@ -0,0 +1,86 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __ENVELOPE_H__
+#define __ENVELOPE_H__
+
+#include <glib.h>
+
+/*
+ * Peak-detect decimation for the display: a channel is reduced to the
+ * minimum and maximum of the samples falling in each pixel column of the
+ * visible range, so drawing costs the same whatever the capture depth,
+ * and glitches narrower than a pixel still show.
+ */
+
+#define ENVELOPE_MIN_COLUMNS 64
+#define ENVELOPE_MAX_COLUMNS 4096
+
+/* Length of the x / y arrays filled for @columns */
+#define ENVELOPE_POINTS(columns) (2 * (columns) + 2)
+
+/*
+ * Level 0 of the pyramid holds the min and max of each group of four
+ * samples, every level above the min and max of four entries of the one
+ * below, so an entry of level n covers 4^(n+1) samples. Any span of
+ * samples is then covered by a handful of entries, whatever its length.
+ */
+#define ENVELOPE_LEVEL_SHIFT 2
+#define ENVELOPE_MAX_LEVELS 12
+
+/*
+ * A coarse pyramid leaves out its lowest levels, for captures too deep to
+ * summarise in full. It is filled in order with envelope_pyramid_append(),
+ * in pieces that are a multiple of ENVELOPE_APPEND_ALIGN samples, but for
+ * the last one.
+ */
+#define ENVELOPE_APPEND_ALIGN 4096
+#define ENVELOPE_MAX_SKIP 5
+
+/* Copies samples @start to @start + @n (excluded) of a channel to @out */
+typedef void (*envelope_fetch)(void *priv, unsigned int start,
+		unsigned int n, gfloat *out);
+
+/**
+ * struct envelope_pyramid - min / max summaries of a channel
+ * @len: number of samples summarised
+ * @filled: number of samples the entries are valid for
+ * @skip: number of the lowest levels left out
+ * @num_levels: number of levels in use
+ * @size: number of entries of each level
+ * @min: minimums, per level
+ * @max: maximums, per level
+ **/
+struct envelope_pyramid {
+	unsigned int len;
+	unsigned int filled;
+	unsigned int skip;
+	unsigned int num_levels;
+	unsigned int size[ENVELOPE_MAX_LEVELS];
+	gfloat *min[ENVELOPE_MAX_LEVELS];
+	gfloat *max[ENVELOPE_MAX_LEVELS];
+};
+
+int envelope_pyramid_init(struct envelope_pyramid *pyr, unsigned int len);
+int envelope_pyramid_init_coarse(struct envelope_pyramid *pyr,
+		unsigned int len, unsigned int skip);
+void envelope_pyramid_free(struct envelope_pyramid *pyr);
+void envelope_pyramid_update(struct envelope_pyramid *pyr,
+		const gfloat *data, unsigned int from, unsigned int to);
+void envelope_pyramid_append(struct envelope_pyramid *pyr,
+		const gfloat *data, unsigned int n);
+
+void envelope_reduce(const struct envelope_pyramid *pyr,
+		const gfloat *data, unsigned int len,
+		gfloat left, gfloat right, unsigned int columns,
+		gfloat *x, gfloat *y);
+void envelope_reduce_fetch(const struct envelope_pyramid *pyr,
+		envelope_fetch fetch, void *priv, unsigned int len,
+		gfloat left, gfloat right, unsigned int columns,
+		gfloat *x, gfloat *y);
+
+#endif
@@ -0,0 +1,374 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <math.h>
+#include <float.h>
+#include <endian.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(HAVE_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "fft_kernels.h"
+
+/* 10 / ln(10), to get dB from a natural log */
+#define DB_PER_NEPER 4.342944819f
+
+/*
+ * The vector logs below are the Cephes logf: the mantissa is brought to
+ * [sqrt(2)/2, sqrt(2)) and ln(1 + x) is a degree 9 polynomial there, good
+ * to a couple of ulp, far below what a plot shows. Zero and denormals
+ * are clamped to FLT_MIN, about -379 dB, rather than giving -inf.
+ */
+#define LOG_P0 7.0376836292E-2f
+#define LOG_P1 -1.1514610310E-1f
+#define LOG_P2 1.1676998740E-1f
+#define LOG_P3 -1.2420140846E-1f
+#define LOG_P4 1.4249322787E-1f
+#define LOG_P5 -1.6668057665E-1f
+#define LOG_P6 2.0000714765E-1f
+#define LOG_P7 -2.4999993993E-1f
+#define LOG_P8 3.3333331174E-1f
+#define LOG_Q1 -2.12194440E-4f
+#define LOG_Q2 0.693359375f
+#define LOG_SQRTHF 0.707106781186547524f
+
+#if defined(__SSE2__)
+
+static inline __m128 log_sse2(__m128 x)
+{
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 e, mask, y, z;
+	__m128i emm0;
+
+	x = _mm_max_ps(x, _mm_set1_ps(FLT_MIN));
+	emm0 = _mm_srli_epi32(_mm_castps_si128(x), 23);
+	x = _mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(~0x7f800000)));
+	x = _mm_or_ps(x, _mm_set1_ps(0.5f));
+	e = _mm_cvtepi32_ps(_mm_sub_epi32(emm0, _mm_set1_epi32(0x7e)));
+
+	mask = _mm_cmplt_ps(x, _mm_set1_ps(LOG_SQRTHF));
+	e = _mm_sub_ps(e, _mm_and_ps(one, mask));
+	x = _mm_add_ps(_mm_sub_ps(x, one), _mm_and_ps(x, mask));
+
+	z = _mm_mul_ps(x, x);
+	y = _mm_set1_ps(LOG_P0);
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(LOG_P1));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(LOG_P2));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(LOG_P3));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(LOG_P4));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(LOG_P5));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(LOG_P6));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(LOG_P7));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(LOG_P8));
+	y = _mm_mul_ps(_mm_mul_ps(y, x), z);
+
+	y = _mm_add_ps(y, _mm_mul_ps(e, _mm_set1_ps(LOG_Q1)));
+	y = _mm_sub_ps(y, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+	x = _mm_add_ps(x, y);
+
+	return _mm_add_ps(x, _mm_mul_ps(e, _mm_set1_ps(LOG_Q2)));
+}
+
+#elif defined(__ARM_NEON) && defined(HAVE_NEON)
+
+static inline float32x4_t log_neon(float32x4_t x)
+{
+	float32x4_t one = vdupq_n_f32(1.0f);
+	float32x4_t e, y, z;
+	uint32x4_t mask;
+	int32x4_t emm0;
+
+	x = vmaxq_f32(x, vdupq_n_f32(FLT_MIN));
+	emm0 = vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_f32(x), 23));
+	x = vreinterpretq_f32_u32(vorrq_u32(vandq_u32(vreinterpretq_u32_f32(x),
+				vdupq_n_u32(~0x7f800000)),
+			vreinterpretq_u32_f32(vdupq_n_f32(0.5f))));
+	e = vcvtq_f32_s32(vsubq_s32(emm0, vdupq_n_s32(0x7e)));
+
+	mask = vcltq_f32(x, vdupq_n_f32(LOG_SQRTHF));
+	e = vsubq_f32(e, vreinterpretq_f32_u32(vandq_u32(
+				vreinterpretq_u32_f32(one), mask)));
+	x = vaddq_f32(vsubq_f32(x, one), vreinterpretq_f32_u32(vandq_u32(
+				vreinterpretq_u32_f32(x), mask)));
+
+	z = vmulq_f32(x, x);
+	y = vdupq_n_f32(LOG_P0);
+	y = vmlaq_f32(vdupq_n_f32(LOG_P1), y, x);
+	y = vmlaq_f32(vdupq_n_f32(LOG_P2), y, x);
+	y = vmlaq_f32(vdupq_n_f32(LOG_P3), y, x);
+	y = vmlaq_f32(vdupq_n_f32(LOG_P4), y, x);
+	y = vmlaq_f32(vdupq_n_f32(LOG_P5), y, x);
+	y = vmlaq_f32(vdupq_n_f32(LOG_P6), y, x);
+	y = vmlaq_f32(vdupq_n_f32(LOG_P7), y, x);
+	y = vmlaq_f32(vdupq_n_f32(LOG_P8), y, x);
+	y = vmulq_f32(vmulq_f32(y, x), z);
+
+	y = vmlaq_f32(y, e, vdupq_n_f32(LOG_Q1));
+	y = vmlsq_f32(y, z, vdupq_n_f32(0.5f));
+	x = vaddq_f32(x, y);
+
+	return vmlaq_f32(x, e, vdupq_n_f32(LOG_Q2));
+}
+
+#endif
+
+/*
+ * @n little endian samples times their window weights. Complex input is
+ * just twice as many values, with each weight repeated for I and Q.
+ */
+void fft_window_s16(float *dst, const int16_t *src, const float *win,
+		unsigned int n)
+{
+	unsigned int i = 0;
+
+#if defined(__SSE2__) && __BYTE_ORDER == __LITTLE_ENDIAN
+	__m128i v;
+
+	for (; i + 8 <= n; i += 8) {
+		v = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(win + i),
+				_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16))));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_loadu_ps(win + i + 4),
+				_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16))));
+	}
+#elif defined(__ARM_NEON) && defined(HAVE_NEON) && __BYTE_ORDER == __LITTLE_ENDIAN
+	int16x8_t v;
+
+	for (; i + 8 <= n; i += 8) {
+		v = vld1q_s16(src + i);
+		vst1q_f32(dst + i, vmulq_f32(vld1q_f32(win + i),
+				vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)))));
+		vst1q_f32(dst + i + 4, vmulq_f32(vld1q_f32(win + i + 4),
+				vcvtq_f32_s32(vmovl_s16(vget_high_s16(v)))));
+	}
+#endif
+
+	for (; i < n; i++)
+		dst[i] = (int16_t)le16toh(src[i]) * win[i];
+}
+
+/* 10 * log10(re^2 + im^2) + @offset of @n complex values in @src */
+void fft_power_db(float *dst, const float *src, unsigned int n, float offset)
+{
+	unsigned int i = 0;
+	float p;
+
+#if defined(__SSE2__)
+	__m128 a, b, re, im;
+
+	for (; i + 4 <= n; i += 4) {
+		a = _mm_loadu_ps(src + 2 * i);
+		b = _mm_loadu_ps(src + 2 * i + 4);
+		re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+		a = _mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im));
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_set1_ps(offset),
+				_mm_mul_ps(log_sse2(a), _mm_set1_ps(DB_PER_NEPER))));
+	}
+#elif defined(__ARM_NEON) && defined(HAVE_NEON)
+	float32x4x2_t v;
+	float32x4_t a;
+
+	for (; i + 4 <= n; i += 4) {
+		v = vld2q_f32(src + 2 * i);
+		a = vmlaq_f32(vmulq_f32(v.val[0], v.val[0]), v.val[1], v.val[1]);
+		vst1q_f32(dst + i, vmlaq_f32(vdupq_n_f32(offset), log_neon(a),
+				vdupq_n_f32(DB_PER_NEPER)));
+	}
+#endif
+
+	for (; i < n; i++) {
+		p = src[2 * i] * src[2 * i] + src[2 * i + 1] * src[2 * i + 1];
+		dst[i] = DB_PER_NEPER * logf(p < FLT_MIN ? FLT_MIN : p) + offset;
+	}
+}
+
+/*
+ * The same for the double precision transform, which isn't vectorized.
+ * Powers are clamped to FLT_MIN too, so both precisions agree on silence.
+ */
+void fft_power_db_d(float *dst, const double *src, unsigned int n,
+		double offset)
+{
+	unsigned int i;
+	double p;
+
+	for (i = 0; i < n; i++) {
+		p = src[2 * i] * src[2 * i] + src[2 * i + 1] * src[2 * i + 1];
+		dst[i] = 10 * log10(p < FLT_MIN ? FLT_MIN : p) + offset;
+	}
+}
+
+/* Adds re^2 + im^2 of @n complex values in @src to @acc */
+void fft_power_acc(float *acc, const float *src, unsigned int n)
+{
+	unsigned int i = 0;
+
+#if defined(__SSE2__)
+	__m128 a, b, re, im;
+
+	for (; i + 4 <= n; i += 4) {
+		a = _mm_loadu_ps(src + 2 * i);
+		b = _mm_loadu_ps(src + 2 * i + 4);
+		re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+		a = _mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im));
+		_mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), a));
+	}
+#elif defined(__ARM_NEON) && defined(HAVE_NEON)
+	float32x4x2_t v;
+
+	for (; i + 4 <= n; i += 4) {
+		v = vld2q_f32(src + 2 * i);
+		vst1q_f32(acc + i, vmlaq_f32(vmlaq_f32(vld1q_f32(acc + i),
+				v.val[0], v.val[0]), v.val[1], v.val[1]));
+	}
+#endif
+
+	for (; i < n; i++)
+		acc[i] += src[2 * i] * src[2 * i] + src[2 * i + 1] * src[2 * i + 1];
+}
+
+void fft_power_acc_d(float *acc, const double *src, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		acc[i] += src[2 * i] * src[2 * i] + src[2 * i + 1] * src[2 * i + 1];
+}
+
+/* 10 * log10(@src) + @offset, for @n powers */
+void fft_db(float *dst, const float *src, unsigned int n, float offset)
+{
+	unsigned int i = 0;
+
+#if defined(__SSE2__)
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_set1_ps(offset),
+				_mm_mul_ps(log_sse2(_mm_loadu_ps(src + i)),
+					_mm_set1_ps(DB_PER_NEPER))));
+#elif defined(__ARM_NEON) && defined(HAVE_NEON)
+	for (; i + 4 <= n; i += 4)
+		vst1q_f32(dst + i, vmlaq_f32(vdupq_n_f32(offset),
+				log_neon(vld1q_f32(src + i)),
+				vdupq_n_f32(DB_PER_NEPER)));
+#endif
+
+	for (; i < n; i++)
+		dst[i] = DB_PER_NEPER * logf(src[i] < FLT_MIN ? FLT_MIN : src[i]) +
+			offset;
+}
+
+/*
+ * The averaging modes of the FFT plot, one loop each rather than one
+ * loop testing the mode for every bin.
+ */
+
+/* Keep the peaks */
+void fft_avg_max(float *trace, const float *db, unsigned int n)
+{
+	unsigned int i = 0;
+
+#if defined(__SSE2__)
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(trace + i, _mm_max_ps(_mm_loadu_ps(trace + i),
+				_mm_loadu_ps(db + i)));
+#elif defined(__ARM_NEON) && defined(HAVE_NEON)
+	for (; i + 4 <= n; i += 4)
+		vst1q_f32(trace + i, vmaxq_f32(vld1q_f32(trace + i),
+				vld1q_f32(db + i)));
+#endif
+
+	for (; i < n; i++)
+		if (trace[i] <= db[i])
+			trace[i] = db[i];
+}
+
+/* Keep the minimums */
+void fft_avg_min(float *trace, const float *db, unsigned int n)
+{
+	unsigned int i = 0;
+
+#if defined(__SSE2__)
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(trace + i, _mm_min_ps(_mm_loadu_ps(trace + i),
+				_mm_loadu_ps(db + i)));
+#elif defined(__ARM_NEON) && defined(HAVE_NEON)
+	for (; i + 4 <= n; i += 4)
+		vst1q_f32(trace + i, vminq_f32(vld1q_f32(trace + i),
+				vld1q_f32(db + i)));
+#endif
+
+	for (; i < n; i++)
+		if (trace[i] >= db[i])
+			trace[i] = db[i];
+}
+
+/* Exponential average, giving the new spectrum a weight of @a */
+void fft_avg_exp(float *trace, const float *db, unsigned int n, float a)
+{
+	unsigned int i = 0;
+
+#if defined(__SSE2__)
+	__m128 t, va = _mm_set1_ps(a);
+
+	for (; i + 4 <= n; i += 4) {
+		t = _mm_loadu_ps(trace + i);
+		t = _mm_add_ps(t, _mm_mul_ps(va, _mm_sub_ps(_mm_loadu_ps(db + i), t)));
+		_mm_storeu_ps(trace + i, t);
+	}
+#elif defined(__ARM_NEON) && defined(HAVE_NEON)
+	float32x4_t t;
+
+	for (; i + 4 <= n; i += 4) {
+		t = vld1q_f32(trace + i);
+		vst1q_f32(trace + i, vmlaq_n_f32(t, vsubq_f32(vld1q_f32(db + i), t), a));
+	}
+#endif
+
+	for (; i < n; i++)
+		trace[i] += a * (db[i] - trace[i]);
+}
+
+void fft_vec_add(float *sum, const float *src, unsigned int n)
+{
+	unsigned int i = 0;
+
+#if defined(__SSE2__)
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(sum + i, _mm_add_ps(_mm_loadu_ps(sum + i),
+				_mm_loadu_ps(src + i)));
+#elif defined(__ARM_NEON) && defined(HAVE_NEON)
+	for (; i + 4 <= n; i += 4)
+		vst1q_f32(sum + i, vaddq_f32(vld1q_f32(sum + i),
+				vld1q_f32(src + i)));
+#endif
+
+	for (; i < n; i++)
+		sum[i] += src[i];
+}
+
+void fft_vec_scale(float *dst, const float *src, unsigned int n, float k)
+{
+	unsigned int i = 0;
+
+#if defined(__SSE2__)
+	__m128 vk = _mm_set1_ps(k);
+
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(src + i), vk));
+#elif defined(__ARM_NEON) && defined(HAVE_NEON)
+	for (; i + 4 <= n; i += 4)
+		vst1q_f32(dst + i, vmulq_n_f32(vld1q_f32(src + i), k));
+#endif
+
+	for (; i < n; i++)
+		dst[i] = src[i] * k;
+}
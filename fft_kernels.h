@@ -0,0 +1,34 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __FFT_KERNELS_H__
+#define __FFT_KERNELS_H__
+
+#include <stdint.h>
+
+/*
+ * Single precision loops around the FFT: samples into the transform's
+ * input, its output into dB, and dB into the displayed traces. They are
+ * vectorized on SSE2 (and NEON, when built with HAVE_NEON), with a
+ * scalar tail, and work on any alignment.
+ */
+
+void fft_window_s16(float *dst, const int16_t *src, const float *win,
+		unsigned int n);
+void fft_power_db(float *dst, const float *src, unsigned int n, float offset);
+void fft_power_db_d(float *dst, const double *src, unsigned int n,
+		double offset);
+void fft_power_acc(float *acc, const float *src, unsigned int n);
+void fft_power_acc_d(float *acc, const double *src, unsigned int n);
+void fft_db(float *dst, const float *src, unsigned int n, float offset);
+void fft_avg_max(float *trace, const float *db, unsigned int n);
+void fft_avg_min(float *trace, const float *db, unsigned int n);
+void fft_avg_exp(float *trace, const float *db, unsigned int n, float a);
+void fft_vec_add(float *sum, const float *src, unsigned int n);
+void fft_vec_scale(float *dst, const float *src, unsigned int n, float k);
+
+#endif
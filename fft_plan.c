@@ -0,0 +1,670 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <glib.h>
+
+#include "fft_plan.h"
+
+/**
+ * struct fft_plan_req - a plan asked of the planning helper
+ * @size: FFT size
+ * @channels: number of channels
+ * @complex: whether the channels are I/Q pairs
+ * @single: whether to plan in single precision
+ * @flags: FFTW planner flags
+ **/
+struct fft_plan_req {
+	unsigned int size;
+	unsigned int channels;
+	bool complex;
+	bool single;
+	unsigned int flags;
+};
+
+static const unsigned int rigor_flags[FFT_RIGOR_NUM] = {
+	[FFT_RIGOR_ESTIMATE] = FFTW_ESTIMATE,
+	[FFT_RIGOR_MEASURE] = FFTW_MEASURE,
+	[FFT_RIGOR_PATIENT] = FFTW_PATIENT,
+};
+
+static const char * const rigor_names[FFT_RIGOR_NUM] = {
+	[FFT_RIGOR_ESTIMATE] = "estimate",
+	[FFT_RIGOR_MEASURE] = "measure",
+	[FFT_RIGOR_PATIENT] = "patient",
+};
+
+/* Only execution is thread safe in FFTW: planning, wisdom and destroy aren't */
+G_LOCK_DEFINE_STATIC(fft_planner);
+
+/* Set from the GUI while the DSP threads plan, so only used atomically */
+static volatile gint plan_rigor;
+#ifdef HAVE_FFTWF
+static volatile gint plan_single = true;
+#else
+static volatile gint plan_single;
+#endif
+static char *wisdom_path;
+/* 0 if FFTW has no thread support */
+static int plan_threads;
+#ifdef HAVE_FFTWF
+static char *wisdom_path_f;
+#endif
+
+/* The planning helper process and the socket to it, -1 if there is none */
+static pid_t helper = -1;
+static int helper_fd = -1;
+/* set once the helper stopped answering */
+static volatile gint helper_lost;
+/* the socket to the helper, for the planners of all the caches */
+G_LOCK_DEFINE_STATIC(fft_helper);
+
+static double win_hanning(int j, int n)
+{
+	double a = 2.0*M_PI/(n-1), w;
+
+	w = 0.5 * (1.0 - cos(a*j));
+
+	return (w);
+}
+
+/* Frees the buffers and plan of @p, sizes and the rest are kept */
+static void fft_buffers_free(struct fft_plan *p)
+{
+	G_LOCK(fft_planner);
+	if (p->plan)
+		fftw_destroy_plan(p->plan);
+#ifdef HAVE_FFTWF
+	if (p->plan_f)
+		fftwf_destroy_plan(p->plan_f);
+#endif
+	G_UNLOCK(fft_planner);
+
+	fftw_free(p->in);
+	fftw_free(p->in_c);
+	fftw_free(p->out);
+	p->plan = NULL;
+	p->in = NULL;
+	p->in_c = NULL;
+	p->out = NULL;
+#ifdef HAVE_FFTWF
+	fftwf_free(p->in_f);
+	fftwf_free(p->out_f);
+	p->plan_f = NULL;
+	p->in_f = NULL;
+	p->out_f = NULL;
+#endif
+}
+
+/* Sets what the transform of @p is, before anything is allocated */
+static void fft_plan_shape(struct fft_plan *p, unsigned int size,
+		unsigned int channels, bool complex, bool single)
+{
+	p->size = size;
+	p->channels = channels;
+	p->complex = complex;
+	p->traces = fft_channels_traces(channels, complex);
+	p->out_dist = p->complex ? size : size / 2 + 1;
+	p->single = single;
+}
+
+/* Transform buffers for the size, channels and precision of @p */
+static int fft_buffers_alloc(struct fft_plan *p)
+{
+	unsigned int n_in = p->size * p->channels;
+	unsigned int n_out = p->out_dist * p->traces;
+
+#ifdef HAVE_FFTWF
+	if (p->single) {
+		p->in_f = fftwf_malloc(sizeof(float) * n_in);
+		p->out_f = fftwf_malloc(sizeof(fftwf_complex) * n_out);
+		if (p->in_f && p->out_f)
+			return 0;
+
+		fft_buffers_free(p);
+		return -ENOMEM;
+	}
+#endif
+
+	if (p->complex)
+		p->in_c = fftw_malloc(sizeof(double) * n_in);
+	else
+		p->in = fftw_malloc(sizeof(double) * n_in);
+	p->out = fftw_malloc(sizeof(fftw_complex) * n_out);
+
+	if ((p->in || p->in_c) && p->out)
+		return 0;
+
+	fft_buffers_free(p);
+	return -ENOMEM;
+}
+
+/*
+ * Plans the transforms of @p's buffers, returns 0 on success. Each one
+ * reads every traces-th complex, or channels-th real, input value.
+ */
+static int fft_plan_make(struct fft_plan *p, unsigned int flags)
+{
+	int n = p->size;
+	int stride = p->complex ? p->traces : p->channels;
+	int threads = 1;
+
+	if (p->size * p->traces >= FFT_THREADS_MIN_POINTS)
+		threads = plan_threads;
+
+	G_LOCK(fft_planner);
+#ifdef HAVE_FFTWF
+	if (plan_threads)
+		fftwf_plan_with_nthreads(threads);
+	if (p->single && p->complex)
+		p->plan_f = fftwf_plan_many_dft(1, &n, p->traces,
+				(fftwf_complex *)p->in_f, NULL, stride, 1,
+				p->out_f, NULL, 1, p->out_dist,
+				FFTW_FORWARD, flags);
+	else if (p->single)
+		p->plan_f = fftwf_plan_many_dft_r2c(1, &n, p->traces,
+				p->in_f, NULL, stride, 1,
+				p->out_f, NULL, 1, p->out_dist, flags);
+	else
+#endif
+	{
+		if (plan_threads)
+			fftw_plan_with_nthreads(threads);
+		if (p->complex)
+			p->plan = fftw_plan_many_dft(1, &n, p->traces,
+					p->in_c, NULL, stride, 1,
+					p->out, NULL, 1, p->out_dist,
+					FFTW_FORWARD, flags);
+		else
+			p->plan = fftw_plan_many_dft_r2c(1, &n, p->traces,
+					p->in, NULL, stride, 1,
+					p->out, NULL, 1, p->out_dist, flags);
+	}
+	G_UNLOCK(fft_planner);
+
+#ifdef HAVE_FFTWF
+	if (p->single)
+		return p->plan_f ? 0 : -EINVAL;
+#endif
+	return p->plan ? 0 : -EINVAL;
+}
+
+static void fft_plan_entry_free(struct fft_plan *e)
+{
+	fft_buffers_free(e);
+	fftw_free(e->win);
+#ifdef HAVE_FFTWF
+	fftwf_free(e->win_f);
+#endif
+	memset(e, 0, sizeof(*e));
+}
+
+static int fft_window_alloc(struct fft_plan *e)
+{
+	unsigned int i;
+
+#ifdef HAVE_FFTWF
+	if (e->single) {
+		unsigned int step = e->channels;
+
+		e->win_f = fftwf_malloc(sizeof(float) * e->size * step);
+		if (!e->win_f)
+			return -ENOMEM;
+		for (i = 0; i < e->size * step; i++)
+			e->win_f[i] = win_hanning(i / step, e->size);
+		return 0;
+	}
+#endif
+
+	e->win = fftw_malloc(sizeof(double) * e->size);
+	if (!e->win)
+		return -ENOMEM;
+	for (i = 0; i < e->size; i++)
+		e->win[i] = win_hanning(i, e->size);
+
+	return 0;
+}
+
+static int fft_plan_entry_init(struct fft_plan *e, unsigned int size,
+		unsigned int channels, bool complex, bool single,
+		enum fft_rigor rigor)
+{
+	int r;
+
+	fft_plan_shape(e, size, channels, complex, single);
+	if (fft_window_alloc(e) || fft_buffers_alloc(e)) {
+		fft_plan_entry_free(e);
+		return -ENOMEM;
+	}
+
+	/* Wisdom from an earlier run may already hold a thorough plan */
+	for (r = rigor; r > FFT_RIGOR_ESTIMATE; r--)
+		if (!fft_plan_make(e, rigor_flags[r] | FFTW_WISDOM_ONLY))
+			break;
+	if (r == FFT_RIGOR_ESTIMATE && fft_plan_make(e, FFTW_ESTIMATE)) {
+		fft_plan_entry_free(e);
+		return -EINVAL;
+	}
+	e->rigor = r;
+
+	return 0;
+}
+
+static int fd_read_full(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t r;
+
+	while (len) {
+		r = read(fd, p, len);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return -EIO;
+		p += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+/* Sockets rather than pipes, so that a lost peer is an error, not SIGPIPE */
+static int fd_write_full(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t r;
+
+	while (len) {
+		r = send(fd, p, len, MSG_NOSIGNAL);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return -EIO;
+		p += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+/*
+ * The planning helper, a process forked at startup: it plans what it is
+ * asked, on buffers of its own, and answers with all of its wisdom, from
+ * which the same plan is then made at once. FFTW_MEASURE and up take
+ * seconds to minutes, and FFTW's planner can't be used by two threads at
+ * a time, so planning them in here would hold the planner, and any size
+ * change meanwhile, for as long. Never returns.
+ */
+static void fft_plan_helper(int fd)
+{
+	struct fft_plan_req req;
+	struct fft_plan p;
+	char *wisdom;
+	size_t len;
+
+	while (!fd_read_full(fd, &req, sizeof(req))) {
+		memset(&p, 0, sizeof(p));
+		fft_plan_shape(&p, req.size, req.channels, req.complex,
+				req.single);
+		wisdom = NULL;
+		if (!fft_buffers_alloc(&p)) {
+#ifdef HAVE_FFTWF
+			if (!fft_plan_make(&p, req.flags))
+				wisdom = p.single ? fftwf_export_wisdom_to_string() :
+					fftw_export_wisdom_to_string();
+#else
+			if (!fft_plan_make(&p, req.flags))
+				wisdom = fftw_export_wisdom_to_string();
+#endif
+			fft_buffers_free(&p);
+		}
+
+		len = wisdom ? strlen(wisdom) + 1 : 0;
+		if (fd_write_full(fd, &len, sizeof(len)) ||
+				fd_write_full(fd, wisdom, len))
+			break;
+		free(wisdom);
+	}
+
+	_exit(0);
+}
+
+/*
+ * Forked before any plan is made or run, so that the helper starts with
+ * the wisdom just read and without FFTW threads, which don't survive fork.
+ */
+static void fft_plan_helper_start(void)
+{
+	int sv[2], err;
+
+	if (helper_fd >= 0)
+		return;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv)) {
+		perror("No background FFT planning");
+		return;
+	}
+
+	helper = fork();
+	if (helper == 0) {
+		close(sv[0]);
+		fft_plan_helper(sv[1]);
+	}
+	err = errno;
+	close(sv[1]);
+	if (helper < 0) {
+		close(sv[0]);
+		fprintf(stderr, "No background FFT planning: %s\n", strerror(err));
+		return;
+	}
+
+	helper_fd = sv[0];
+}
+
+static void fft_plan_helper_stop(void)
+{
+	if (helper_fd < 0)
+		return;
+
+	close(helper_fd);
+	helper_fd = -1;
+	waitpid(helper, NULL, 0);
+	helper = -1;
+	g_atomic_int_set(&helper_lost, 0);
+}
+
+/*
+ * Has the helper plan @p with @flags, and brings back its wisdom. Returns
+ * NULL if there is no plan, with @lost set if the helper is gone.
+ */
+static char * fft_plan_helper_ask(const struct fft_plan *p,
+		unsigned int flags, bool *lost)
+{
+	struct fft_plan_req req;
+	char *wisdom;
+	size_t len;
+
+	memset(&req, 0, sizeof(req));
+	req.size = p->size;
+	req.channels = p->channels;
+	req.complex = p->complex;
+	req.single = p->single;
+	req.flags = flags;
+
+	G_LOCK(fft_helper);
+	*lost = true;
+	wisdom = NULL;
+	if (fd_write_full(helper_fd, &req, sizeof(req)) ||
+			fd_read_full(helper_fd, &len, sizeof(len)))
+		goto out;
+	*lost = false;
+	if (!len)
+		goto out;
+
+	wisdom = g_malloc(len);
+	if (fd_read_full(helper_fd, wisdom, len) || wisdom[len - 1]) {
+		*lost = true;
+		g_free(wisdom);
+		wisdom = NULL;
+	}
+out:
+	G_UNLOCK(fft_helper);
+
+	return wisdom;
+}
+
+/*
+ * Only the wisdom import and the plan made from it hold the planner here;
+ * the display keeps using the old plan and buffers until fft_plan_collect()
+ * swaps them.
+ */
+static gpointer fft_plan_thread(gpointer data)
+{
+	struct fft_plan_job *j = data;
+	unsigned int flags = rigor_flags[j->rigor];
+	char *wisdom;
+	int imported;
+	bool lost;
+
+	j->ok = false;
+	wisdom = fft_plan_helper_ask(&j->p, flags, &lost);
+	if (lost && g_atomic_int_compare_and_exchange(&helper_lost, 0, 1))
+		fprintf(stderr, "The FFT planning helper is gone, plans stay estimated\n");
+	if (wisdom && !fft_buffers_alloc(&j->p)) {
+		G_LOCK(fft_planner);
+#ifdef HAVE_FFTWF
+		if (j->p.single)
+			imported = fftwf_import_wisdom_from_string(wisdom);
+		else
+#endif
+			imported = fftw_import_wisdom_from_string(wisdom);
+		G_UNLOCK(fft_planner);
+
+		j->ok = imported &&
+			!fft_plan_make(&j->p, flags | FFTW_WISDOM_ONLY);
+		if (!j->ok)
+			fft_buffers_free(&j->p);
+	}
+	g_free(wisdom);
+
+	g_atomic_int_set(&j->done, 1);
+
+	return NULL;
+}
+
+/* Swap in the background plan of @c if it is done, or @wait for it */
+static void fft_plan_collect(struct fft_plan_cache *c, bool wait)
+{
+	struct fft_plan_job *j = &c->job;
+	struct fft_plan *e = j->entry;
+
+	if (!c->planner)
+		return;
+	if (!wait && !g_atomic_int_get(&j->done))
+		return;
+
+	g_thread_join(c->planner);
+	c->planner = NULL;
+
+	if (!j->ok)
+		return;
+
+	fft_buffers_free(e);
+
+	e->plan = j->p.plan;
+	e->in = j->p.in;
+	e->in_c = j->p.in_c;
+	e->out = j->p.out;
+#ifdef HAVE_FFTWF
+	e->plan_f = j->p.plan_f;
+	e->in_f = j->p.in_f;
+	e->out_f = j->p.out_f;
+#endif
+	e->rigor = j->rigor;
+}
+
+static void fft_plan_start_job(struct fft_plan_cache *c, struct fft_plan *e,
+		enum fft_rigor rigor)
+{
+	struct fft_plan_job *j = &c->job;
+
+	memset(j, 0, sizeof(*j));
+	j->entry = e;
+	j->rigor = rigor;
+	fft_plan_shape(&j->p, e->size, e->channels, e->complex, e->single);
+
+	c->planner = g_thread_new("FFT_planner", fft_plan_thread, j);
+}
+
+void fft_plan_cache_init(struct fft_plan_cache *c)
+{
+	memset(c, 0, sizeof(*c));
+}
+
+/* Waits for a background plan, so that its wisdom is saved too */
+void fft_plan_cache_free(struct fft_plan_cache *c)
+{
+	unsigned int i;
+
+	fft_plan_collect(c, true);
+
+	for (i = 0; i < FFT_PLAN_CACHE; i++)
+		if (c->plans[i].size)
+			fft_plan_entry_free(&c->plans[i]);
+}
+
+/*
+ * The plan for @size points of @channels channels, taken as I/Q pairs if
+ * @complex, in the precision set by fft_plan_set_single(), from @c if it
+ * is there. The buffers and plan of an entry may change between calls, so
+ * they must not be kept. A cache serves one thread at a time, and the
+ * plans of different caches may run at the same time; the rigor and
+ * precision may be set from any thread. Returns NULL if it can't be made.
+ */
+struct fft_plan * fft_plan_get(struct fft_plan_cache *c, unsigned int size,
+		unsigned int channels, bool complex)
+{
+	struct fft_plan *e = NULL, *victim = NULL, *p;
+	enum fft_rigor rigor = g_atomic_int_get(&plan_rigor);
+	bool single = g_atomic_int_get(&plan_single);
+	unsigned int i;
+
+	fft_plan_collect(c, false);
+
+	for (i = 0; i < FFT_PLAN_CACHE; i++) {
+		p = &c->plans[i];
+		if (p->size == size && p->channels == channels &&
+				p->complex == complex && p->single == single) {
+			e = p;
+			break;
+		}
+		if (c->planner && p == c->job.entry)
+			continue;
+		if (!victim || !p->size ||
+				(victim->size && p->last_used < victim->last_used))
+			victim = p;
+	}
+
+	if (!e) {
+		e = victim;
+		if (e->size)
+			fft_plan_entry_free(e);
+		if (fft_plan_entry_init(e, size, channels, complex, single,
+					rigor))
+			return NULL;
+	}
+
+	e->last_used = ++c->clock;
+
+	if (!c->planner && helper_fd >= 0 && !g_atomic_int_get(&helper_lost) &&
+			e->rigor < rigor)
+		fft_plan_start_job(c, e, rigor);
+
+	return e;
+}
+
+void fft_plan_set_rigor(enum fft_rigor rigor)
+{
+	if (rigor < FFT_RIGOR_NUM)
+		g_atomic_int_set(&plan_rigor, rigor);
+}
+
+enum fft_rigor fft_plan_get_rigor(void)
+{
+	return g_atomic_int_get(&plan_rigor);
+}
+
+/* Only takes effect if built with single precision FFTW */
+void fft_plan_set_single(bool single)
+{
+#ifdef HAVE_FFTWF
+	g_atomic_int_set(&plan_single, single);
+#endif
+}
+
+bool fft_plan_get_single(void)
+{
+	return g_atomic_int_get(&plan_single);
+}
+
+const char * fft_rigor_name(enum fft_rigor rigor)
+{
+	return rigor < FFT_RIGOR_NUM ? rigor_names[rigor] : NULL;
+}
+
+/*
+ * Wisdom is kept in @home_dir, if there is one. Must be called before any
+ * plan is made, and before the other threads that make them are started.
+ */
+void fft_plan_init(const char *home_dir)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	G_LOCK(fft_planner);
+	if (fftw_init_threads()
+#ifdef HAVE_FFTWF
+			&& fftwf_init_threads()
+#endif
+			)
+		plan_threads = CLAMP(cpus, 1, FFT_MAX_THREADS);
+	G_UNLOCK(fft_planner);
+
+	g_free(wisdom_path);
+	wisdom_path = NULL;
+#ifdef HAVE_FFTWF
+	g_free(wisdom_path_f);
+	wisdom_path_f = NULL;
+#endif
+	if (!home_dir) {
+		fft_plan_helper_start();
+		return;
+	}
+
+	wisdom_path = g_strdup_printf("%s/%s", home_dir, FFT_WISDOM_FILE);
+#ifdef HAVE_FFTWF
+	wisdom_path_f = g_strdup_printf("%s/%s", home_dir, FFT_WISDOM_FILE_F);
+#endif
+
+	G_LOCK(fft_planner);
+	if (!fftw_import_wisdom_from_filename(wisdom_path))
+		printf("No FFTW wisdom loaded from %s\n", wisdom_path);
+#ifdef HAVE_FFTWF
+	if (!fftwf_import_wisdom_from_filename(wisdom_path_f))
+		printf("No FFTW wisdom loaded from %s\n", wisdom_path_f);
+#endif
+	G_UNLOCK(fft_planner);
+
+	fft_plan_helper_start();
+}
+
+/* Saves the wisdom, once the caches are freed */
+void fft_plan_cleanup(void)
+{
+	fft_plan_helper_stop();
+
+	G_LOCK(fft_planner);
+	if (wisdom_path && !fftw_export_wisdom_to_filename(wisdom_path))
+		fprintf(stderr, "Failed to save FFTW wisdom to %s\n", wisdom_path);
+#ifdef HAVE_FFTWF
+	if (wisdom_path_f && !fftwf_export_wisdom_to_filename(wisdom_path_f))
+		fprintf(stderr, "Failed to save FFTW wisdom to %s\n", wisdom_path_f);
+#endif
+	G_UNLOCK(fft_planner);
+
+	g_free(wisdom_path);
+	wisdom_path = NULL;
+#ifdef HAVE_FFTWF
+	g_free(wisdom_path_f);
+	wisdom_path_f = NULL;
+#endif
+}
@@ -0,0 +1,140 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __FFT_PLAN_H__
+#define __FFT_PLAN_H__
+
+#include <stdbool.h>
+#include <glib.h>
+#include <fftw3.h>
+
+/*
+ * FFTW plans for the FFT plot, with their buffers and window, kept for
+ * each size and channel count seen so that switching back and forth
+ * doesn't plan again. Each thread that transforms has a cache of its own,
+ * so that several frames can be transformed at once. A plan is first made from wisdom, or estimated;
+ * if a more thorough one was asked for, it is planned by a helper process
+ * forked at startup, whose wisdom a background thread then makes the plan
+ * from, and swapped in by fft_plan_get() once ready. The planner is only
+ * held for quick plans, so a new size never waits for a thorough one.
+ * Wisdom is read at startup and written back on exit.
+ *
+ * Built with HAVE_FFTWF, plans may also be single precision (fftwf), which
+ * is about twice as fast on targets with narrow vector units; the samples
+ * are only 16 bits, so the display can't tell the difference. Single and
+ * double precision plans are cached separately, each with its own wisdom.
+ *
+ * All the enabled channels are transformed by one batched plan, straight
+ * from the interleaved capture of 16 bit samples: as I/Q pairs when the
+ * caller says they are, else one by one. Big transforms are planned over
+ * several threads.
+ */
+#define FFT_PLAN_CACHE 8
+#define FFT_THREADS_MIN_POINTS (1 << 16)
+#define FFT_MAX_THREADS 4
+#define FFT_WISDOM_FILE ".osc_fftw_wisdom"
+#define FFT_WISDOM_FILE_F ".osc_fftwf_wisdom"
+
+enum fft_rigor {
+	FFT_RIGOR_ESTIMATE,
+	FFT_RIGOR_MEASURE,
+	FFT_RIGOR_PATIENT,
+	FFT_RIGOR_NUM
+};
+
+/**
+ * struct fft_plan - a cached FFT and its buffers
+ * @size: FFT size, 0 if the cache entry is unused
+ * @channels: number of channels it was planned for
+ * @complex: whether the input is complex, from pairs of channels
+ * @traces: number of transforms, that is spectra
+ * @out_dist: distance between two spectra in @out or @out_f
+ * @single: whether it is a single precision plan, using the _f fields
+ * @rigor: how thoroughly @plan was planned
+ * @plan: forward transform from @in, or @in_c, to @out
+ * @in: real input, NULL for complex plans
+ * @in_c: complex input, NULL for real plans
+ * @out: transform output
+ * @win: Hann window of @size points
+ * @plan_f: single precision transform from @in_f to @out_f
+ * @in_f: single precision input, interleaved like the capture
+ * @out_f: single precision transform output
+ * @win_f: Hann window with one weight per value of @in_f
+ * @last_used: when the entry was last asked for, to pick one to evict
+ **/
+struct fft_plan {
+	unsigned int size;
+	unsigned int channels;
+	bool complex;
+	bool single;
+	unsigned int traces;
+	unsigned int out_dist;
+	enum fft_rigor rigor;
+	fftw_plan plan;
+	double *in;
+	fftw_complex *in_c;
+	fftw_complex *out;
+	double *win;
+#ifdef HAVE_FFTWF
+	fftwf_plan plan_f;
+	float *in_f;
+	fftwf_complex *out_f;
+	float *win_f;
+#endif
+	unsigned int last_used;
+};
+
+/**
+ * struct fft_plan_job - a plan being made in the background
+ * @entry: the cache entry it is for, which is not evicted meanwhile
+ * @rigor: how thoroughly to plan
+ * @p: the new plan and its buffers, with @entry's size and precision
+ * @ok: whether planning succeeded
+ * @done: set once the plan is made, or failed
+ **/
+struct fft_plan_job {
+	struct fft_plan *entry;
+	enum fft_rigor rigor;
+	struct fft_plan p;
+	bool ok;
+	volatile gint done;
+};
+
+/**
+ * struct fft_plan_cache - the plans of one thread
+ * @plans: the cached plans
+ * @clock: counts the lookups, for the last_used of @plans
+ * @planner: the thread making a more thorough plan, NULL if there is none
+ * @job: what @planner is making
+ **/
+struct fft_plan_cache {
+	struct fft_plan plans[FFT_PLAN_CACHE];
+	unsigned int clock;
+	GThread *planner;
+	struct fft_plan_job job;
+};
+
+/* Spectra of @channels channels, which make one each or one per I/Q pair */
+static inline unsigned int fft_channels_traces(unsigned int channels,
+		bool complex)
+{
+	return complex ? channels / 2 : channels;
+}
+
+void fft_plan_init(const char *home_dir);
+void fft_plan_cleanup(void);
+void fft_plan_set_rigor(enum fft_rigor rigor);
+enum fft_rigor fft_plan_get_rigor(void);
+const char * fft_rigor_name(enum fft_rigor rigor);
+void fft_plan_set_single(bool single);
+bool fft_plan_get_single(void);
+void fft_plan_cache_init(struct fft_plan_cache *c);
+void fft_plan_cache_free(struct fft_plan_cache *c);
+struct fft_plan * fft_plan_get(struct fft_plan_cache *c, unsigned int size,
+		unsigned int channels, bool complex);
+
+#endif
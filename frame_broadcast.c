@@ -0,0 +1,273 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <errno.h>
+#include <string.h>
+#include <glib.h>
+
+#include "frame_broadcast.h"
+#include "buffer_pool.h"
+
+/*
+ * A slot is claimed by a subscriber, and given back by the publisher once
+ * the subscriber is gone: the publisher is then the only one left touching
+ * the queue, so it can empty it without racing anybody.
+ */
+enum {
+	BROADCAST_SUB_FREE,
+	BROADCAST_SUB_CLAIMED,
+	BROADCAST_SUB_ACTIVE,
+	BROADCAST_SUB_CLOSING,
+};
+
+int broadcast_init(struct frame_broadcast *b)
+{
+	unsigned int i;
+
+	memset(b, 0, sizeof(*b));
+	g_mutex_init(&b->lock);
+	g_cond_init(&b->cond);
+
+	for (i = 0; i < BROADCAST_SUBSCRIBERS; i++)
+		if (frame_ring_init(&b->subs[i].queue, BROADCAST_QUEUE_DEPTH + 1))
+			return -ENOMEM;
+
+	return 0;
+}
+
+/* Hand the slots of the subscribers gone since the last call back */
+static void broadcast_reap(struct frame_broadcast *b)
+{
+	struct broadcast_sub *sub;
+	struct shared_frame *frame;
+	unsigned int i;
+
+	for (i = 0; i < BROADCAST_SUBSCRIBERS; i++) {
+		sub = &b->subs[i];
+		if (g_atomic_int_get(&sub->state) != BROADCAST_SUB_CLOSING)
+			continue;
+
+		while ((frame = frame_ring_pop(&sub->queue)))
+			shared_frame_unref(frame);
+		g_atomic_int_set(&sub->state, BROADCAST_SUB_FREE);
+	}
+}
+
+/* Called before the publishing thread starts, and not while it runs */
+void broadcast_start(struct frame_broadcast *b)
+{
+	broadcast_reap(b);
+	g_atomic_int_set(&b->running, 1);
+}
+
+/* Wake the subscribers waiting for a frame */
+static void broadcast_wake(struct frame_broadcast *b)
+{
+	g_mutex_lock(&b->lock);
+	g_cond_broadcast(&b->cond);
+	g_mutex_unlock(&b->lock);
+}
+
+/* Subscribers waiting for a frame give up once the queue runs dry */
+void broadcast_stop(struct frame_broadcast *b)
+{
+	g_atomic_int_set(&b->running, 0);
+	broadcast_wake(b);
+}
+
+/* Whether anyone listens, so the publisher can skip the demux if not */
+bool broadcast_wanted(struct frame_broadcast *b)
+{
+	unsigned int i;
+
+	broadcast_reap(b);
+
+	for (i = 0; i < BROADCAST_SUBSCRIBERS; i++)
+		if (g_atomic_int_get(&b->subs[i].state) == BROADCAST_SUB_ACTIVE)
+			return true;
+
+	return false;
+}
+
+static int shared_frame_reserve(struct shared_frame *frame,
+		unsigned int raw_size, unsigned int num_channels,
+		unsigned int num_samples)
+{
+	unsigned int i;
+
+	if (frame->raw_alloc < raw_size) {
+		buffer_pool_free(frame->raw);
+		frame->raw = buffer_pool_alloc(raw_size);
+		frame->raw_alloc = frame->raw ? raw_size : 0;
+		if (!frame->raw)
+			return -ENOMEM;
+	}
+
+	if (frame->channels_alloc < num_channels ||
+			frame->cooked_alloc < num_samples) {
+		for (i = 0; i < frame->channels_alloc; i++)
+			buffer_pool_free(frame->cooked[i]);
+		g_free(frame->cooked);
+		frame->channels_alloc = 0;
+		frame->cooked_alloc = 0;
+
+		frame->cooked = g_new0(gfloat *, num_channels);
+		if (!frame->cooked)
+			return -ENOMEM;
+		frame->channels_alloc = num_channels;
+		for (i = 0; i < num_channels; i++) {
+			frame->cooked[i] = buffer_pool_alloc(num_samples *
+					sizeof(gfloat));
+			if (!frame->cooked[i])
+				return -ENOMEM;
+		}
+		frame->cooked_alloc = num_samples;
+	}
+
+	frame->raw_size = raw_size;
+	frame->num_channels = num_channels;
+	frame->num_samples = num_samples;
+
+	return 0;
+}
+
+/*
+ * A frame nobody holds, sized for @num_channels arrays of @num_samples and
+ * @raw_size raw bytes, for the publisher to fill. Returns NULL when slow
+ * readers hold the whole pool. Memory is only allocated when a frame is
+ * smaller than asked for, so a pool is allocated once and then reused.
+ */
+struct shared_frame * broadcast_frame_get(struct frame_broadcast *b,
+		unsigned int raw_size, unsigned int num_channels,
+		unsigned int num_samples)
+{
+	struct shared_frame *frame;
+	unsigned int i;
+
+	for (i = 0; i < BROADCAST_FRAMES; i++) {
+		frame = &b->frames[i];
+		if (!g_atomic_int_compare_and_exchange(&frame->refs, 0, 1))
+			continue;
+
+		if (shared_frame_reserve(frame, raw_size, num_channels,
+					num_samples) < 0) {
+			g_atomic_int_set(&frame->refs, 0);
+			return NULL;
+		}
+
+		return frame;
+	}
+
+	return NULL;
+}
+
+/*
+ * Queue @frame, got from broadcast_frame_get() and filled in, to every
+ * subscriber with room for it, and drop the publisher's reference.
+ * Returns how many subscribers got it.
+ */
+unsigned int broadcast_publish(struct frame_broadcast *b,
+		struct shared_frame *frame)
+{
+	struct broadcast_sub *sub;
+	unsigned int i, n = 0;
+
+	frame->seq = b->seq++;
+
+	for (i = 0; i < BROADCAST_SUBSCRIBERS; i++) {
+		sub = &b->subs[i];
+		if (g_atomic_int_get(&sub->state) != BROADCAST_SUB_ACTIVE)
+			continue;
+
+		g_atomic_int_inc(&frame->refs);
+		if (frame_ring_push(&sub->queue, frame)) {
+			n++;
+		} else {
+			g_atomic_int_add(&frame->refs, -1);
+			g_atomic_int_inc(&sub->missed);
+		}
+	}
+
+	shared_frame_unref(frame);
+	if (n)
+		broadcast_wake(b);
+
+	return n;
+}
+
+/* Returns NULL if all the slots are taken */
+struct broadcast_sub * broadcast_subscribe(struct frame_broadcast *b)
+{
+	struct broadcast_sub *sub;
+	unsigned int i;
+
+	for (i = 0; i < BROADCAST_SUBSCRIBERS; i++) {
+		sub = &b->subs[i];
+		if (!g_atomic_int_compare_and_exchange(&sub->state,
+					BROADCAST_SUB_FREE, BROADCAST_SUB_CLAIMED))
+			continue;
+
+		g_atomic_int_set(&sub->missed, 0);
+		g_atomic_int_set(&sub->state, BROADCAST_SUB_ACTIVE);
+		return sub;
+	}
+
+	return NULL;
+}
+
+/*
+ * Frames still queued are released by the publisher, which is the only
+ * one allowed to touch the queue from now on.
+ */
+void broadcast_unsubscribe(struct broadcast_sub *sub)
+{
+	if (sub)
+		g_atomic_int_set(&sub->state, BROADCAST_SUB_CLOSING);
+}
+
+/*
+ * The oldest frame queued to @sub, waiting up to @timeout_ms for one, or
+ * for as long as frames are published if @timeout_ms is negative. Returns
+ * NULL if none came. The caller owns a reference to the frame.
+ */
+struct shared_frame * broadcast_next(struct frame_broadcast *b,
+		struct broadcast_sub *sub, int timeout_ms)
+{
+	struct shared_frame *frame;
+	gint64 deadline;
+
+	frame = frame_ring_pop(&sub->queue);
+	if (frame || !timeout_ms)
+		return frame;
+
+	deadline = g_get_monotonic_time() + (gint64)timeout_ms * 1000;
+
+	/* the publisher queues, then takes the lock to wake us: none is lost */
+	g_mutex_lock(&b->lock);
+	for (;;) {
+		frame = frame_ring_pop(&sub->queue);
+		if (frame || !g_atomic_int_get(&b->running))
+			break;
+
+		if (timeout_ms < 0) {
+			g_cond_wait(&b->cond, &b->lock);
+		} else if (!g_cond_wait_until(&b->cond, &b->lock, deadline)) {
+			frame = frame_ring_pop(&sub->queue);
+			break;
+		}
+	}
+	g_mutex_unlock(&b->lock);
+
+	return frame;
+}
+
+void shared_frame_unref(struct shared_frame *frame)
+{
+	/* back in the pool once it drops to zero */
+	if (frame)
+		g_atomic_int_dec_and_test(&frame->refs);
+}
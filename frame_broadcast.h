@@ -0,0 +1,106 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __FRAME_BROADCAST_H__
+#define __FRAME_BROADCAST_H__
+
+#include <stdbool.h>
+#include <glib.h>
+
+#include "frame_ring.h"
+
+/*
+ * Capture frames shared with any number of readers. The capture thread
+ * demuxes a frame once into a pooled shared_frame and publishes it: each
+ * subscriber gets a reference in its own queue, and the frame goes back
+ * to the pool when the last reference is dropped. Publishing never waits;
+ * a subscriber whose queue is full, or a frame when the whole pool is
+ * held by slow readers, is just skipped.
+ */
+#define BROADCAST_FRAMES 8
+#define BROADCAST_SUBSCRIBERS 8
+#define BROADCAST_QUEUE_DEPTH 2
+
+/**
+ * struct shared_frame - a published frame, read-only for subscribers
+ * @refs: references, held by the publisher while it fills the frame and
+ *	by each queue or reader it was handed to
+ * @seq: publication number; gaps tell a subscriber it missed frames
+ * @pos: stream position of the first sample
+ * @num_samples: samples per channel
+ * @num_channels: number of arrays in @cooked
+ * @raw: the frame as it came out of the buffer
+ * @raw_size: bytes in @raw
+ * @cooked: one demuxed array per enabled channel
+ * @raw_alloc: bytes allocated for @raw
+ * @cooked_alloc: samples allocated for each array of @cooked
+ * @channels_alloc: arrays allocated in @cooked
+ **/
+struct shared_frame {
+	volatile gint refs;
+	guint64 seq;
+	guint64 pos;
+	unsigned int num_samples;
+	unsigned int num_channels;
+	void *raw;
+	unsigned int raw_size;
+	gfloat **cooked;
+	unsigned int raw_alloc;
+	unsigned int cooked_alloc;
+	unsigned int channels_alloc;
+};
+
+/**
+ * struct broadcast_sub - a subscriber slot
+ * @state: whether the slot is free, in use, or being given up
+ * @queue: frames published to the subscriber, not read yet
+ * @missed: frames the queue had no room for
+ **/
+struct broadcast_sub {
+	volatile gint state;
+	struct frame_ring queue;
+	volatile gint missed;
+};
+
+/**
+ * struct frame_broadcast - frame pool and subscribers of a stream
+ * @frames: the frame pool
+ * @subs: subscriber slots
+ * @running: whether frames are being published
+ * @seq: publication number of the next frame
+ * @lock: taken to wait on @cond
+ * @cond: signalled when frames are published, or publishing stops
+ **/
+struct frame_broadcast {
+	struct shared_frame frames[BROADCAST_FRAMES];
+	struct broadcast_sub subs[BROADCAST_SUBSCRIBERS];
+	volatile gint running;
+	guint64 seq;
+	GMutex lock;
+	GCond cond;
+};
+
+int broadcast_init(struct frame_broadcast *b);
+void broadcast_start(struct frame_broadcast *b);
+void broadcast_stop(struct frame_broadcast *b);
+
+/* Publisher side, for a single thread */
+bool broadcast_wanted(struct frame_broadcast *b);
+struct shared_frame * broadcast_frame_get(struct frame_broadcast *b,
+		unsigned int raw_size, unsigned int num_channels,
+		unsigned int num_samples);
+unsigned int broadcast_publish(struct frame_broadcast *b,
+		struct shared_frame *frame);
+
+/* Subscriber side, any number of threads, one per subscription */
+struct broadcast_sub * broadcast_subscribe(struct frame_broadcast *b);
+void broadcast_unsubscribe(struct broadcast_sub *sub);
+struct shared_frame * broadcast_next(struct frame_broadcast *b,
+		struct broadcast_sub *sub, int timeout_ms);
+void shared_frame_unref(struct shared_frame *frame);
+
+#endif
@@ -0,0 +1,78 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <errno.h>
+#include <glib.h>
+
+#include "frame_ring.h"
+
+int frame_ring_init(struct frame_ring *ring, unsigned int size)
+{
+	if (size < 2)
+		return -EINVAL;
+
+	ring->slots = g_new0(gpointer, size);
+	if (!ring->slots)
+		return -ENOMEM;
+
+	ring->size = size;
+	frame_ring_reset(ring);
+
+	return 0;
+}
+
+void frame_ring_free(struct frame_ring *ring)
+{
+	g_free(ring->slots);
+	ring->slots = NULL;
+	ring->size = 0;
+}
+
+/* Only safe while neither the producer nor the consumer is running */
+void frame_ring_reset(struct frame_ring *ring)
+{
+	g_atomic_int_set(&ring->head, 0);
+	g_atomic_int_set(&ring->tail, 0);
+}
+
+bool frame_ring_push(struct frame_ring *ring, gpointer item)
+{
+	gint head = g_atomic_int_get(&ring->head);
+	gint next = (head + 1) % ring->size;
+
+	if (next == g_atomic_int_get(&ring->tail))
+		return false;
+
+	ring->slots[head] = item;
+
+	/* the atomic store orders the slot write before the new head */
+	g_atomic_int_set(&ring->head, next);
+
+	return true;
+}
+
+gpointer frame_ring_pop(struct frame_ring *ring)
+{
+	gint tail = g_atomic_int_get(&ring->tail);
+	gpointer item;
+
+	if (tail == g_atomic_int_get(&ring->head))
+		return NULL;
+
+	item = ring->slots[tail];
+	g_atomic_int_set(&ring->tail, (tail + 1) % ring->size);
+
+	return item;
+}
+
+unsigned int frame_ring_count(struct frame_ring *ring)
+{
+	gint head = g_atomic_int_get(&ring->head);
+	gint tail = g_atomic_int_get(&ring->tail);
+
+	return (head - tail + ring->size) % ring->size;
+}
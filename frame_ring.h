@@ -0,0 +1,34 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __FRAME_RING_H__
+#define __FRAME_RING_H__
+
+#include <stdbool.h>
+#include <glib.h>
+
+/*
+ * Lock-free single-producer / single-consumer ring of pointers.
+ * Only the producer moves the head, only the consumer moves the tail,
+ * so the two sides never need a lock. One slot is always kept empty to
+ * tell a full ring from an empty one.
+ */
+struct frame_ring {
+	gpointer *slots;
+	unsigned int size;
+	volatile gint head;
+	volatile gint tail;
+};
+
+int frame_ring_init(struct frame_ring *ring, unsigned int size);
+void frame_ring_free(struct frame_ring *ring);
+void frame_ring_reset(struct frame_ring *ring);
+bool frame_ring_push(struct frame_ring *ring, gpointer item);
+gpointer frame_ring_pop(struct frame_ring *ring);
+unsigned int frame_ring_count(struct frame_ring *ring);
+
+#endif
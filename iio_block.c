@@ -0,0 +1,147 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+
+#include "iio_block.h"
+
+static int ioctl_nointr(int fd, unsigned long request, void *data)
+{
+	int ret;
+
+	do {
+		ret = ioctl(fd, request, data);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret < 0 ? -errno : ret;
+}
+
+/*
+ * Ask the kernel for @count blocks of @size bytes, map them and queue them
+ * all to the DMA. This must be done while the buffer is disabled. Returns
+ * a negative error (-ENOTTY on drivers without the interface) so the caller
+ * can fall back to read().
+ */
+int iio_block_open(struct iio_block_session *s, int fd,
+		unsigned int size, unsigned int count)
+{
+	struct iio_block_alloc_req req;
+	unsigned int i;
+	int ret;
+
+	memset(s, 0, sizeof(*s));
+	s->fd = fd;
+
+	if (count > IIO_BLOCK_MAX)
+		count = IIO_BLOCK_MAX;
+
+	req.type = 0;
+	req.size = size;
+	req.count = count;
+	req.id = 0;
+
+	ret = ioctl_nointr(fd, IIO_BLOCK_ALLOC_IOCTL, &req);
+	if (ret < 0)
+		return ret;
+
+	/* The kernel may give us less than we asked for */
+	if (req.count == 0 || req.count > IIO_BLOCK_MAX) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
+	for (i = 0; i < req.count; i++) {
+		s->blocks[i].id = i;
+
+		ret = ioctl_nointr(fd, IIO_BLOCK_QUERY_IOCTL, &s->blocks[i]);
+		if (ret < 0)
+			goto err_unmap;
+
+		s->addrs[i] = mmap(NULL, s->blocks[i].size, PROT_READ | PROT_WRITE,
+				MAP_SHARED, fd, s->blocks[i].offset);
+		if (s->addrs[i] == MAP_FAILED) {
+			ret = -errno;
+			goto err_unmap;
+		}
+		s->count = i + 1;
+
+		ret = ioctl_nointr(fd, IIO_BLOCK_ENQUEUE_IOCTL, &s->blocks[i]);
+		if (ret < 0)
+			goto err_unmap;
+	}
+
+	return 0;
+
+err_unmap:
+	for (i = 0; i < s->count; i++)
+		munmap(s->addrs[i], s->blocks[i].size);
+	s->count = 0;
+err_free:
+	ioctl_nointr(fd, IIO_BLOCK_FREE_IOCTL, NULL);
+	fprintf(stderr, "Failed to map buffer blocks: %d\n", ret);
+	return ret;
+}
+
+void iio_block_close(struct iio_block_session *s)
+{
+	unsigned int i;
+
+	if (!s->count)
+		return;
+
+	for (i = 0; i < s->count; i++)
+		munmap(s->addrs[i], s->blocks[i].size);
+
+	ioctl_nointr(s->fd, IIO_BLOCK_FREE_IOCTL, NULL);
+	s->count = 0;
+}
+
+int iio_block_enqueue(struct iio_block_session *s, unsigned int id)
+{
+	if (id >= s->count)
+		return -EINVAL;
+
+	return ioctl_nointr(s->fd, IIO_BLOCK_ENQUEUE_IOCTL, &s->blocks[id]);
+}
+
+/*
+ * Wait up to @timeout_ms for the DMA to complete a block. Returns 1 and
+ * the block in @id, 0 if nothing completed in time, or a negative error.
+ */
+int iio_block_dequeue(struct iio_block_session *s, unsigned int *id,
+		int timeout_ms)
+{
+	struct iio_block block;
+	struct pollfd pfd;
+	int ret;
+
+	pfd.fd = s->fd;
+	pfd.events = POLLIN;
+	ret = poll(&pfd, 1, timeout_ms);
+	if (ret == 0)
+		return 0;
+	if (ret < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	memset(&block, 0, sizeof(block));
+	ret = ioctl_nointr(s->fd, IIO_BLOCK_DEQUEUE_IOCTL, &block);
+	if (ret == -EAGAIN)
+		return 0;
+	if (ret < 0)
+		return ret;
+	if (block.id >= s->count)
+		return -EIO;
+
+	s->blocks[block.id] = block;
+	*id = block.id;
+
+	return 1;
+}
@@ -0,0 +1,67 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __IIO_BLOCK_H__
+#define __IIO_BLOCK_H__
+
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+/*
+ * High speed (mmap) interface of the IIO DMA buffers: the kernel hands
+ * out fixed size blocks that are mapped into user space, filled by the
+ * DMA and passed back and forth with the dequeue / enqueue ioctls, so
+ * samples never need to be copied through read().
+ */
+
+#define IIO_BLOCK_MAX 32
+
+struct iio_block {
+	uint32_t id;
+	uint32_t size;
+	uint32_t bytes_used;
+	uint32_t type;
+	uint32_t flags;
+	uint32_t offset;
+	uint64_t timestamp;
+};
+
+struct iio_block_alloc_req {
+	uint32_t type;
+	uint32_t size;
+	uint32_t count;
+	uint32_t id;
+};
+
+#define IIO_BLOCK_ALLOC_IOCTL	_IOWR('i', 0xa0, struct iio_block_alloc_req)
+#define IIO_BLOCK_FREE_IOCTL	_IO('i', 0xa1)
+#define IIO_BLOCK_QUERY_IOCTL	_IOWR('i', 0xa2, struct iio_block)
+#define IIO_BLOCK_ENQUEUE_IOCTL	_IOWR('i', 0xa3, struct iio_block)
+#define IIO_BLOCK_DEQUEUE_IOCTL	_IOWR('i', 0xa4, struct iio_block)
+
+/**
+ * struct iio_block_session - blocks mapped from one buffer
+ * @fd: the buffer character device
+ * @count: number of blocks mapped, zero when not in use
+ * @blocks: block descriptors, as last returned by the kernel
+ * @addrs: where each block is mapped
+ **/
+struct iio_block_session {
+	int fd;
+	unsigned int count;
+	struct iio_block blocks[IIO_BLOCK_MAX];
+	void *addrs[IIO_BLOCK_MAX];
+};
+
+int iio_block_open(struct iio_block_session *s, int fd,
+		unsigned int size, unsigned int count);
+void iio_block_close(struct iio_block_session *s);
+int iio_block_enqueue(struct iio_block_session *s, unsigned int id);
+int iio_block_dequeue(struct iio_block_session *s, unsigned int *id,
+		int timeout_ms);
+
+#endif
@@ -22,6 +22,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <poll.h>
 
 #include <fftw3.h>
 
@@ -32,16 +33,116 @@
 #include "config.h"
 #include "osc_plugin.h"
 #include "ini/ini.h"
+#include "frame_ring.h"
+#include "iio_block.h"
+#include "demux.h"
+#include "ring_buffer.h"
+#include "sample_source.h"
+#include "recorder.h"
+#include "stats.h"
+#include "soft_trigger.h"
+#include "envelope.h"
+#include "chunk_store.h"
+#include "buffer_pool.h"
+#include "fft_plan.h"
+#include "fft_kernels.h"
+#include "welch.h"
+#include "peak_detect.h"
+#include "spectrum.h"
+#include "waterfall.h"
 
 #define SAMPLE_COUNT_MIN_VALUE 10
 #define SAMPLE_COUNT_MAX_VALUE 1000000ul
+#define DEEP_SAMPLE_COUNT_MAX_VALUE 500000000ul
+
+/* Frames shared between the capture thread and the display */
+#define CAPTURE_FRAMES 5
+/* The display may queue at most this many frames (ring keeps a slot empty) */
+#define CAPTURE_QUEUE_DEPTH (CAPTURE_FRAMES - 2)
+/* How often (ms) the capture thread rechecks for a stop request */
+#define CAPTURE_POLL_TIMEOUT 100
+/* Display refresh period in ms */
+#define CAPTURE_DISPLAY_INTERVAL 20
+/* DMA blocks to map, enough that the kernel keeps some while we hold frames */
+#define CAPTURE_BLOCKS (CAPTURE_FRAMES + 3)
 
 extern char * get_filename_from_path(const char *path);
 
 GSList *plugin_list = NULL;
 
 static gfloat *X = NULL;
+/* what is plotted, copied from the newest published spectrum */
 static gfloat *fft_channel = NULL;
+/* spectra in fft_channel, one per channel or I/Q pair */
+static unsigned int fft_traces = 1;
+/* whether the enabled channels are I/Q pairs, see fft_channels_iq() */
+static bool fft_complex;
+/* running average of the DSP workers, laid out like fft_channel */
+static gfloat *fft_avg_trace;
+/* sums of the linear average, likewise */
+static gfloat *fft_lin_sum;
+
+/* Overlap of the Welch PSD choices, in %, or -1 to show the latest frame */
+static const int welch_overlaps[] = { -1, 0, 50, 75 };
+static bool welch_on;
+static struct welch fft_welch;
+/* sum of the power of welch_segments segments, for each trace */
+static gfloat *welch_psd;
+static unsigned int welch_segments;
+
+/*
+ * In the FFT domain the capture thread hands frames straight to a pool of
+ * DSP workers rather than to the display. A worker transforms a frame,
+ * folds it into the running average, looks for the peaks, and publishes
+ * the result in fft_spectra as an immutable spectrum; all the display does
+ * is copy the newest one into fft_channel and place the markers. A job
+ * takes a plan cache off fft_plan_free for its transforms, so the workers
+ * transform frames side by side and only take turns to average and
+ * publish them; big transforms are also spread over several threads by
+ * FFTW. The Welch PSD needs the frames in order, so it has a pool of its
+ * own with a single worker: lowering the limit of the main pool would
+ * still leave its idle workers waiting for frames a while.
+ */
+static GThreadPool *fft_dsp_pool;
+static GThreadPool *welch_dsp_pool;
+/* one plan cache for each frame the workers may hold */
+static struct fft_plan_cache fft_plan_caches[CAPTURE_QUEUE_DEPTH];
+static GAsyncQueue *fft_plan_free;
+/* frames handed to the workers and not given back yet */
+static volatile gint fft_dsp_jobs;
+/* set to start the running average over */
+static volatile gint fft_dsp_restart;
+static guint64 fft_dsp_seq;
+static struct spectrum_slot fft_spectra;
+static guint64 fft_shown_seq;
+
+/* history of the first trace, kept by the workers while in the waterfall */
+static struct waterfall fft_waterfall;
+static GtkWidget *waterfall_area;
+static bool waterfall_on;
+
+/**
+ * struct fft_dsp_params - display settings the DSP workers go by
+ * @avg: the FFT average setting
+ * @linear: whether the average is linear rather than exponential
+ * @db_base: offset of the transform's power to dBFS, for a single bin
+ * @find_peaks: whether the markers need the peaks
+ * @peaks: what counts as a peak
+ * @waterfall: whether the first trace also goes to the waterfall
+ **/
+struct fft_dsp_params {
+	double avg;
+	bool linear;
+	double db_base;
+	bool find_peaks;
+	struct peak_params peaks;
+	bool waterfall;
+};
+
+static struct fft_dsp_params fft_dsp_params;
+G_LOCK_DEFINE_STATIC(fft_dsp_params);
+/* fft_avg_trace, fft_lin_sum and fft_dsp_seq */
+G_LOCK_DEFINE_STATIC(fft_avg);
 static gfloat fft_corr = 0.0;
 gfloat plugin_fft_corr = 0.0;
 
@@ -53,19 +154,26 @@ unsigned int num_samples;
 unsigned int num_samples_ploted;
 static struct iio_channel_info *channels;
 unsigned int num_active_channels;
-int cached_num_active_channels = -1;
 static unsigned int num_channels;
 gfloat **channel_data;
-static unsigned int current_sample;
 static unsigned int bytes_per_sample;
+static struct demux_plan capture_demux;
+/* Plugins get raw codes, whatever the display shows */
+static struct demux_plan shared_demux;
+static unsigned int capture_samples;
 
 static GtkWidget *databox;
 static GtkWidget *time_interval_widget;
 static GtkWidget *sample_count_widget;
 static GtkWidget *fft_size_widget, *fft_avg_widget, *fft_pwr_offset_widget;
+static GtkWidget *fft_planning_widget;
+static GtkWidget *waterfall_colormap_widget, *waterfall_min_widget, *waterfall_max_widget;
+static GtkWidget *fft_welch_widget, *fft_analyzed_widget;
+static GtkWidget *fft_avg_linear;
 GtkWidget *plot_domain;
 
 static GtkWidget *show_grid;
+static GtkWidget *si_units;
 static GtkWidget *enable_auto_scale;
 static GtkWidget *device_list_widget;
 static GtkWidget *capture_button;
@@ -80,15 +188,76 @@ GtkWidget *capture_graph;
 
 static GtkWidget *rx_lo_freq_label, *adc_freq_label;
 
+/*
+ * Software trigger of the time domain plot. With it on, frames are
+ * captured TRIGGER_SPAN times as long as the display, and the window
+ * shown is cut around the first edge found in them.
+ */
+#define TRIGGER_SPAN 2
+
+static GtkWidget *trigger_enable, *trigger_edge, *trigger_source;
+static GtkWidget *trigger_level, *trigger_hysteresis, *trigger_holdoff;
+static GtkWidget *trigger_pre;
+static struct soft_trigger time_trigger;
+static bool time_trigger_on;
+static unsigned int time_trigger_source;
+static gfloat **trigger_data;
+static unsigned int trigger_data_channels;
+
+/*
+ * Deep time domain captures are drawn from a min/max envelope of the
+ * visible range rather than from every sample. It is rebuilt right before
+ * a redraw, when new data came in or the plot was zoomed or panned, from
+ * a pyramid of min/max summaries kept up to date as frames are demuxed.
+ */
+#define ENVELOPE_CHUNK 4096
+
+static bool envelope_on;
+static unsigned int envelope_columns;
+static unsigned int envelope_channels;
+static gfloat *envelope_x;
+static gfloat **envelope_y;
+static struct envelope_pyramid *envelope_pyr;
+static bool envelope_dirty;
+static gfloat envelope_left, envelope_right;
+
+/*
+ * Deep memory: time domain captures of more than SAMPLE_COUNT_MAX_VALUE
+ * samples are taken once, straight into a chunk store kept for the whole
+ * session. Only a coarse envelope pyramid of them stays demuxed; the plot
+ * and the export read the samples back from the store a piece at a time.
+ */
+#define DEEP_FRAME_SAMPLES (1 << 18)
+#define DEEP_SCRATCH (16 * ENVELOPE_APPEND_ALIGN)
+/* Most samples the display folds into the envelope per refresh */
+#define DEEP_UPDATE_SAMPLES (1 << 22)
+#define DEEP_PYRAMID_SKIP 3
+
+static GtkWidget *deep_memory;
+static bool deep_capture;
+static struct chunk_store deep_store;
+static volatile gint deep_captured;
+static unsigned int deep_shown;
+
 static GtkDataboxGraph *fft_graph;
 static GtkDataboxGraph *grid;
 
 static GtkDataboxGraph **channel_graph;
 
 static struct marker_type markers[MAX_MARKERS + 2];
-static struct marker_type *markers_copy;
+/*
+ * The markers last shown, for plugin_data_capture(): any number of plugins
+ * may wait on markers_cond for the next ones, while markers_running.
+ */
+static struct marker_type markers_shown[MAX_MARKERS + 2];
+static guint64 markers_seq;
+static bool markers_running;
+static GMutex markers_lock;
+static GCond markers_cond;
 static GtkWidget *marker_label;
 static enum marker_types marker_type;
+static struct peak_params marker_peaks;
+static bool marker_interp = true;
 
 struct detachable_plugin {
 	const struct osc_plugin *plugin;
@@ -160,8 +329,7 @@ static GdkColor color_marker = {
 	.blue = 0xFFFF,
 };
 
-G_LOCK_DEFINE_STATIC(buffer_full);
-G_LOCK_DEFINE_STATIC(markers_copy);
+G_LOCK_DEFINE_STATIC(capture_recorder);
 
 /* Couple helper functions from fru parsing */
 void printf_warn (const char * fmt, ...)
@@ -192,13 +360,84 @@ void * x_calloc (size_t nmemb, size_t size)
 
 struct buffer {
 	void *data;
-	void *data_copy;
 	unsigned int available;
 	unsigned int size;
+	int block;
+	guint64 pos;
+	bool in_use;
 };
 
+/*
+ * The capture thread owns buffer_fd and fills the frames of a fixed pool.
+ * Completed frames are queued to the display through frames_full, or in
+ * the FFT domain handed to the DSP workers, and come back through
+ * frames_free once they are done with them. frames_full has exactly one
+ * producer and one consumer, so it needs no lock; frames_free has one
+ * consumer, and its producers take the frames_free lock.
+ * When the driver supports the mmap block interface, frames point straight
+ * into the DMA blocks and the block goes back to the kernel when the frame
+ * is reused. Otherwise read() appends to capture_ring, a byte ring mapped
+ * twice back to back, and each frame is a window into it: reads never stop
+ * at frame boundaries and nothing is moved once it has been read. The
+ * per-frame capture_mem buffers are only used for one-shot devices, or if
+ * the ring can't be mapped.
+ */
+static struct buffer capture_frames[CAPTURE_FRAMES];
+static void *capture_mem[CAPTURE_FRAMES];
+static struct ring_buffer capture_ring;
+static bool capture_use_ring;
+static struct iio_block_session capture_blocks;
+static struct frame_ring frames_full;
+static struct frame_ring frames_free;
+G_LOCK_DEFINE_STATIC(frames_free);
+static GThread *capture_thread;
+static volatile gint capture_thread_stop;
+static volatile gint capture_thread_error;
+
+/*
+ * One-shot devices stop after filling buffer/length samples and have to be
+ * re-enabled for the next shot. The session keeps the buffer open with the
+ * length set for the whole capture, and buffer/enable open so that a shot
+ * only costs two writes to it.
+ */
+static int oneshot_enable_fd = -1;
+static bool oneshot_armed;
+
+/*
+ * Where samples come from: the IIO buffer of current_device, or when one
+ * was given on the command line and is picked in the device list, one of
+ * the sample_source backends (synthetic signals, replay of a file).
+ */
+static struct sample_source *sample_source;
+static struct sample_source *capture_source;
+
+/*
+ * Recording to disk taps every completed frame in the capture thread,
+ * whether or not the display gets to see it. The lock only keeps the
+ * recorder from going away under the capture thread.
+ */
+static struct recorder *capture_recorder;
+static bool capture_record_direct;
+static GtkWidget *record_menu;
+
+/*
+ * Plugins get completed frames from the capture thread the same way, and
+ * as many of them as want to: a frame is only demuxed if somebody listens,
+ * once, and every subscriber reads that one copy. A subscriber that falls
+ * behind misses frames; the capture thread never waits for it.
+ */
+static struct frame_broadcast capture_broadcast;
+
+static bool source_is_current(void)
+{
+	return sample_source && current_device &&
+		!strcmp(current_device, sample_source->device);
+}
+
 static bool is_oneshot_mode(void)
 {
+	if (source_is_current())
+		return false;
 	if (strncmp(current_device, "cf-ad9", 5) == 0)
 		return true;
 	if (strncmp(current_device, "ad-mc-", 5) == 0)
@@ -207,7 +446,12 @@ static bool is_oneshot_mode(void)
 	return false;
 }
 
-static int buffer_open(unsigned int length, int flags)
+/*
+ * If @blocks is given, try to map @block_size byte DMA blocks instead of
+ * going through read(); blocks->count is left zero if the driver can't.
+ */
+static int buffer_open(unsigned int length, int flags,
+		struct iio_block_session *blocks, unsigned int block_size)
 {
 	int ret;
 	int fd;
@@ -224,6 +468,10 @@ static int buffer_open(unsigned int length, int flags)
 		return ret;
 	}
 
+	/* With mapped blocks, the blocks themselves set the buffer length */
+	if (blocks && iio_block_open(blocks, fd, block_size, CAPTURE_BLOCKS) == 0)
+		goto enable;
+
 	/* Setup ring buffer parameters */
 	ret = write_devattr_int("buffer/length", length);
 	if (ret < 0) {
@@ -231,6 +479,8 @@ static int buffer_open(unsigned int length, int flags)
 		goto err_close;
 	}
 
+enable:
+
 	/* Enable the buffer */
 	ret = write_devattr_int("buffer/enable", 1);
 	if (ret < 0) {
@@ -241,11 +491,15 @@ static int buffer_open(unsigned int length, int flags)
 	return fd;
 
 err_close:
+	if (blocks)
+		iio_block_close(blocks);
 	close(fd);
 	return ret;
 }
 
-static void buffer_close(unsigned int fd)
+static void oneshot_session_close(void);
+
+static void buffer_close(unsigned int fd, struct iio_block_session *blocks)
 {
 	int ret;
 
@@ -260,104 +514,725 @@ static void buffer_close(unsigned int fd)
 		fprintf(stderr, "Failed to disable buffer: %d\n", ret);
 	}
 
+	if (blocks)
+		iio_block_close(blocks);
+
+	oneshot_session_close();
+
 	close(fd);
 }
 
-#if DEBUG
-
-static int sample_iio_data_continuous(int buffer_fd, struct buffer *buf)
+static int iio_source_read(struct sample_source *src, void *buf,
+		unsigned int len, int timeout_ms)
 {
-	static int offset;
-	int i;
+	static bool eagain;
+	struct pollfd pfd;
+	int ret;
 
-	for (i = 0; i < num_samples; i++) {
-		((int16_t *)(buf->data))[i*2] = 4096.0f * cos((i + offset) * G_PI / 100) + (rand() % 500 - 250);
-		((int16_t *)(buf->data))[i*2+1] = 4096.0f * sin((i + offset) * G_PI / 100) + (rand() % 1000 - 500);
+	/* Don't block forever, the capture thread needs to notice a stop */
+	pfd.fd = buffer_fd;
+	pfd.events = POLLIN;
+	ret = poll(&pfd, 1, timeout_ms);
+	if (ret == 0)
+		return 0;
+	if (ret < 0) {
+		if (errno == EINTR)
+			return 0;
+		else
+			return -errno;
 	}
 
-	buf->available = 10;
-	offset += 10;
+	ret = read(buffer_fd, buf, len);
+	if (ret < 0) {
+		if (errno == EAGAIN) {
+			/* poll() said there was data, the driver disagrees */
+			stats_count(STATS_EAGAIN, 1);
+			if (!eagain)
+				stats_count(STATS_EAGAIN_STREAKS, 1);
+			eagain = true;
+			return 0;
+		} else
+			return -errno;
+	}
+
+	eagain = false;
+	if ((unsigned int)ret < len)
+		stats_count(STATS_SHORT_READS, 1);
+
+	return ret;
+}
+
+static int oneshot_rearm(void)
+{
+	if (oneshot_enable_fd < 0) {
+		/* couldn't keep the attribute open, go through sysfs */
+		set_dev_paths(current_device);
+		if (write_devattr_int("buffer/enable", 0) < 0)
+			return -EIO;
+		return write_devattr_int("buffer/enable", 1) < 0 ? -EIO : 0;
+	}
+
+	if (pwrite(oneshot_enable_fd, "0", 1, 0) < 0 ||
+			pwrite(oneshot_enable_fd, "1", 1, 0) < 0)
+		return -errno;
 
 	return 0;
 }
-static int sample_iio_data(struct buffer *buf);
 
-static int sample_iio_data_oneshot(struct buffer *buf)
+/* Called after buffer_open(), which left the first shot armed */
+static void oneshot_session_open(void)
 {
-	return sample_iio_data(buf);
+	char *path;
+
+	path = g_strdup_printf("%s/buffer/enable", dev_name_dir());
+	oneshot_enable_fd = open(path, O_WRONLY);
+	g_free(path);
+
+	oneshot_armed = true;
 }
 
-#else
+static void oneshot_session_close(void)
+{
+	if (oneshot_enable_fd >= 0)
+		close(oneshot_enable_fd);
+	oneshot_enable_fd = -1;
+}
 
-static int sample_iio_data_continuous(int buffer_fd, struct buffer *buf)
+static int iio_source_open(struct sample_source *src,
+		const struct iio_channel_info *channels,
+		unsigned int num_channels, unsigned int num_samples)
+{
+	if (is_oneshot_mode()) {
+		buffer_fd = buffer_open(num_samples, O_NONBLOCK, NULL, 0);
+		if (buffer_fd < 0)
+			return buffer_fd;
+		oneshot_session_open();
+	} else {
+		buffer_fd = buffer_open(num_samples, O_NONBLOCK,
+				&capture_blocks, data_buffer.size);
+		if (buffer_fd < 0)
+			return buffer_fd;
+	}
+
+	return 0;
+}
+
+static void iio_source_close(struct sample_source *src)
+{
+	if (buffer_fd >= 0) {
+		buffer_close(buffer_fd, &capture_blocks);
+		buffer_fd = -1;
+	}
+}
+
+static const struct sample_source_ops iio_source_ops = {
+	.name = "iio",
+	.open = iio_source_open,
+	.close = iio_source_close,
+	.read = iio_source_read,
+};
+
+static struct sample_source iio_source = {
+	.ops = &iio_source_ops,
+};
+
+static void capture_source_close(void)
+{
+	if (capture_source)
+		sample_source_close(capture_source);
+	capture_source = NULL;
+}
+
+static int sample_iio_data_oneshot(struct buffer *buf)
 {
 	int ret;
 
-	ret = read(buffer_fd, buf->data + buf->available,
-			buf->size - buf->available);
-	if (ret == 0)
-		return 0;
-	if (ret < 0) {
-		if (errno == EAGAIN)
-			return 0;
-		else
-			return -errno;
+	if (!oneshot_armed) {
+		ret = oneshot_rearm();
+		if (ret < 0)
+			return ret;
+		oneshot_armed = true;
 	}
 
+	ret = iio_source_read(&iio_source, buf->data + buf->available,
+			buf->size - buf->available, CAPTURE_POLL_TIMEOUT);
+	if (ret < 0)
+		return ret;
+
 	buf->available += ret;
+	if (buf->available == buf->size) {
+		oneshot_armed = false;
+		stats_count(STATS_SHOTS, 1);
+	}
 
 	return 0;
 }
 
-static int sample_iio_data_oneshot(struct buffer *buf)
+/*
+ * Zero-copy capture: give the block this frame was pointing at back to
+ * the DMA, and point the frame at the next completed one.
+ */
+static int sample_iio_data_mmap(struct buffer *buf)
 {
-	int fd, ret;
+	unsigned int id;
+	int ret;
 
-	fd = buffer_open(buf->size, 0);
-	if (fd < 0)
-		return fd;
+	if (buf->block >= 0) {
+		ret = iio_block_enqueue(&capture_blocks, buf->block);
+		buf->block = -1;
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = iio_block_dequeue(&capture_blocks, &id, CAPTURE_POLL_TIMEOUT);
+	if (ret <= 0)
+		return ret;
 
-	ret = sample_iio_data_continuous(fd, buf);
+	/*
+	 * Everything after the capture thread expects whole frames, so a
+	 * block the DMA could not fill goes straight back to it.
+	 */
+	if (capture_blocks.blocks[id].bytes_used != data_buffer.size) {
+		stats_count(STATS_OVERRUNS, 1);
+		return iio_block_enqueue(&capture_blocks, id);
+	}
 
-	buffer_close(fd);
+	buf->block = id;
+	buf->data = capture_blocks.addrs[id];
+	buf->available = data_buffer.size;
+	buf->size = data_buffer.size;
 
-	return ret;
+	return 0;
 }
 
-#endif
-
 static int sample_iio_data(struct buffer *buf)
 {
+	unsigned int available = buf->available;
+	guint64 start = stats_now();
 	int ret;
 
-	if (is_oneshot_mode())
+	if (capture_blocks.count)
+		ret = sample_iio_data_mmap(buf);
+	else if (is_oneshot_mode())
 		ret = sample_iio_data_oneshot(buf);
-	else
-		ret = sample_iio_data_continuous(buffer_fd, buf);
+	else {
+		ret = sample_source_read(capture_source,
+				buf->data + buf->available,
+				buf->size - buf->available, CAPTURE_POLL_TIMEOUT);
+		if (ret > 0)
+			buf->available += ret;
+	}
+
+	stats_stage_end(STATS_READ, start);
+	if (buf->available > available)
+		stats_count(STATS_BYTES, buf->available - available);
+
+	return ret;
+}
+
+static void capture_record(const void *data, unsigned int len)
+{
+	G_LOCK(capture_recorder);
+	if (capture_recorder) {
+		if (recorder_write(capture_recorder, data, len))
+			stats_count(STATS_RECORD_BYTES, len);
+		else
+			stats_count(STATS_RECORD_DROPPED, 1);
+	}
+	G_UNLOCK(capture_recorder);
+}
+
+/* Share a completed frame of @len bytes, at byte @pos of the stream */
+static void capture_publish(const void *data, unsigned int len, guint64 pos)
+{
+	struct shared_frame *frame;
+	unsigned int n = len / bytes_per_sample;
+
+	if (!broadcast_wanted(&capture_broadcast))
+		return;
+
+	frame = broadcast_frame_get(&capture_broadcast, len,
+			num_active_channels, n);
+	if (!frame) {
+		stats_count(STATS_SHARED_DROPPED, 1);
+		return;
+	}
+
+	memcpy(frame->raw, data, len);
+	frame->pos = pos / bytes_per_sample;
+	demux_run(&shared_demux, frame->raw, frame->cooked, n, 0, n);
+
+	if (broadcast_publish(&capture_broadcast, frame))
+		stats_count(STATS_SHARED_FRAMES, 1);
+}
+
+/* Account for a completed frame, @queued if the display got it */
+static void capture_frame_done(unsigned int len, bool queued)
+{
+	stats_count(STATS_FRAMES, 1);
+	stats_count(STATS_SAMPLES, len / bytes_per_sample);
+	if (!queued)
+		stats_count(STATS_FRAMES_DROPPED, 1);
+}
+
+static void fft_dsp_job(gpointer data, gpointer user_data);
+
+/*
+ * Queue a completed frame to the display, or to the DSP workers in the FFT
+ * domain. Returns false if they are too far behind to take it.
+ */
+static bool capture_frame_queue(struct buffer *frame)
+{
+	if (!is_fft_mode)
+		return frame_ring_push(&frames_full, frame);
+
+	if (g_atomic_int_get(&fft_dsp_jobs) >= CAPTURE_QUEUE_DEPTH)
+		return false;
+
+	g_atomic_int_inc(&fft_dsp_jobs);
+	g_thread_pool_push(welch_on ? welch_dsp_pool : fft_dsp_pool, frame, NULL);
+
+	return true;
+}
+
+/* Wait for the DSP workers to give back the frames they were handed */
+static void fft_dsp_drain(void)
+{
+	while (g_atomic_int_get(&fft_dsp_jobs))
+		usleep(1000);
+}
+
+static struct buffer * capture_frame_idle(void)
+{
+	int i;
+
+	for (i = 0; i < CAPTURE_FRAMES; i++)
+		if (!capture_frames[i].in_use)
+			return &capture_frames[i];
+
+	return NULL;
+}
+
+/*
+ * Capture loop for the staging ring. @wr is how much of the stream has
+ * been read, @rd where the next frame starts. Bytes from the oldest frame
+ * still held by the display onwards must not be overwritten; the ring is
+ * sized so that this normally leaves room, and if it doesn't we wait for
+ * the display to give frames back, the driver buffers in the meantime.
+ */
+static int capture_thread_ring(void)
+{
+	unsigned int size = data_buffer.size;
+	guint64 wr = 0, rd = 0, tail, start;
+	struct buffer *frame;
+	int i, ret = 0;
+
+	while (!g_atomic_int_get(&capture_thread_stop)) {
+		while ((frame = frame_ring_pop(&frames_free)))
+			frame->in_use = false;
+
+		tail = rd;
+		for (i = 0; i < CAPTURE_FRAMES; i++)
+			if (capture_frames[i].in_use && capture_frames[i].pos < tail)
+				tail = capture_frames[i].pos;
+
+		if (wr - tail >= capture_ring.size) {
+			usleep(1000);
+			continue;
+		}
+
+		start = stats_now();
+		ret = sample_source_read(capture_source,
+				ring_buffer_at(&capture_ring, wr),
+				capture_ring.size - (wr - tail), CAPTURE_POLL_TIMEOUT);
+		stats_stage_end(STATS_READ, start);
+		if (ret < 0)
+			break;
+		wr += ret;
+		stats_count(STATS_BYTES, ret);
+
+		for (; wr - rd >= size; rd += size) {
+			capture_record(ring_buffer_at(&capture_ring, rd), size);
+			capture_publish(ring_buffer_at(&capture_ring, rd), size, rd);
+
+			frame = capture_frame_idle();
+			if (frame) {
+				frame->data = ring_buffer_at(&capture_ring, rd);
+				frame->available = size;
+				frame->size = size;
+				frame->pos = rd;
+				frame->in_use = true;
+			}
+
+			/* If the display is behind, let the samples go rather than wait */
+			if (frame && capture_frame_queue(frame)) {
+				capture_frame_done(size, true);
+			} else {
+				if (frame)
+					frame->in_use = false;
+				capture_frame_done(size, false);
+			}
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Capture loop for deep memory: frames go to the chunk store until it
+ * holds num_samples samples, and the thread is done. The display is only
+ * told how far it got, and reads the samples back from the store.
+ */
+static int capture_thread_deep(void)
+{
+	guint64 size = (guint64)num_samples * bytes_per_sample, wr = 0;
+	struct buffer *frame;
+	int ret = 0;
+
+	frame = frame_ring_pop(&frames_free);
+	if (!frame)
+		return -ENOMEM;
+	frame->available = 0;
+
+	while (wr < size && !g_atomic_int_get(&capture_thread_stop)) {
+		ret = sample_iio_data(frame);
+		if (ret < 0)
+			break;
+
+		if (frame->available < frame->size)
+			continue;
+
+		capture_record(frame->data, frame->available);
+		capture_publish(frame->data, frame->available, wr);
+		wr += chunk_store_write(&deep_store, wr, frame->data,
+				MIN(frame->available, size - wr));
+		capture_frame_done(frame->available, true);
+		frame->available = 0;
+
+		g_atomic_int_set(&deep_captured, wr / bytes_per_sample);
+	}
+
+	return ret;
+}
+
+static gpointer capture_thread_func(gpointer data)
+{
+	struct buffer *frame = NULL;
+	guint64 pos = 0;
+	int ret = 0;
+
+	if (deep_capture) {
+		ret = capture_thread_deep();
+		goto out;
+	}
+
+	if (capture_use_ring) {
+		ret = capture_thread_ring();
+		goto out;
+	}
+
+	while (!g_atomic_int_get(&capture_thread_stop)) {
+		if (!frame) {
+			frame = frame_ring_pop(&frames_free);
+			if (!frame) {
+				/* The display is holding all the frames */
+				usleep(1000);
+				continue;
+			}
+			frame->available = 0;
+			frame->pos = pos;
+		}
+
+		ret = sample_iio_data(frame);
+		if (ret < 0)
+			break;
+
+		if (frame->available < frame->size)
+			continue;
+
+		capture_record(frame->data, frame->available);
+		capture_publish(frame->data, frame->available, frame->pos);
+		pos += frame->size;
+
+		/* If the display is behind, reuse the frame rather than wait */
+		if (capture_frame_queue(frame)) {
+			capture_frame_done(frame->size, true);
+			frame = NULL;
+		} else {
+			capture_frame_done(frame->size, false);
+			frame->available = 0;
+			frame->pos = pos;
+		}
+	}
+
+out:
+	if (ret < 0)
+		g_atomic_int_set(&capture_thread_error, ret);
+
+	iio_thread_clear(g_thread_self());
+
+	return NULL;
+}
+
+/*
+ * Must be called once buffer_open() has decided between the mmap blocks
+ * and read(), since only the latter needs memory for the frames.
+ */
+static int capture_frames_setup(unsigned int size)
+{
+	int i;
+
+	if (!frames_full.slots) {
+		if (frame_ring_init(&frames_full, CAPTURE_QUEUE_DEPTH + 1) ||
+				frame_ring_init(&frames_free, CAPTURE_FRAMES + 1))
+			return -ENOMEM;
+	}
+
+	frame_ring_reset(&frames_full);
+	frame_ring_reset(&frames_free);
+
+	/*
+	 * One frame more than can ever be in flight, so the capture thread
+	 * always has room for the frame it is assembling.
+	 */
+	capture_use_ring = false;
+	if (!capture_blocks.count && !is_oneshot_mode() && !deep_capture) {
+		size_t ring_size = (size_t)size * (CAPTURE_FRAMES + 1);
+
+		if (capture_ring.base && capture_ring.size < ring_size)
+			ring_buffer_free(&capture_ring);
+		if (capture_ring.base || !ring_buffer_init(&capture_ring, ring_size))
+			capture_use_ring = true;
+	} else {
+		ring_buffer_free(&capture_ring);
+	}
+
+	for (i = 0; i < CAPTURE_FRAMES; i++) {
+		if (capture_blocks.count || capture_use_ring) {
+			buffer_pool_free(capture_mem[i]);
+			capture_mem[i] = NULL;
+		} else {
+			capture_mem[i] = buffer_pool_resize(capture_mem[i], size);
+			if (!capture_mem[i])
+				return -ENOMEM;
+		}
+		capture_frames[i].data = capture_mem[i];
+		capture_frames[i].available = 0;
+		capture_frames[i].size = size;
+		capture_frames[i].block = -1;
+		capture_frames[i].pos = 0;
+		capture_frames[i].in_use = false;
+		frame_ring_push(&frames_free, &capture_frames[i]);
+	}
+
+	return 0;
+}
+
+static int capture_thread_start(void)
+{
+	g_atomic_int_set(&capture_thread_stop, 0);
+	g_atomic_int_set(&capture_thread_error, 0);
+	stats_reset();
+
+	capture_thread = g_thread_new("Capture_thread", capture_thread_func, NULL);
+	if (!capture_thread)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static void capture_thread_join(void)
+{
+	if (!capture_thread)
+		return;
+
+	g_atomic_int_set(&capture_thread_stop, 1);
+	g_thread_join(capture_thread);
+	capture_thread = NULL;
+	fft_dsp_drain();
+
+	capture_record_stop();
+}
+
+bool capture_record_active(void)
+{
+	return capture_recorder != NULL;
+}
+
+/* Record the stream of the running capture to @filename */
+int capture_record_start(const char *filename)
+{
+	struct recorder *rec;
+	int ret;
+
+	if (!capture_thread)
+		return -ENODEV;
+	if (capture_recorder)
+		return -EBUSY;
+
+	ret = recorder_start(&rec, filename, channels, num_channels,
+			adc_freq_raw, data_buffer.size, capture_record_direct);
+	if (ret < 0)
+		return ret;
+
+	G_LOCK(capture_recorder);
+	capture_recorder = rec;
+	G_UNLOCK(capture_recorder);
+
+	if (record_menu)
+		gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(record_menu), TRUE);
+
+	return 0;
+}
+
+void capture_record_stop(void)
+{
+	struct recorder_stats stats;
+	struct recorder *rec;
+	int ret;
+
+	G_LOCK(capture_recorder);
+	rec = capture_recorder;
+	capture_recorder = NULL;
+	G_UNLOCK(capture_recorder);
+
+	if (record_menu)
+		gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(record_menu), FALSE);
+
+	if (!rec)
+		return;
+
+	recorder_get_stats(rec, &stats);
+	ret = recorder_stop(rec);
+	printf("Recording stopped: %llu bytes, %u frames dropped%s\n",
+			(unsigned long long)stats.bytes_written,
+			stats.frames_dropped, ret ? ", write error" : "");
+}
+
+static void capture_frame_put(struct buffer *frame)
+{
+	G_LOCK(frames_free);
+	frame_ring_push(&frames_free, frame);
+	G_UNLOCK(frames_free);
+}
+
+/*
+ * Grab the newest completed frame, handing anything older straight back
+ * to the capture thread. Returns NULL if nothing new arrived.
+ */
+static struct buffer * capture_frame_get(void)
+{
+	struct buffer *frame, *newest = NULL;
+
+	while ((frame = frame_ring_pop(&frames_full))) {
+		if (newest)
+			capture_frame_put(newest);
+		newest = frame;
+	}
+
+	return newest;
+}
+
+static int frame_counter;
+
+static void fps_counter(void)
+{
+	static time_t last_update;
+	time_t t;
+
+	stats_count(STATS_FRAMES_DISPLAYED, 1);
+
+	/* auto_scale_databox() rescales each time this wraps */
+	frame_counter++;
+	t = time(NULL);
+	if (t - last_update >= 10) {
+		frame_counter = 0;
+		last_update = t;
+	}
+}
+
+/*
+ * Demux samples @start to @start + @n of the deep capture into
+ * channel_data, which only has room for DEEP_SCRATCH of them.
+ */
+static void deep_demux(unsigned int start, unsigned int n)
+{
+	struct chunk_iter it;
+	const void *span;
+	unsigned int done = 0;
+	size_t len;
+
+	chunk_iter_init(&it, &deep_store, (guint64)start * bytes_per_sample,
+			(guint64)(start + n) * bytes_per_sample);
+	while ((len = chunk_iter_next(&it, &span))) {
+		demux_run(&capture_demux, span, channel_data,
+				len / bytes_per_sample, done, DEEP_SCRATCH);
+		done += len / bytes_per_sample;
+	}
+}
+
+/* envelope_fetch for the deep capture, @priv being the channel index */
+static void deep_fetch(void *priv, unsigned int start, unsigned int n,
+		gfloat *out)
+{
+	unsigned int ch = GPOINTER_TO_UINT(priv), len;
+
+	for (; n; n -= len, start += len, out += len) {
+		len = MIN(n, DEEP_SCRATCH);
+		deep_demux(start, len);
+		memcpy(out, channel_data[ch], len * sizeof(gfloat));
+	}
+}
+
+static void envelope_update(gfloat left, gfloat right)
+{
+	guint64 start = stats_now();
+	unsigned int i;
+
+	for (i = 0; i < envelope_channels; i++) {
+		if (deep_capture)
+			envelope_reduce_fetch(&envelope_pyr[i], deep_fetch,
+					GUINT_TO_POINTER(i), deep_shown,
+					left, right, envelope_columns,
+					envelope_x, envelope_y[i]);
+		else
+			envelope_reduce(&envelope_pyr[i], channel_data[i],
+					num_samples, left, right,
+					envelope_columns, envelope_x,
+					envelope_y[i]);
+	}
+
+	envelope_left = left;
+	envelope_right = right;
+	envelope_dirty = false;
+	stats_stage_end(STATS_DECIMATE, start);
+}
+
+/* The databox draws from the expose handler, time from first to last */
+static guint64 redraw_start;
+
+static gboolean redraw_begin(GtkWidget *widget, GdkEventExpose *event,
+		gpointer data)
+{
+	gfloat left, right, top, bottom;
 
-	if ((buf->data_copy) && (buf->available == buf->size)) {
-		memcpy(buf->data_copy, buf->data, buf->size);
-		buf->data_copy = NULL;
-		G_UNLOCK(buffer_full);
+	if (envelope_on) {
+		gtk_databox_get_visible_limits(GTK_DATABOX(widget),
+				&left, &right, &top, &bottom);
+		if (envelope_dirty || left != envelope_left ||
+				right != envelope_right)
+			envelope_update(left, right);
 	}
 
-	return ret;
+	redraw_start = stats_now();
+	return FALSE;
 }
 
-static int frame_counter;
-
-static void fps_counter(void)
+static gboolean redraw_end(GtkWidget *widget, GdkEventExpose *event,
+		gpointer data)
 {
-	static time_t last_update;
-	time_t t;
-
-	frame_counter++;
-	t = time(NULL);
-	if (t - last_update >= 10) {
-		printf("FPS: %d\n", frame_counter / 10);
-		frame_counter = 0;
-		last_update = t;
-	}
+	stats_stage_end(STATS_REDRAW, redraw_start);
+	return FALSE;
 }
 
 /*
@@ -375,6 +1250,12 @@ static void fill_axis(gfloat *buf, gfloat start, gfloat inc, int num)
 
 }
 
+/* The waterfall is the FFT, with the history of the first trace under it */
+static bool domain_fft(int domain)
+{
+	return domain == FFT_PLOT || domain == WATERFALL_PLOT;
+}
+
 static void add_grid(void)
 {
 	static gfloat gridy[25], gridx[25];
@@ -389,7 +1270,7 @@ static void add_grid(void)
 	grid = gtk_databox_grid_array_new (y, x, gridy, gridx, &color_grid, 1);
 */
 
-	if (gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)) == FFT_PLOT) {
+	if (domain_fft(gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)))) {
 		fill_axis(gridx, -30, 10, 15);
 		fill_axis(gridy, 10, -10, 15);
 		grid = gtk_databox_grid_array_new (15, 15, gridy, gridx, &color_grid, 1);
@@ -438,141 +1319,252 @@ static void rescale_databox(GtkDatabox *box, gfloat border)
 		gtk_databox_set_total_limits(box, min_x, max_x, max_x, min_x);
 
 	} else {
+		/* the extents have to come from the whole capture */
+		if (envelope_on)
+			envelope_update(0, num_samples - 1);
 		gtk_databox_auto_rescale(box, border);
 	}
 }
 
 static void auto_scale_databox(GtkDatabox *box)
 {
+	guint64 start;
+
 	if (!gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(enable_auto_scale)))
 		return;
 
 	/* Auto scale every 10 seconds */
 	if ((frame_counter == 0) || (do_a_rescale_flag == 1)) {
+		start = stats_now();
 		do_a_rescale_flag = 0;
 		rescale_databox(box, 0.05);
+		stats_stage_end(STATS_AUTOSCALE, start);
 	}
 }
 
-static int sign_extend(unsigned int val, unsigned int bits)
+/* Whether plugins waiting for markers may still get any */
+static void markers_set_running(bool running)
 {
-	unsigned int shift = 32 - bits;
-	return ((int)(val << shift)) >> shift;
+	g_mutex_lock(&markers_lock);
+	markers_running = running;
+	g_cond_broadcast(&markers_cond);
+	g_mutex_unlock(&markers_lock);
 }
 
-static void demux_data_stream(void *data_in, gfloat **data_out,
-	unsigned int num_sam, unsigned int offset, unsigned int data_out_size,
-	struct iio_channel_info *channels, unsigned int num_channels)
+/* Hand the markers just shown to the plugins waiting for them */
+static void markers_publish(const struct marker_type *shown)
 {
-	unsigned int i, j, n;
-	unsigned int val;
-	unsigned int k;
-
-	for (i = 0; i < num_sam; i++) {
-		n = (offset + i) % data_out_size;
-		k = 0;
-		for (j = 0; j < num_channels; j++) {
-			if (!channels[j].enabled)
-				continue;
-			switch (channels[j].bytes) {
-			case 1:
-				val = *(uint8_t *)data_in;
-				break;
-			case 2:
-				switch (channels[j].endianness) {
-				case IIO_BE:
-					val = be16toh(*(uint16_t *)data_in);
-					break;
-				case IIO_LE:
-					val = le16toh(*(uint16_t *)data_in);
-					break;
-				default:
-					val = 0;
-					break;
-				}
-				break;
-			case 4:
-				switch (channels[j].endianness) {
-				case IIO_BE:
-					val = be32toh(*(uint32_t *)data_in);
-					break;
-				case IIO_LE:
-					val = le32toh(*(uint32_t *)data_in);
-					break;
-				default:
-					val = 0;
-					break;
-				}
-				break;
-			default:
-				continue;
-			}
-			data_in += channels[j].bytes;
-			val >>= channels[j].shift;
-			val &= channels[j].mask;
-			if (channels[j].is_signed)
-				data_out[k][n] = sign_extend(val, channels[j].bits_used);
-			else
-				data_out[k][n] = val;
-			k++;
-		}
-	}
-
+	g_mutex_lock(&markers_lock);
+	memcpy(markers_shown, shown, sizeof(struct marker_type) * MAX_MARKERS);
+	markers_seq++;
+	g_cond_broadcast(&markers_cond);
+	g_mutex_unlock(&markers_lock);
 }
 
 static void abort_sampling(void)
 {
-	if (buffer_fd >= 0) {
-		buffer_close(buffer_fd);
-		buffer_fd = -1;
-	}
+	capture_thread_join();
+	capture_source_close();
 	gtk_toggle_tool_button_set_active(GTK_TOGGLE_TOOL_BUTTON(capture_button),
 			FALSE);
-	G_TRYLOCK(buffer_full);
-	G_UNLOCK(buffer_full);
-	G_TRYLOCK(markers_copy);
-	G_UNLOCK(markers_copy);
+	broadcast_stop(&capture_broadcast);
+	markers_set_running(false);
+}
+
+static void time_trigger_update(void)
+{
+	if (gtk_combo_box_get_active(GTK_COMBO_BOX(trigger_edge)) == 1)
+		time_trigger.edge = SOFT_TRIGGER_FALLING;
+	else
+		time_trigger.edge = SOFT_TRIGGER_RISING;
+	time_trigger.level = gtk_spin_button_get_value(GTK_SPIN_BUTTON(trigger_level));
+	time_trigger.hysteresis = gtk_spin_button_get_value(GTK_SPIN_BUTTON(trigger_hysteresis));
+	time_trigger.holdoff = gtk_spin_button_get_value(GTK_SPIN_BUTTON(trigger_holdoff));
+}
+
+/*
+ * Find an edge in the @n samples of trigger_data, at a point where the
+ * pre-trigger part of the window comes before it and the rest after, and
+ * copy that window to the plot. @first is the stream position of the
+ * frame, for the holdoff.
+ */
+static int time_trigger_align(unsigned int n, guint64 first)
+{
+	unsigned int pre, i;
+	guint64 start;
+	int pos;
+
+	n = MIN(n, capture_samples);
+	if (n < num_samples)
+		return -ENOENT;
+
+	time_trigger_update();
+	pre = num_samples * gtk_spin_button_get_value(GTK_SPIN_BUTTON(trigger_pre)) / 100;
+
+	start = stats_now();
+	pos = soft_trigger_find(&time_trigger, trigger_data[time_trigger_source],
+			pre, n - num_samples + pre + 1, first);
+	stats_stage_end(STATS_TRIGGER, start);
+	if (pos < 0)
+		return pos;
+
+	for (i = 0; i < num_active_channels; i++)
+		memcpy(channel_data[i], trigger_data[i] + pos - pre,
+				num_samples * sizeof(gfloat));
+
+	return 0;
+}
+
+/*
+ * Demux @n samples of @frame a piece at a time, folding each piece into
+ * the envelope pyramid while it is still in the cache.
+ */
+static void time_capture_demux_envelope(struct buffer *frame, unsigned int n)
+{
+	guint64 demux_ns = 0, pyramid_ns = 0, t0, t1;
+	unsigned int i, j, len;
+
+	for (i = 0; i < n; i += len) {
+		len = MIN(ENVELOPE_CHUNK, n - i);
+
+		t0 = stats_now();
+		demux_run(&capture_demux, frame->data + i * bytes_per_sample,
+				channel_data, len, i, num_samples);
+		t1 = stats_now();
+		for (j = 0; j < envelope_channels; j++)
+			envelope_pyramid_update(&envelope_pyr[j],
+					channel_data[j], i, i + len);
+
+		demux_ns += t1 - t0;
+		pyramid_ns += stats_now() - t1;
+	}
+
+	stats_stage_time(STATS_DEMUX, demux_ns);
+	stats_stage_time(STATS_DECIMATE, pyramid_ns);
 }
 
 static gboolean time_capture_func(GtkDatabox *box)
 {
-	unsigned int n;
+	struct buffer *frame;
+	unsigned int n, i;
+	guint64 start, first;
 	int ret;
 
 	if (!GTK_IS_DATABOX(box))
 		return FALSE;
 
-	ret = sample_iio_data(&data_buffer);
+	ret = g_atomic_int_get(&capture_thread_error);
 	if (ret < 0) {
 		abort_sampling();
 		fprintf(stderr, "Failed to capture samples: %s\n", strerror(-ret));
 		return FALSE;
 	}
 
-	n = data_buffer.available / bytes_per_sample;
+	frame = capture_frame_get();
+	if (!frame)
+		return TRUE;
+
+	n = frame->available / bytes_per_sample;
 
-	demux_data_stream(data_buffer.data, channel_data, n, current_sample,
-			num_samples, channels, num_channels);
-	current_sample = (current_sample + n) % num_samples;
-	data_buffer.available -= n * bytes_per_sample;
-	if (data_buffer.available != 0) {
-		memmove(data_buffer.data, data_buffer.data +  n * bytes_per_sample,
-			data_buffer.available);
+	start = stats_now();
+	if (time_trigger_on) {
+		demux_run(&capture_demux, frame->data, trigger_data, n, 0,
+				capture_samples);
+		stats_stage_end(STATS_DEMUX, start);
+		first = frame->pos / bytes_per_sample;
+		capture_frame_put(frame);
+
+		/* No edge in this frame, leave the last one on the screen */
+		if (time_trigger_align(n, first) < 0)
+			return TRUE;
+
+		if (envelope_on) {
+			start = stats_now();
+			for (i = 0; i < envelope_channels; i++)
+				envelope_pyramid_update(&envelope_pyr[i],
+						channel_data[i], 0, num_samples);
+			stats_stage_end(STATS_DECIMATE, start);
+		}
+	} else if (envelope_on) {
+		time_capture_demux_envelope(frame, MIN(n, num_samples));
+		capture_frame_put(frame);
+	} else {
+		demux_run(&capture_demux, frame->data, channel_data, n, 0,
+				num_samples);
+		stats_stage_end(STATS_DEMUX, start);
+		capture_frame_put(frame);
 	}
+	envelope_dirty = true;
+
+	auto_scale_databox(box);
+
+	gtk_widget_queue_draw(GTK_WIDGET(box));
+
+	fps_counter();
+
+	return TRUE;
+}
+
 /*
-	for (j = 1; j < num_samples; j++) {
-		if (data[j * 2 - 2] < trigger && data[j * 2] >= trigger)
-			break;
+ * Fold what the capture thread stored since the last refresh into the
+ * envelope, and stop once the whole deep capture is in. The samples stay
+ * in the store to be looked at, until the next capture.
+ */
+static gboolean deep_capture_func(GtkDatabox *box)
+{
+	guint64 demux_ns = 0, pyramid_ns = 0, t0, t1;
+	unsigned int end, n, i;
+	int ret;
+
+	if (!GTK_IS_DATABOX(box))
+		return FALSE;
+
+	ret = g_atomic_int_get(&capture_thread_error);
+	if (ret < 0) {
+		abort_sampling();
+		fprintf(stderr, "Failed to capture samples: %s\n", strerror(-ret));
+		return FALSE;
 	}
-*/
+
+	end = MIN((unsigned int)g_atomic_int_get(&deep_captured),
+			deep_shown + DEEP_UPDATE_SAMPLES);
+	/* the pyramid takes aligned pieces, but for the last one */
+	if (end < num_samples)
+		end -= end % ENVELOPE_APPEND_ALIGN;
+	if (end <= deep_shown)
+		return TRUE;
+
+	for (; deep_shown < end; deep_shown += n) {
+		n = MIN(end - deep_shown, DEEP_SCRATCH);
+
+		t0 = stats_now();
+		deep_demux(deep_shown, n);
+		t1 = stats_now();
+		for (i = 0; i < envelope_channels; i++)
+			envelope_pyramid_append(&envelope_pyr[i],
+					channel_data[i], n);
+
+		demux_ns += t1 - t0;
+		pyramid_ns += stats_now() - t1;
+	}
+	stats_stage_time(STATS_DEMUX, demux_ns);
+	stats_stage_time(STATS_DECIMATE, pyramid_ns);
+	envelope_dirty = true;
+
 	auto_scale_databox(box);
 
 	gtk_widget_queue_draw(GTK_WIDGET(box));
-	usleep(50000);
 
 	fps_counter();
 
-	return TRUE;
+	if (deep_shown < num_samples)
+		return TRUE;
+
+	capture_function = 0;
+	gtk_toggle_tool_button_set_active(GTK_TOGGLE_TOOL_BUTTON(capture_button),
+			FALSE);
+
+	return FALSE;
 }
 
 #if NO_FFTW
@@ -616,164 +1608,388 @@ static void do_fft()
 
 #else
 
-static double win_hanning(int j, int n)
+enum fft_avg_mode {
+	FFT_AVG_PEAK,
+	FFT_AVG_MIN,
+	FFT_AVG_EXP,
+	FFT_AVG_LINEAR,
+};
+
+/* Fold @n bins of the latest power spectrum @db into @trace */
+static void fft_average_span(enum fft_avg_mode mode, gfloat *trace,
+		const gfloat *db, unsigned int n, float avg)
 {
-	double a = 2.0*M_PI/(n-1), w;
+	switch (mode) {
+	case FFT_AVG_PEAK:
+		fft_avg_max(trace, db, n);
+		break;
+	case FFT_AVG_MIN:
+		fft_avg_min(trace, db, n);
+		break;
+	case FFT_AVG_EXP:
+		fft_avg_exp(trace, db, n, avg);
+		break;
+	case FFT_AVG_LINEAR:
+		/* trace is the sums here, fft_average() divides them */
+		fft_vec_add(trace, db, n);
+		break;
+	}
+}
+
+/*
+ * Fold the latest power spectra in @db into fft_avg_trace, according to
+ * the averaging setting. The linear average shows the mean of the frames
+ * so far until it has fft_avg of them, then the mean of each fft_avg
+ * frames. Called with the fft_avg lock held.
+ */
+static void fft_average(const gfloat *db, unsigned int m, unsigned int traces,
+		bool complex, const struct fft_dsp_params *params)
+{
+	static unsigned int lin_frames;
+	static bool lin_first;
+	static enum fft_avg_mode last_mode;
+	enum fft_avg_mode mode;
+	unsigned int t, n = m * traces;
+	gfloat *trace, *dst = fft_avg_trace;
+	double avg = params->avg;
+	float a;
+
+	if (!avg)
+		mode = FFT_AVG_PEAK;
+	else if (avg == 128)
+		mode = FFT_AVG_MIN;
+	else if (params->linear)
+		mode = FFT_AVG_LINEAR;
+	else
+		mode = FFT_AVG_EXP;
+
+	a = mode == FFT_AVG_EXP ? 1 / avg : 0;
+
+	/* Don't average the first iteration, nor carry old sums over */
+	if (fft_avg_trace[0] == FLT_MAX ||
+			(mode == FFT_AVG_LINEAR && last_mode != FFT_AVG_LINEAR)) {
+		last_mode = mode;
+		mode = FFT_AVG_LINEAR;
+		memset(fft_lin_sum, 0, n * sizeof(gfloat));
+		lin_frames = 0;
+		lin_first = true;
+	} else {
+		last_mode = mode;
+	}
+
+	if (mode == FFT_AVG_LINEAR)
+		dst = fft_lin_sum;
+
+	for (t = 0; t < traces; t++) {
+		trace = dst + t * m;
+		/* I/Q spectra are shown with DC in the middle */
+		if (complex) {
+			fft_average_span(mode, trace, db + t * m + m / 2, m / 2, a);
+			fft_average_span(mode, trace + m / 2, db + t * m, m / 2, a);
+		} else {
+			fft_average_span(mode, trace, db + t * m, m, a);
+		}
+	}
+
+	if (mode != FFT_AVG_LINEAR)
+		return;
 
-	w = 0.5 * (1.0 - cos(a*j));
+	lin_frames++;
+	if (lin_first || lin_frames >= avg)
+		fft_vec_scale(fft_avg_trace, fft_lin_sum, n, 1.0f / lin_frames);
+	if (lin_frames >= avg) {
+		memset(fft_lin_sum, 0, n * sizeof(gfloat));
+		lin_frames = 0;
+		lin_first = false;
+	}
+}
 
-	return (w);
+/* Offset of the transform's power to dBFS, for @m bins */
+static double fft_db_offset(const struct fft_dsp_params *params,
+		unsigned int m)
+{
+	return params->db_base - 20 * log10(m);
 }
 
-static void do_fft(struct buffer *buf)
+/*
+ * Window and transform num_samples samples of all the enabled channels,
+ * interleaved, at @data, with a plan from @plans. Returns the plan holding
+ * the result, or NULL; it may change at the next call with @plans.
+ */
+static struct fft_plan * fft_transform(struct fft_plan_cache *plans,
+		const void *data)
 {
 	unsigned int fft_size = num_samples;
-	static unsigned int m;
-	int i, j, k;
-	int cnt;
-	static double *in;
-	static fftw_complex *in_c;
-	static double *win;
-	gfloat mag;
-	double avg, pwr_offset;
-	static fftw_complex *out;
-	static fftw_plan plan_forward;
-	static int cached_fft_size = -1;
+	int i, cnt, ch;
+	struct fft_plan *plan;
+	double *in, *win;
+	guint64 start;
 
-	unsigned int maxx[MAX_MARKERS + 1];
-	gfloat maxY[MAX_MARKERS + 1];
+	plan = fft_plan_get(plans, fft_size, num_active_channels, fft_complex);
+	if (!plan)
+		return NULL;
 
-	static GtkTextBuffer *tbuf = NULL;
-	GtkTextIter iter;
-	char text[256];
+	start = stats_now();
+#ifdef HAVE_FFTWF
+	if (plan->single) {
+		fft_window_s16(plan->in_f, data, plan->win_f,
+				fft_size * num_active_channels);
+		fftwf_execute(plan->plan_f);
+		stats_stage_end(STATS_FFT, start);
+		return plan;
+	}
+#endif
 
-	if ((cached_fft_size == -1) || (cached_fft_size != fft_size) ||
-		(cached_num_active_channels != num_active_channels)) {
-
-		if (cached_fft_size != -1) {
-			fftw_destroy_plan(plan_forward);
-			fftw_free(win);
-			fftw_free(out);
-			if (in != NULL)
-				fftw_free(in);
-			if (in_c != NULL)
-				fftw_free(in_c);
-			in_c = NULL;
-			in = NULL;
-		}
+	in = plan->complex ? (double *)plan->in_c : plan->in;
+	win = plan->win;
 
-		win = fftw_malloc(sizeof(double) * fft_size);
+	/* the plan reads the interleaved channels as they come */
+	for (cnt = 0, i = 0; cnt < fft_size; cnt++)
+		for (ch = 0; ch < num_active_channels; ch++, i++)
+			in[i] = ((const int16_t *)data)[i] * win[cnt];
 
-		if (num_active_channels == 2) {
-			m = fft_size;
-			in_c = fftw_malloc(sizeof(fftw_complex) * fft_size);
-			in = NULL;
-			out = fftw_malloc(sizeof(fftw_complex) * (m + 1));
-			plan_forward = fftw_plan_dft_1d(fft_size, in_c, out, FFTW_FORWARD, FFTW_ESTIMATE);
+	fftw_execute(plan->plan);
+	stats_stage_end(STATS_FFT, start);
 
-		} else {
-			m = fft_size / 2;
-			out = fftw_malloc(sizeof(fftw_complex) * (m + 1));
-			in_c = NULL;
-			in = fftw_malloc(sizeof(double) * fft_size);
-			plan_forward = fftw_plan_dft_r2c_1d(fft_size, in, out, FFTW_ESTIMATE);
-		}
+	return plan;
+}
+
+/*
+ * Fold the power spectra in @spec into the running average, replace them
+ * with the average, look for the peaks of the first trace and publish it.
+ * The waterfall gets its row here too, in the order the frames are
+ * published, straight from @spec.
+ */
+static void fft_dsp_publish(struct spectrum *spec, bool complex,
+		const struct fft_dsp_params *params)
+{
+	unsigned int n = spec->bins * spec->traces;
+	guint64 start;
+
+	start = stats_now();
+	G_LOCK(fft_avg);
+	if (g_atomic_int_compare_and_exchange(&fft_dsp_restart, 1, 0))
+		fft_avg_trace[0] = FLT_MAX;
+	fft_average(spec->db, spec->bins, spec->traces, complex, params);
+	memcpy(spec->db, fft_avg_trace, n * sizeof(gfloat));
+	spec->seq = ++fft_dsp_seq;
+	if (params->waterfall)
+		waterfall_push(&fft_waterfall, spec->db, spec->bins);
+	G_UNLOCK(fft_avg);
+	stats_stage_end(STATS_AVERAGE, start);
+
+	if (params->find_peaks) {
+		start = stats_now();
+		spec->num_peaks = peak_detect(spec->peaks, MAX_MARKERS + 1,
+				spec->db, spec->bins, &params->peaks);
+		stats_stage_end(STATS_MARKERS, start);
+	}
 
-		for (i = 0; i < fft_size; i ++)
-			win[i] = win_hanning(i, fft_size);
+	spectrum_publish(&fft_spectra, spec);
+}
 
-		cached_fft_size = fft_size;
-		cached_num_active_channels = num_active_channels;
+/* Show the spectrum of each frame, averaged */
+static void fft_dsp_frame(struct buffer *frame,
+		const struct fft_dsp_params *params, struct fft_plan_cache *plans)
+{
+	struct spectrum *spec;
+	struct fft_plan *plan;
+	unsigned int m = num_samples_ploted, t;
+	double db_offset = fft_db_offset(params, m);
+	guint64 start;
+
+	spec = spectrum_new(m, fft_traces, MAX_MARKERS + 1);
+	if (!spec) {
+		capture_frame_put(frame);
+		return;
 	}
 
-	if (num_active_channels == 2) {
-		for (cnt = 0, i = 0; cnt < fft_size; cnt++) {
-			/* normalization and scaling see fft_corr */
-			in_c[cnt][0] = ((int16_t *)(buf->data))[i++] * win[cnt];
-			in_c[cnt][1] = ((int16_t *)(buf->data))[i++] * win[cnt];
+	plan = fft_transform(plans, frame->data);
+	if (plan) {
+		start = stats_now();
+		for (t = 0; t < plan->traces; t++) {
+#ifdef HAVE_FFTWF
+			if (plan->single) {
+				fft_power_db(spec->db + t * m,
+						(float *)(plan->out_f + t * plan->out_dist),
+						m, db_offset);
+				continue;
+			}
+#endif
+			fft_power_db_d(spec->db + t * m,
+					(double *)(plan->out + t * plan->out_dist),
+					m, db_offset);
 		}
+		stats_stage_end(STATS_POWER, start);
+	}
+	capture_frame_put(frame);
 
-	} else  {
-		for (cnt = 0, i = 0; i < fft_size; i++) {
-			/* normalization and scaling see fft_corr */
-			in[cnt] = ((int16_t *)(buf->data))[i] * win[cnt];
-			cnt++;
-		}
+	if (!plan) {
+		spectrum_unref(spec);
+		return;
 	}
+	stats_count(STATS_ANALYZED_SAMPLES, num_samples);
+
+	fft_dsp_publish(spec, fft_complex, params);
+}
 
-	fftw_execute(plan_forward);
-	avg = gtk_spin_button_get_value(GTK_SPIN_BUTTON(fft_avg_widget));
-	if (avg && avg != 128 )
-		avg = 1.0f / avg;
+/* Add the power of a segment to the Welch sums */
+static void welch_segment(const void *seg, void *priv)
+{
+	struct fft_plan *plan;
+	unsigned int m, t;
+	guint64 start;
 
-	pwr_offset = gtk_spin_button_get_value(GTK_SPIN_BUTTON(fft_pwr_offset_widget));
+	plan = fft_transform(priv, seg);
+	if (!plan)
+		return;
 
-	for (j = 0; j <= MAX_MARKERS; j++) {
-		maxx[j] = 0;
-		maxY[j] = -100.0f;
+	start = stats_now();
+	m = plan->complex ? plan->size : plan->size / 2;
+	for (t = 0; t < plan->traces; t++) {
+#ifdef HAVE_FFTWF
+		if (plan->single) {
+			fft_power_acc(welch_psd + t * m,
+					(float *)(plan->out_f + t * plan->out_dist), m);
+			continue;
+		}
+#endif
+		fft_power_acc_d(welch_psd + t * m,
+				(double *)(plan->out + t * plan->out_dist), m);
 	}
+	stats_stage_end(STATS_POWER, start);
+
+	welch_segments++;
+}
 
-	for (i = 0; i < m; ++i) {
+/*
+ * Cut a frame into segments, and publish the average power of those
+ * completed since the last time, once the queued frames are all in or a
+ * display period went by. Only ever runs on one worker at a time.
+ */
+static void fft_dsp_welch(struct buffer *frame,
+		const struct fft_dsp_params *params, struct fft_plan_cache *plans)
+{
+	static guint64 published;
+	struct spectrum *spec;
+	unsigned int m = num_samples_ploted, n = m * fft_traces;
+	guint64 analyzed = fft_welch.analyzed, start;
+
+	welch_feed(&fft_welch, frame->data,
+			frame->available / bytes_per_sample,
+			frame->pos / bytes_per_sample, welch_segment, plans);
+	capture_frame_put(frame);
+	stats_count(STATS_ANALYZED_SAMPLES, fft_welch.analyzed - analyzed);
+
+	start = stats_now();
+	if (!welch_segments || (g_thread_pool_unprocessed(welch_dsp_pool) &&
+			start - published < CAPTURE_DISPLAY_INTERVAL * 1000000ULL))
+		return;
+	published = start;
 
-		if (num_active_channels == 2) {
-			if (i < (m / 2))
-				j = i + (m / 2);
-			else
-				j = i - (m / 2);
-		} else {
-			j = i;
-		}
+	spec = spectrum_new(m, fft_traces, MAX_MARKERS + 1);
+	if (!spec)
+		return;
 
-		mag = 10 * log10((out[j][0] * out[j][0] +
-				out[j][1] * out[j][1]) / (m * m)) +
-			fft_corr + pwr_offset + plugin_fft_corr;
-
-		/* it's better for performance to have seperate loops,
-		 * rather than do these tests inside the loop, but it makes
-		 * the code harder to understand... Oh well...
-		 ***/
-		if (fft_channel[i] == FLT_MAX) {
-			/* Don't average the first iterration */
-			 fft_channel[i] = mag;
-		} else if (!avg) {
-			/* keep peaks */
-			if (fft_channel[i] <= mag)
-				fft_channel[i] = mag;
-		} else if (avg == 128) {
-			/* keep min */
-			if (fft_channel[i] >= mag)
-				fft_channel[i] = mag;
-		} else {
-			/* do an average */
-			fft_channel[i] = ((1 - avg) * fft_channel[i]) + (avg * mag);
-		}
+	fft_db(spec->db, welch_psd, n,
+			fft_db_offset(params, m) - 10 * log10(welch_segments));
+	memset(welch_psd, 0, n * sizeof(gfloat));
+	welch_segments = 0;
+	stats_stage_end(STATS_POWER, start);
 
-		if (MAX_MARKERS && (marker_type == MARKER_PEAK ||
-				    marker_type == MARKER_ONE_TONE ||
-				    marker_type == MARKER_IMAGE)) {
-			if (i == 0) {
-				maxx[0] = 0;
-				maxY[0] = fft_channel[0];
-			} else {
-				for (j = 0; j <= MAX_MARKERS && markers[j].active; j++) {
-					if  ((fft_channel[i - 1] > maxY[j]) &&
-						((!((fft_channel[i - 2] > fft_channel[i - 1]) &&
-						 (fft_channel[i - 1] > fft_channel[i]))) &&
-						 (!((fft_channel[i - 2] < fft_channel[i - 1]) &&
-						 (fft_channel[i - 1] < fft_channel[i]))))) {
-						if (marker_type == MARKER_PEAK) {
-							for (k = MAX_MARKERS; k > j; k--) {
-								maxY[k] = maxY[k - 1];
-								maxx[k] = maxx[k - 1];
-							}
-						}
-						maxY[j] = fft_channel[i - 1];
-						maxx[j] = i - 1;
-						break;
-					}
-				}
-			}
+	fft_dsp_publish(spec, fft_complex, params);
+}
+
+/* A frame handed over by the capture thread */
+static void fft_dsp_job(gpointer data, gpointer user_data)
+{
+	struct fft_dsp_params params;
+	struct fft_plan_cache *plans;
+
+	G_LOCK(fft_dsp_params);
+	params = fft_dsp_params;
+	G_UNLOCK(fft_dsp_params);
+
+	/* there are as many as frames in the pools, so one is always free */
+	plans = g_async_queue_pop(fft_plan_free);
+	if (welch_on)
+		fft_dsp_welch(data, &params, plans);
+	else
+		fft_dsp_frame(data, &params, plans);
+	g_async_queue_push(fft_plan_free, plans);
+
+	g_atomic_int_add(&fft_dsp_jobs, -1);
+}
+
+/* Pass the display settings on to the DSP workers */
+static void fft_dsp_params_update(void)
+{
+	struct fft_dsp_params p;
+
+	p.avg = gtk_spin_button_get_value(GTK_SPIN_BUTTON(fft_avg_widget));
+	p.linear = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(fft_avg_linear));
+	/* normalization and scaling see fft_corr */
+	p.db_base = fft_corr + plugin_fft_corr +
+		gtk_spin_button_get_value(GTK_SPIN_BUTTON(fft_pwr_offset_widget));
+	p.find_peaks = MAX_MARKERS && (marker_type == MARKER_PEAK ||
+			marker_type == MARKER_ONE_TONE ||
+			marker_type == MARKER_IMAGE);
+	p.peaks = marker_peaks;
+	p.waterfall = waterfall_on;
+
+	G_LOCK(fft_dsp_params);
+	fft_dsp_params = p;
+	G_UNLOCK(fft_dsp_params);
+}
+
+/* Puts @mk on @bin of the first trace, or between bins on the tone it shows */
+static void marker_place(struct marker_type *mk, unsigned int bin,
+		unsigned int m)
+{
+	float level = fft_channel[bin], d = 0;
+
+	if (marker_interp)
+		d = peak_interp_hann(fft_channel, m, bin, &level);
+
+	mk->x = X[bin] + d * (X[1] - X[0]);
+	mk->y = level;
+}
+
+/*
+ * Every enabled channel, or I/Q pair, gets its own spectrum, one after
+ * the other in fft_channel. Markers follow the first one.
+ */
+static void fft_display(const struct spectrum *spec)
+{
+	unsigned int m = spec->bins;
+	bool complex = fft_complex;
+	int i, j, k;
+
+	unsigned int maxx[MAX_MARKERS + 1];
+
+	static GtkTextBuffer *tbuf = NULL;
+	GtkTextIter iter;
+	char text[256];
+
+	memcpy(fft_channel, spec->db, m * spec->traces * sizeof(gfloat));
+
+	for (j = 0; j <= MAX_MARKERS; j++)
+		maxx[j] = 0;
+
+	/* Peak markers want the N highest peaks, the tone ones the two highest */
+	if (MAX_MARKERS && (marker_type == MARKER_PEAK ||
+			    marker_type == MARKER_ONE_TONE ||
+			    marker_type == MARKER_IMAGE)) {
+		unsigned int want = 2;
+
+		if (marker_type == MARKER_PEAK) {
+			want = 0;
+			while (want <= MAX_MARKERS && markers[want].active)
+				want++;
 		}
+
+		for (j = 0; j < want && j < spec->num_peaks; j++)
+			maxx[j] = spec->peaks[j].bin;
 	}
 
 	if (tbuf == NULL) {
@@ -782,8 +1998,8 @@ static void do_fft(struct buffer *buf)
 	}
 
 	if ((marker_type == MARKER_ONE_TONE || marker_type == MARKER_IMAGE) &&
-			((num_active_channels == 1 && maxx[0] == 0) ||
-			 (num_active_channels == 2 && maxx[0] == m/2))) {
+			((!complex && maxx[0] == 0) ||
+			 (complex && maxx[0] == m/2))) {
 		unsigned int max_tmp;
 
 		max_tmp = maxx[1];
@@ -794,12 +2010,10 @@ static void do_fft(struct buffer *buf)
 	if (MAX_MARKERS && marker_type != MARKER_OFF) {
 		for (j = 0; j <= MAX_MARKERS && markers[j].active; j++) {
 			if (marker_type == MARKER_PEAK) {
-				markers[j].x = (gfloat)X[maxx[j]];
-				markers[j].y = (gfloat)fft_channel[maxx[j]];
 				markers[j].bin = maxx[j];
+				marker_place(&markers[j], maxx[j], m);
 			} else if (marker_type == MARKER_FIXED) {
-				markers[j].x = (gfloat)X[markers[j].bin];
-				markers[j].y = (gfloat)fft_channel[markers[j].bin];
+				marker_place(&markers[j], markers[j].bin, m);
 			} else if (marker_type == MARKER_ONE_TONE) {
 				/* assume peak is the tone */
 				if (j == 0) {
@@ -807,14 +2021,14 @@ static void do_fft(struct buffer *buf)
 					i = 1;
 				} else if (j == 1) {
 					/* keep DC */
-					if (num_active_channels == 2)
+					if (complex)
 						markers[j].bin = m / 2;
 					else
 						markers[j].bin = 0;
 				} else {
 					/* where should the spurs be? */
 					i++;
-					if (num_active_channels == 2) {
+					if (complex) {
 						markers[j].bin = (markers[0].bin - (m / 2)) * i + (m / 2);
 						if (markers[j].bin > m)
 							markers[j].bin -= 2 * (markers[j].bin - m);
@@ -842,11 +2056,10 @@ static void do_fft(struct buffer *buf)
 				if (fft_channel[k] > fft_channel[markers[j].bin])
 					markers[j].bin = k;
 
-				markers[j].x = (gfloat)X[markers[j].bin];
-				markers[j].y = (gfloat)fft_channel[markers[j].bin];
+				marker_place(&markers[j], markers[j].bin, m);
 			} else if (marker_type == MARKER_IMAGE) {
 				/* keep DC, fundamental, and image
-				 * num_active_channels always needs to be 2 for images */
+				 * the input always needs to be I/Q for images */
 				if (j == 0) {
 					/* Fundamental */
 					markers[j].bin = maxx[j];
@@ -858,8 +2071,7 @@ static void do_fft(struct buffer *buf)
 					markers[j].bin = m / 2 - (markers[0].bin - m/2);
 				} else
 					continue;
-				markers[j].x = (gfloat)X[markers[j].bin];
-				markers[j].y = (gfloat)fft_channel[markers[j].bin];
+				marker_place(&markers[j], markers[j].bin, m);
 
 			}
 
@@ -874,11 +2086,7 @@ static void do_fft(struct buffer *buf)
 				gtk_text_buffer_insert(tbuf, &iter, text, -1);
 			}
 		}
-		if (markers_copy) {
-			memcpy(markers_copy, &markers, sizeof(struct marker_type) * MAX_MARKERS);
-			markers_copy = NULL;
-			G_UNLOCK(markers_copy);
-		}
+		markers_publish(markers);
 	} else {
 		gtk_text_buffer_set_text(tbuf, "No markers active", 17);
 	}
@@ -886,46 +2094,88 @@ static void do_fft(struct buffer *buf)
 
 #endif
 
+/* Share of the captured samples that made it into a spectrum */
+static void fft_analyzed_update(void)
+{
+	guint64 samples = stats_counter_get(STATS_SAMPLES);
+	char buf[32];
+
+	if (!samples)
+		return;
+
+	snprintf(buf, sizeof(buf), "%.1f %%", 100.0 *
+			stats_counter_get(STATS_ANALYZED_SAMPLES) / samples);
+	gtk_label_set_text(GTK_LABEL(fft_analyzed_widget), buf);
+}
+
 static gboolean fft_capture_func(GtkDatabox *box)
 {
+	struct spectrum *spec;
 	int ret;
 
-	ret = sample_iio_data(&data_buffer);
+	ret = g_atomic_int_get(&capture_thread_error);
 	if (ret < 0) {
 		abort_sampling();
 		fprintf(stderr, "Failed to capture samples: %d\n", ret);
 		return FALSE;
 	}
-	if (data_buffer.available == data_buffer.size) {
-		do_fft(&data_buffer);
-		data_buffer.available = 0;
-		auto_scale_databox(box);
-		gtk_widget_queue_draw(GTK_WIDGET(box));
-	}
 
-	usleep(5000);
+	fft_dsp_params_update();
+
+	spec = spectrum_latest(&fft_spectra, fft_shown_seq);
+	if (!spec)
+		return TRUE;
+
+	fft_shown_seq = spec->seq;
+	fft_display(spec);
+	spectrum_unref(spec);
+
+	fft_analyzed_update();
+	auto_scale_databox(box);
+	gtk_widget_queue_draw(GTK_WIDGET(box));
+	if (waterfall_on)
+		gtk_widget_queue_draw(waterfall_area);
 
 	fps_counter();
 
 	return TRUE;
 }
 
+static gboolean waterfall_expose(GtkWidget *widget, GdkEventExpose *event,
+		gpointer data)
+{
+	GtkAllocation alloc;
+	cairo_t *cr;
+
+	gtk_widget_get_allocation(widget, &alloc);
+	if (waterfall_resize(&fft_waterfall, alloc.width, alloc.height))
+		return FALSE;
+
+	cr = gdk_cairo_create(gtk_widget_get_window(widget));
+	gdk_cairo_region(cr, event->region);
+	cairo_clip(cr);
+	waterfall_draw(&fft_waterfall, cr);
+	cairo_destroy(cr);
+
+	return TRUE;
+}
+
 static void fft_update_scale(bool force_update)
 {
 	double corr;
 	int i;
 
-	if (num_active_channels == 2) {
+	if (fft_complex) {
 		corr =  adc_freq / 2;
 	} else {
 		corr = 0;
 	}
 
 	for (i = 0; i < num_samples_ploted; i++)
-	{
 		X[i] = (i * adc_freq / num_samples) - corr;
+	for (i = 0; i < num_samples_ploted * fft_traces; i++)
 		fft_channel[i] = FLT_MAX;
-	}
+	g_atomic_int_set(&fft_dsp_restart, 1);
 
 	if (!gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(enable_auto_scale)) && force_update == FALSE)
 		return;
@@ -1041,7 +2291,7 @@ static gint moved_fixed(GtkDatabox *box, GdkEventMotion *event, int mark)
 {
 	unsigned int max_size;
 
-	if (num_active_channels == 2)
+	if (fft_complex)
 		max_size = num_samples;
 	else
 		max_size = num_samples / 2;
@@ -1067,7 +2317,7 @@ static gint marker_button (GtkDatabox *box, GdkEventButton *event)
 	static gulong fixed_marker_hid = 0;
 
 	/* FFT? */
-	if (gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)) != FFT_PLOT)
+	if (!domain_fft(gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain))))
 		return FALSE;
 
 	/* Right button */
@@ -1177,7 +2427,7 @@ static gint marker_button (GtkDatabox *box, GdkEventButton *event)
 	i++;
 */
 
-	if (num_active_channels == 2) {
+	if (fft_complex) {
 		menuitem = gtk_check_menu_item_new_with_label(IMAGE_MRK);
 		gtk_menu_attach(GTK_MENU(popupmenu), menuitem, 0, 1, i, i + 1);
 		gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(menuitem),
@@ -1209,16 +2459,89 @@ static gint marker_button (GtkDatabox *box, GdkEventButton *event)
 
 }
 
-static int prev_num_active_ch = 0;
+static int prev_num_active_ch = 0;
+
+/* Whether @name ends with the IIO modifier @mod, as in in_voltage0_i */
+static bool channel_modified(const char *name, char mod)
+{
+	size_t len = name ? strlen(name) : 0;
+
+	return len > 2 && name[len - 2] == '_' && name[len - 1] == mod;
+}
+
+/* Whether @q is the Q channel of @i, named alike but for the modifier */
+static bool channels_iq_pair(const struct iio_channel_info *i,
+		const struct iio_channel_info *q)
+{
+	return channel_modified(i->name, 'i') &&
+		channel_modified(q->name, 'q') &&
+		strlen(i->name) == strlen(q->name) &&
+		!strncmp(i->name, q->name, strlen(q->name) - 1);
+}
+
+/*
+ * Whether the enabled channels of @ch are I/Q pairs, in their order: an
+ * _i channel, then the _q channel of the same name. Devices older than
+ * those modifiers only told I/Q apart by being a pair, so two unmodified
+ * channels of the same type and next to each other are taken for I and Q
+ * too, as before.
+ */
+static bool fft_channels_iq(const struct iio_channel_info *ch, unsigned int n)
+{
+	const struct iio_channel_info *first = NULL, *prev = NULL;
+	unsigned int i, enabled = 0;
+	bool paired = true, modified = false;
+
+	for (i = 0; i < n; i++) {
+		if (!ch[i].enabled)
+			continue;
+
+		if (channel_modified(ch[i].name, 'i') ||
+				channel_modified(ch[i].name, 'q'))
+			modified = true;
+		if (enabled++ % 2)
+			paired &= channels_iq_pair(prev, &ch[i]);
+		if (!first)
+			first = &ch[i];
+		prev = &ch[i];
+	}
+
+	if (!enabled || enabled % 2)
+		return false;
+	if (paired)
+		return true;
+
+	return enabled == 2 && !modified &&
+		first->generic_name && prev->generic_name &&
+		!strcmp(first->generic_name, prev->generic_name) &&
+		prev->index == first->index + 1;
+}
+
+/* The FFT reads the capture as 16 bit samples, whatever the channels */
+static bool fft_channels_s16(const struct iio_channel_info *ch, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		if (ch[i].enabled && ch[i].bytes != 2)
+			return false;
+
+	return true;
+}
 
 static int fft_capture_setup(void)
 {
 	int i;
 	char buf[10];
 
+	if (!fft_channels_s16(channels, num_channels)) {
+		fprintf(stderr, "The FFT only takes 16 bit samples\n");
+		return -EINVAL;
+	}
+
 	if (channel_data) {
 		for (i = 0; i < prev_num_active_ch; i++)
-			g_free(channel_data[i]);
+			buffer_pool_free(channel_data[i]);
 		g_free(channel_data);
 		channel_data = NULL;
 	}
@@ -1226,21 +2549,57 @@ static int fft_capture_setup(void)
 	num_samples = atoi(gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(fft_size_widget)));
 
 	data_buffer.size = num_samples * bytes_per_sample * num_active_channels;
-	data_buffer.data = g_renew(int8_t, data_buffer.data, data_buffer.size);
-	data_buffer.data_copy = NULL;
-	markers_copy = NULL;
-
-	num_samples_ploted = num_samples * num_active_channels / 2;
+	capture_samples = num_samples;
+	envelope_on = false;
+	deep_capture = false;
+
+	fft_complex = fft_channels_iq(channels, num_channels);
+	fft_traces = fft_channels_traces(num_active_channels, fft_complex);
+	if (fft_complex)
+		num_samples_ploted = num_samples;
+	else
+		num_samples_ploted = num_samples / 2;
+
+	X = buffer_pool_resize(X, num_samples_ploted * sizeof(gfloat));
+	fft_channel = buffer_pool_resize(fft_channel,
+			num_samples_ploted * fft_traces * sizeof(gfloat));
+	fft_avg_trace = buffer_pool_resize(fft_avg_trace,
+			num_samples_ploted * fft_traces * sizeof(gfloat));
+	fft_lin_sum = buffer_pool_resize(fft_lin_sum,
+			num_samples_ploted * fft_traces * sizeof(gfloat));
+	if (!X || !fft_channel || !fft_avg_trace || !fft_lin_sum)
+		return -ENOMEM;
+
+	welch_free(&fft_welch);
+	buffer_pool_free(welch_psd);
+	welch_psd = NULL;
+	welch_segments = 0;
+	i = welch_overlaps[gtk_combo_box_get_active(GTK_COMBO_BOX(fft_welch_widget))];
+	welch_on = i >= 0;
+	if (welch_on) {
+		welch_psd = buffer_pool_alloc0(num_samples_ploted * fft_traces *
+				sizeof(gfloat));
+		if (!welch_psd || welch_init(&fft_welch, num_samples, i,
+					bytes_per_sample))
+			return -ENOMEM;
+	}
+	gtk_label_set_text(GTK_LABEL(fft_analyzed_widget), "");
 
-	X = g_renew(gfloat, X, num_samples_ploted);
-	fft_channel = g_renew(gfloat, fft_channel, num_samples_ploted);
+	/* The workers are idle until the capture starts */
+	spectrum_slot_clear(&fft_spectra);
+	fft_dsp_seq = 0;
+	fft_shown_seq = 0;
 
 	fft_update_scale(FORCE_UPDATE);
 
 	is_fft_mode = true;
+	waterfall_on = gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)) == WATERFALL_PLOT;
+	/* the history starts over, at the size of the view */
+	waterfall_free(&fft_waterfall);
 
 	/* Compute FFT normalization and scaling offset */
 	fft_corr = 20 * log10(2.0 / (1 << (channels[0].bits_used - 1)));
+	fft_dsp_params_update();
 
 	/*
 	 * Init markers
@@ -1269,15 +2628,20 @@ static int fft_capture_setup(void)
 			set_marker_labels(NULL, marker_type);
 	}
 
-	fft_graph = gtk_databox_lines_new(num_samples_ploted, X, fft_channel, &color_graph[0], line_thickness);
-	gtk_databox_graph_add(GTK_DATABOX(databox), fft_graph);
+	for (i = 0; i < fft_traces; i++) {
+		fft_graph = gtk_databox_lines_new(num_samples_ploted, X,
+				fft_channel + i * num_samples_ploted,
+				&color_graph[i], line_thickness);
+		gtk_databox_graph_add(GTK_DATABOX(databox), fft_graph);
+	}
 
 	return 0;
 }
 
 static void fft_capture_start(void)
 {
-	capture_function = g_idle_add((GSourceFunc) fft_capture_func, databox);
+	capture_function = g_timeout_add(CAPTURE_DISPLAY_INTERVAL,
+			(GSourceFunc) fft_capture_func, databox);
 }
 
 static void detach_plugin(GtkToolButton *btn, gpointer data);
@@ -1499,21 +2863,84 @@ gdouble plugin_get_fft_avg(const char *device)
 	return 0;
 }
 
+/* Copy a shared frame out to buffers owned by a plugin */
+static int plugin_frame_copy(const struct shared_frame *frame, void **buf,
+		gfloat ***cooked_data)
+{
+	unsigned int i;
+
+	*buf = buffer_pool_resize(*buf, frame->raw_size);
+	if (!*buf)
+		return -ENOMEM;
+	memcpy(*buf, frame->raw, frame->raw_size);
+
+	if (!cooked_data)
+		return 0;
+
+	if (*cooked_data)
+		*cooked_data = g_renew(gfloat *, *cooked_data, frame->num_channels);
+	else
+		*cooked_data = g_new0(gfloat *, frame->num_channels);
+	if (!*cooked_data)
+		return -ENOMEM;
+
+	for (i = 0; i < frame->num_channels; i++) {
+		(*cooked_data)[i] = buffer_pool_resize((*cooked_data)[i],
+				frame->num_samples * sizeof(gfloat));
+		if (!(*cooked_data)[i])
+			return -ENOMEM;
+		memcpy((*cooked_data)[i], frame->cooked[i],
+				frame->num_samples * sizeof(gfloat));
+	}
+
+	return 0;
+}
+
+/*
+ * Plugins that keep up with the stream subscribe to it rather than poll
+ * plugin_data_capture(): each frame they get is shared with the display
+ * and the other plugins, and must be released, but is never written to.
+ * A NULL frame means capture stopped, or that nothing came in @timeout_ms.
+ */
+struct broadcast_sub * plugin_frames_subscribe(const char *device)
+{
+	if (!device || !current_device || strcmp(current_device, device))
+		return NULL;
+
+	return broadcast_subscribe(&capture_broadcast);
+}
+
+struct shared_frame * plugin_frames_next(struct broadcast_sub *sub,
+		int timeout_ms)
+{
+	return broadcast_next(&capture_broadcast, sub, timeout_ms);
+}
+
+void plugin_frames_release(struct shared_frame *frame)
+{
+	shared_frame_unref(frame);
+}
+
+void plugin_frames_unsubscribe(struct broadcast_sub *sub)
+{
+	broadcast_unsubscribe(sub);
+}
+
 int plugin_data_capture(const char *device, void **buf, gfloat ***cooked_data,
 			struct marker_type **markers_cp)
 {
-	int i, j;
-	bool new = FALSE;
+	guint64 seq;
+	int i, ret;
 
 	/* if there isn't anything to send, clear everything */
 	if (data_buffer.size == 0 || device == NULL) {
 		if (buf && *buf) {
-			g_free(*buf);
+			buffer_pool_free(*buf);
 			*buf = NULL;
 		}
 		if (cooked_data && *cooked_data) {
 			for (i = 0; i < num_active_channels; i++)
-				g_free((*cooked_data)[i]);
+				buffer_pool_free((*cooked_data)[i]);
 			g_free(*cooked_data);
 			*cooked_data = NULL;
 		}
@@ -1528,68 +2955,24 @@ int plugin_data_capture(const char *device, void **buf, gfloat ***cooked_data,
 		return -ENXIO;
 
 	if (buf) {
-		/* One consumer at a time */
-		if (data_buffer.data_copy)
-			return -EBUSY;
-
-		/* make sure space is allocated */
-		if (*buf)
-			*buf = g_renew(int8_t, *buf, data_buffer.size);
-		else
-			*buf = g_new(int8_t, data_buffer.size);
+		struct broadcast_sub *sub;
+		struct shared_frame *frame;
 
-		if (!*buf)
-			goto capture_malloc_fail;
-
-		/* where to put the copy */
-		data_buffer.data_copy = *buf;
-
-		/* Wait til the buffer is full */
-		G_LOCK(buffer_full);
+		/* Wait for the next frame on a subscription of our own */
+		sub = broadcast_subscribe(&capture_broadcast);
+		if (!sub)
+			return -EBUSY;
+		frame = broadcast_next(&capture_broadcast, sub, -1);
+		broadcast_unsubscribe(sub);
 
-		/* if the lock is released, but the copy is still there
-		 * that's because someone else broke the lock
-		 */
-		if (data_buffer.data_copy) {
-			data_buffer.data_copy = NULL;
+		/* capture was stopped before a frame came */
+		if (!frame)
 			return -EINTR;
-		}
-
-		if (cooked_data) {
-			/* make sure space is allocated */
-			if (*cooked_data) {
-				*cooked_data = g_renew(gfloat *, *cooked_data,
-							num_active_channels);
-				new = FALSE;
-			} else {
-				*cooked_data = g_new(gfloat *, num_active_channels);
-				new = TRUE;
-			}
-
-			if (!*cooked_data)
-				goto capture_malloc_fail;
-
-			for (i = 0; i < num_active_channels; i++) {
-				if (new)
-					(*cooked_data)[i] = g_new(gfloat,
-							data_buffer.size / bytes_per_sample);
-				else
-					(*cooked_data)[i] = g_renew(gfloat,
-							(*cooked_data)[i],
-							data_buffer.size / bytes_per_sample);
 
-				if (!(*cooked_data)[i])
-					goto capture_malloc_fail;
-
-				for (j = 0; j < data_buffer.size / bytes_per_sample; j++)
-					(*cooked_data)[i][j] = 0.0f;
-			}
-
-			/* Now that we have the space, process it */
-			 demux_data_stream(*buf, *cooked_data,
-					data_buffer.size / 4, 0, data_buffer.size / 4,
-					channels, num_active_channels);
-		}
+		ret = plugin_frame_copy(frame, buf, cooked_data);
+		shared_frame_unref(frame);
+		if (ret < 0)
+			goto capture_malloc_fail;
 	}
 
 	if (markers_cp) {
@@ -1601,10 +2984,6 @@ int plugin_data_capture(const char *device, void **buf, gfloat ***cooked_data,
 			return 0;
 		}
 
-		/* One consumer at a time */
-		if (markers_copy)
-			return -EBUSY;
-
 		/* make sure space is allocated */
 		if (*markers_cp)
 			*markers_cp = g_renew(struct marker_type, *markers_cp, MAX_MARKERS + 2);
@@ -1614,19 +2993,18 @@ int plugin_data_capture(const char *device, void **buf, gfloat ***cooked_data,
 		if (!*markers_cp)
 			goto capture_malloc_fail;
 
-		/* where to put the copy */
-		markers_copy = *markers_cp;
-
-		/* Wait til the copy is complete */
-		G_LOCK(markers_copy);
-
-		/* if the lock is released, but the copy is still there
-		 * that's because someone else broke the lock
-		 */
-		if (markers_copy) {
-			markers_copy = NULL;
-			return -EINTR;
-		}
+		/* Wait for the next markers shown, unless capture stops first */
+		g_mutex_lock(&markers_lock);
+		seq = markers_seq;
+		while (markers_running && markers_seq == seq)
+			g_cond_wait(&markers_cond, &markers_lock);
+		ret = markers_seq != seq ? 0 : -EINTR;
+		if (!ret)
+			memcpy(*markers_cp, markers_shown,
+					sizeof(struct marker_type) * MAX_MARKERS);
+		g_mutex_unlock(&markers_lock);
+		if (ret)
+			return ret;
 	}
 	return 0;
 
@@ -1636,43 +3014,182 @@ capture_malloc_fail:
 	return -ENOMEM;
 }
 
+/* Index of the trigger source among the enabled channels */
+static unsigned int time_trigger_channel(void)
+{
+	gchar *name;
+	unsigned int i, k = 0;
+
+	name = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(trigger_source));
+	for (i = 0; name && i < num_channels; i++) {
+		if (!channels[i].enabled)
+			continue;
+		if (!strcmp(channels[i].name, name))
+			break;
+		k++;
+	}
+
+	if (!name || i == num_channels) {
+		printf("Trigger source not enabled, using the first channel\n");
+		k = 0;
+	}
+	g_free(name);
+
+	return k;
+}
+
+static void time_trigger_setup(void)
+{
+	unsigned int i;
+
+	if (trigger_data) {
+		for (i = 0; i < trigger_data_channels; i++)
+			g_free(trigger_data[i]);
+		g_free(trigger_data);
+		trigger_data = NULL;
+	}
+
+	capture_samples = num_samples;
+	time_trigger_on = !deep_capture &&
+		gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(trigger_enable));
+	if (!time_trigger_on)
+		return;
+
+	capture_samples = num_samples * TRIGGER_SPAN;
+	trigger_data_channels = num_active_channels;
+	trigger_data = g_new(gfloat *, num_active_channels);
+	for (i = 0; i < num_active_channels; i++)
+		trigger_data[i] = g_new0(gfloat, capture_samples);
+
+	time_trigger_source = time_trigger_channel();
+	soft_trigger_reset(&time_trigger);
+}
+
+/*
+ * Decide whether the time plot is drawn from an envelope, with a column
+ * per pixel of the plot, and allocate it. Only worth it when the capture
+ * holds more samples than the envelope has points.
+ */
+static void envelope_setup(bool is_constellation)
+{
+	GtkAllocation alloc;
+	unsigned int i;
+
+	if (envelope_y) {
+		for (i = 0; i < envelope_channels; i++) {
+			g_free(envelope_y[i]);
+			envelope_pyramid_free(&envelope_pyr[i]);
+		}
+		g_free(envelope_y);
+		g_free(envelope_pyr);
+		envelope_y = NULL;
+		envelope_pyr = NULL;
+	}
+	g_free(envelope_x);
+	envelope_x = NULL;
+	envelope_channels = 0;
+	envelope_on = false;
+
+	if (is_constellation)
+		return;
+
+	gtk_widget_get_allocation(databox, &alloc);
+	envelope_columns = CLAMP(alloc.width, ENVELOPE_MIN_COLUMNS,
+			ENVELOPE_MAX_COLUMNS);
+	if (num_samples <= ENVELOPE_POINTS(envelope_columns))
+		return;
+
+	envelope_x = g_new(gfloat, ENVELOPE_POINTS(envelope_columns));
+	envelope_y = g_new(gfloat *, num_active_channels);
+	envelope_pyr = g_new(struct envelope_pyramid, num_active_channels);
+	for (i = 0; i < num_active_channels; i++) {
+		envelope_y[i] = g_new0(gfloat, ENVELOPE_POINTS(envelope_columns));
+		if (deep_capture) {
+			/* filled as the capture comes in */
+			envelope_pyramid_init_coarse(&envelope_pyr[i], num_samples,
+					DEEP_PYRAMID_SKIP);
+			continue;
+		}
+		envelope_pyramid_init(&envelope_pyr[i], num_samples);
+		envelope_pyramid_update(&envelope_pyr[i], channel_data[i],
+				0, num_samples);
+	}
+	envelope_channels = num_active_channels;
+	envelope_left = envelope_right = 0;
+	envelope_dirty = true;
+	envelope_on = true;
+}
+
+/*
+ * Make room in the store for the deep capture. Chunks mapped for an
+ * earlier one are reused, so after the first deep capture of a session,
+ * this costs nothing.
+ */
+static int deep_capture_setup(void)
+{
+	int ret;
+
+	ret = chunk_store_reserve(&deep_store, bytes_per_sample,
+			(guint64)num_samples * bytes_per_sample);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to allocate deep memory for %u samples: %s\n",
+				num_samples, strerror(-ret));
+		return ret;
+	}
+
+	capture_samples = DEEP_FRAME_SAMPLES;
+	g_atomic_int_set(&deep_captured, 0);
+	deep_shown = 0;
+
+	return 0;
+}
+
 static int time_capture_setup(void)
 {
 	gboolean is_constellation;
-	unsigned int i, j;
+	unsigned int i, j, len;
+	int ret;
 
 	is_constellation = gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)) == XY_PLOT;
 
 	gtk_databox_graph_remove_all(GTK_DATABOX(databox));
 
 	num_samples = gtk_spin_button_get_value(GTK_SPIN_BUTTON(sample_count_widget));
-	data_buffer.size = num_samples * bytes_per_sample;
+	if (is_constellation)
+		num_samples = MIN(num_samples, SAMPLE_COUNT_MAX_VALUE);
+	deep_capture = num_samples > SAMPLE_COUNT_MAX_VALUE;
+	time_trigger_setup();
+	if (deep_capture) {
+		ret = deep_capture_setup();
+		if (ret < 0)
+			return ret;
+	}
+	data_buffer.size = capture_samples * bytes_per_sample;
 
-	data_buffer.data = g_renew(int8_t, data_buffer.data, data_buffer.size);
-	data_buffer.data_copy = NULL;
-	markers_copy = NULL;
+	/* A deep capture is only ever demuxed a piece at a time */
+	len = deep_capture ? DEEP_SCRATCH : num_samples;
 
-	X = g_renew(gfloat, X, num_samples);
+	X = buffer_pool_resize(X, len * sizeof(gfloat));
 
-	for (i = 0; i < num_samples; i++)
+	for (i = 0; i < len; i++)
 		X[i] = i;
 
 	is_fft_mode = false;
+	waterfall_on = false;
 
 	if (channel_data)
 		for (i = 0; i < prev_num_active_ch; i++)
-			g_free(channel_data[i]);
+			buffer_pool_free(channel_data[i]);
 
 	channel_data = g_renew(gfloat *, channel_data, num_active_channels);
 	channel_graph = g_renew(GtkDataboxGraph *, channel_graph, num_active_channels);
-	for (i = 0; i < num_active_channels; i++) {
-		channel_data[i] = g_new(gfloat, num_samples);
-		for (j = 0; j < num_samples; j++)
-			channel_data[i][j] = 0.0f;
-	}
+	for (i = 0; i < num_active_channels; i++)
+		channel_data[i] = buffer_pool_alloc0(len * sizeof(gfloat));
 
 	prev_num_active_ch = num_active_channels;
 
+	envelope_setup(is_constellation);
+
 	if (is_constellation) {
 		if (strcmp(gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(plot_type)), "Lines"))
 			fft_graph = gtk_databox_points_new(num_samples, channel_data[0],
@@ -1682,17 +3199,26 @@ static int time_capture_setup(void)
 					channel_data[1], &color_graph[0], line_thickness);
 		gtk_databox_graph_add(GTK_DATABOX (databox), fft_graph);
 	} else {
+		gfloat *x = X, **y = channel_data;
+		unsigned int len = num_samples;
+
+		if (envelope_on) {
+			x = envelope_x;
+			y = envelope_y;
+			len = ENVELOPE_POINTS(envelope_columns);
+		}
+
 		j = 0;
 		for (i = 0; i < num_channels; i++) {
 			if (!channels[i].enabled)
 				continue;
 
 			if (strcmp(gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(plot_type)), "Lines"))
-				channel_graph[j] = gtk_databox_points_new(num_samples, X,
-					channel_data[j], &color_graph[i], 3);
+				channel_graph[j] = gtk_databox_points_new(len, x,
+					y[j], &color_graph[i], 3);
 			else
-				channel_graph[j] = gtk_databox_lines_new(num_samples, X,
-					channel_data[j], &color_graph[i], line_thickness);
+				channel_graph[j] = gtk_databox_lines_new(len, x,
+					y[j], &color_graph[i], line_thickness);
 
 			gtk_databox_graph_add(GTK_DATABOX(databox), channel_graph[j]);
 			j++;
@@ -1712,7 +3238,50 @@ static int time_capture_setup(void)
 
 static void time_capture_start()
 {
-	capture_function = g_idle_add((GSourceFunc) time_capture_func, databox);
+	if (deep_capture)
+		capture_function = g_timeout_add(CAPTURE_DISPLAY_INTERVAL,
+				(GSourceFunc) deep_capture_func, databox);
+	else
+		capture_function = g_timeout_add(CAPTURE_DISPLAY_INTERVAL,
+				(GSourceFunc) time_capture_func, databox);
+}
+
+/* Samples of the last time domain capture, deep or not */
+unsigned int capture_data_samples(void)
+{
+	if (deep_capture)
+		return g_atomic_int_get(&deep_captured);
+
+	return num_samples;
+}
+
+/*
+ * Walk the samples of the last time domain capture from @pos on, a piece
+ * at a time: points @data at one array per enabled channel and returns how
+ * many samples they hold, or 0 past the end. The arrays only stay valid
+ * until the next call.
+ */
+unsigned int capture_data_read(unsigned int pos, gfloat ***data)
+{
+	static gfloat **view;
+	unsigned int total = capture_data_samples(), n, i;
+
+	if (!channel_data || pos >= total)
+		return 0;
+
+	if (deep_capture) {
+		n = MIN(total - pos, DEEP_SCRATCH);
+		deep_demux(pos, n);
+		*data = channel_data;
+		return n;
+	}
+
+	view = g_renew(gfloat *, view, num_active_channels);
+	for (i = 0; i < num_active_channels; i++)
+		view[i] = channel_data[i] + pos;
+	*data = view;
+
+	return total - pos;
 }
 
 static void capture_button_clicked(GtkToggleToolButton *btn, gpointer data)
@@ -1724,11 +3293,9 @@ static void capture_button_clicked(GtkToggleToolButton *btn, gpointer data)
 	if (gtk_toggle_tool_button_get_active(btn)) {
 		gtk_databox_graph_remove_all(GTK_DATABOX(databox));
 
-		G_TRYLOCK(buffer_full);
-		G_TRYLOCK(markers_copy);
+		markers_set_running(true);
 
 		data_buffer.available = 0;
-		current_sample = 0;
 		num_active_channels = 0;
 		bytes_per_sample = 0;
 		for (i = 0; i < num_channels; i++) {
@@ -1737,8 +3304,12 @@ static void capture_button_clicked(GtkToggleToolButton *btn, gpointer data)
 				num_active_channels++;
 			}
 		}
+		demux_plan_build(&capture_demux, channels, num_channels);
+		demux_plan_convert(&capture_demux,
+				gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(si_units)));
+		demux_plan_build(&shared_demux, channels, num_channels);
 
-		if (gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)) == FFT_PLOT) {
+		if (domain_fft(gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)))) {
 			sprintf(buf, "%sHz", adc_scale);
 			gtk_label_set_text(GTK_LABEL(hor_scale), buf);
 			gtk_widget_show(marker_label);
@@ -1752,35 +3323,41 @@ static void capture_button_clicked(GtkToggleToolButton *btn, gpointer data)
 		if (ret)
 			goto play_err;
 
-		if (!is_oneshot_mode()) {
-			buffer_fd = buffer_open(num_samples, O_NONBLOCK);
-			if (buffer_fd < 0)
-				goto play_err;
+		capture_source = source_is_current() ? sample_source : &iio_source;
+		ret = sample_source_open(capture_source, channels, num_channels,
+				capture_samples);
+		if (ret) {
+			capture_source = NULL;
+			goto play_err;
+		}
+
+		broadcast_start(&capture_broadcast);
+		if (capture_frames_setup(data_buffer.size) ||
+				capture_thread_start()) {
+			broadcast_stop(&capture_broadcast);
+			capture_source_close();
+			goto play_err;
 		}
 
 		add_grid();
 		gtk_widget_queue_draw(GTK_WIDGET(databox));
 		frame_counter = 0;
 
-		if (gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)) == FFT_PLOT)
+		if (domain_fft(gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain))))
 			fft_capture_start();
 		else
 			time_capture_start();
 
 	} else {
-		G_TRYLOCK(buffer_full);
-		G_UNLOCK(buffer_full);
-		G_TRYLOCK(markers_copy);
-		G_UNLOCK(markers_copy);
+		broadcast_stop(&capture_broadcast);
+		markers_set_running(false);
 
 		if (capture_function > 0) {
 			g_source_remove(capture_function);
 			capture_function = 0;
 		}
-		if (buffer_fd >= 0) {
-			buffer_close(buffer_fd);
-			buffer_fd = -1;
-		}
+		capture_thread_join();
+		capture_source_close();
 	}
 
 	return;
@@ -1808,6 +3385,9 @@ static double read_sampling_frequency(void)
 	double freq = 1.0;
 	int ret;
 
+	if (source_is_current())
+		return sample_source->sample_rate;
+
 	if (set_dev_paths(current_device) < 0)
 		return -1.0f;
 
@@ -1844,12 +3424,48 @@ void time_interval_adjust(void)
 	adj = gtk_spin_button_get_adjustment(GTK_SPIN_BUTTON(time_interval_widget));
 
 	min_time = (SAMPLE_COUNT_MIN_VALUE / adc_freq_raw) * 1000000;
-	max_time = (SAMPLE_COUNT_MAX_VALUE / adc_freq_raw) * 1000000;
+	if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(deep_memory)))
+		max_time = (DEEP_SAMPLE_COUNT_MAX_VALUE / adc_freq_raw) * 1000000;
+	else
+		max_time = (SAMPLE_COUNT_MAX_VALUE / adc_freq_raw) * 1000000;
 
 	gtk_adjustment_set_lower(adj, min_time);
 	gtk_adjustment_set_upper(adj, max_time);
 }
 
+/* Plans already made are upgraded the next time they are used */
+static void fft_planning_changed(GtkComboBox *box, gpointer data)
+{
+	fft_plan_set_rigor(gtk_combo_box_get_active(box));
+}
+
+/* New rows take the colours and levels; the ones already drawn keep theirs */
+static void waterfall_settings_changed(GtkWidget *widget, gpointer data)
+{
+	waterfall_set_colormap(&fft_waterfall,
+			gtk_combo_box_get_active(GTK_COMBO_BOX(waterfall_colormap_widget)));
+	waterfall_set_range(&fft_waterfall,
+			gtk_spin_button_get_value(GTK_SPIN_BUTTON(waterfall_min_widget)),
+			gtk_spin_button_get_value(GTK_SPIN_BUTTON(waterfall_max_widget)));
+}
+
+/* Deep memory raises the sample count limit, for the time domain */
+static void deep_memory_toggled(GtkToggleButton *btn, gpointer data)
+{
+	GtkAdjustment *adj;
+
+	adj = gtk_spin_button_get_adjustment(GTK_SPIN_BUTTON(sample_count_widget));
+	if (gtk_toggle_button_get_active(btn)) {
+		gtk_adjustment_set_upper(adj, DEEP_SAMPLE_COUNT_MAX_VALUE);
+	} else {
+		gtk_adjustment_set_upper(adj, SAMPLE_COUNT_MAX_VALUE);
+		if (gtk_adjustment_get_value(adj) > SAMPLE_COUNT_MAX_VALUE)
+			gtk_adjustment_set_value(adj, SAMPLE_COUNT_MAX_VALUE);
+	}
+
+	time_interval_adjust();
+}
+
 void rx_update_labels(void)
 {
 	char buf[20];
@@ -2238,6 +3854,8 @@ static void device_list_cb(GtkWidget *widget, gpointer data)
 	int i;
 
 	gtk_list_store_clear(channel_list_store);
+	gtk_list_store_clear(GTK_LIST_STORE(gtk_combo_box_get_model(
+			GTK_COMBO_BOX(trigger_source))));
 	if (num_channels)
 		free_channel_array(channels, num_channels);
 
@@ -2251,7 +3869,11 @@ static void device_list_cb(GtkWidget *widget, gpointer data)
 	set_dev_paths(current_device);
 	plugin_setup_validation_fct = find_setup_check_fct_by_devname(current_device);
 
-	ret = build_channel_array(dev_name_dir(), &channels, &num_channels);
+	if (source_is_current())
+		ret = sample_source_get_channels(sample_source,
+				&channels, &num_channels);
+	else
+		ret = build_channel_array(dev_name_dir(), &channels, &num_channels);
 	if (ret)
 		return;
 
@@ -2262,8 +3884,11 @@ static void device_list_cb(GtkWidget *widget, gpointer data)
 			gtk_list_store_append(channel_list_store, &iter);
 			gtk_list_store_set(channel_list_store, &iter, 0, channels[i].name,
 				1, channels[i].enabled, 2, &channels[i], -1);
+			gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(trigger_source),
+				channels[i].name);
 		}
 	}
+	gtk_combo_box_set_active(GTK_COMBO_BOX(trigger_source), 0);
 
 }
 
@@ -2275,6 +3900,10 @@ static void init_device_list(void)
 	g_signal_connect(device_list_widget, "changed",
 			G_CALLBACK(device_list_cb), NULL);
 
+	if (sample_source)
+		gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(device_list_widget),
+				sample_source->device);
+
 	num = find_iio_names(&devices, "iio:device");
 	if (devices != NULL) {
 		device = devices;
@@ -2286,10 +3915,10 @@ static void init_device_list(void)
 			device += strlen(device) + 1;
 		}
 		free(devices);
-
-		gtk_combo_box_set_active(GTK_COMBO_BOX(device_list_widget), 0);
 	}
 
+	gtk_combo_box_set_active(GTK_COMBO_BOX(device_list_widget), 0);
+
 	device_list_cb(device_list_widget, NULL);
 }
 
@@ -2309,6 +3938,13 @@ void channel_toggled(GtkCellRendererToggle* renderer, gchar* pathStr, gpointer d
 	gtk_tree_model_get(GTK_TREE_MODEL (data), &iter, 1, &enabled, 2, &channel, -1);
 	enabled = !enabled;
 
+	if (source_is_current()) {
+		/* a recording has the channels it has */
+		if (sample_source->fixed_layout)
+			enabled = channel->enabled;
+		goto out;
+	}
+
 	snprintf(buf, sizeof(buf), "%s/scan_elements/%s_en", dev_name_dir(), channel->name);
 	f = fopen(buf, "w");
 	if (f) {
@@ -2323,6 +3959,7 @@ void channel_toggled(GtkCellRendererToggle* renderer, gchar* pathStr, gpointer d
 	} else
 		enabled = false;
 
+out:
 	channel->enabled = enabled;
 	gtk_list_store_set(GTK_LIST_STORE (data), &iter, 1, enabled, -1);
 }
@@ -2344,14 +3981,21 @@ static gboolean capture_button_icon_transform(GBinding *binding,
 static gboolean domain_is_fft(GBinding *binding,
         const GValue *source_value, GValue *target_value, gpointer user_data)
 {
-	g_value_set_boolean(target_value, g_value_get_int(source_value) == FFT_PLOT);
+	g_value_set_boolean(target_value, domain_fft(g_value_get_int(source_value)));
 	return TRUE;
 }
 
 static gboolean domain_is_time(GBinding *binding,
 	const GValue *source_value, GValue *target_value, gpointer user_data)
 {
-	g_value_set_boolean(target_value, g_value_get_int(source_value) != FFT_PLOT);
+	g_value_set_boolean(target_value, !domain_fft(g_value_get_int(source_value)));
+	return TRUE;
+}
+
+static gboolean domain_is_waterfall(GBinding *binding,
+	const GValue *source_value, GValue *target_value, gpointer user_data)
+{
+	g_value_set_boolean(target_value, g_value_get_int(source_value) == WATERFALL_PLOT);
 	return TRUE;
 }
 
@@ -2374,7 +4018,7 @@ static gboolean check_valid_setup()
 
 	/* Additional validation rules provided by the plugin of the device */
 	if (plugin_setup_validation_fct)
-		if (gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)) == FFT_PLOT ||
+		if (domain_fft(gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain))) ||
 			gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)) == XY_PLOT)
 			if (j == 2)
 				if(!(*plugin_setup_validation_fct)(channels, num_channels, ch_names)) {
@@ -2386,9 +4030,17 @@ static gboolean check_valid_setup()
 
 
 	/* Basic validation rules */
-	if (gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)) == FFT_PLOT) {
-		if (j != 2 && j != 1) {
-			gtk_widget_set_tooltip_text(capture_button, "FFT needs 2 channels or less");
+	if (domain_fft(gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)))) {
+		bool iq = fft_channels_iq(channels, num_channels);
+
+		if (j == 0 || fft_channels_traces(j, iq) > G_N_ELEMENTS(color_graph)) {
+			gtk_widget_set_tooltip_text(capture_button,
+				"FFT shows at most 4 channels or I/Q pairs");
+			goto capture_button_err;
+		}
+		if (!fft_channels_s16(channels, num_channels)) {
+			gtk_widget_set_tooltip_text(capture_button,
+				"FFT needs 16 bit samples");
 			goto capture_button_err;
 		}
 	} else if (gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)) == XY_PLOT) {
@@ -2430,17 +4082,21 @@ capture_button_err:
 gboolean time_to_samples(GBinding *binding, const GValue *source_val,
 	GValue *target_val, gpointer data)
 {
+	GtkAdjustment *adj;
 	gdouble time;
 	gdouble samples;
 
+	/* Deep memory moves the upper limit */
+	adj = gtk_spin_button_get_adjustment(GTK_SPIN_BUTTON(sample_count_widget));
+
 	time = g_value_get_double(source_val);
 	/* Microseconds to seconds */
 	time /= 1000000.0;
 	samples = time * adc_freq_raw;
 	if (samples < 10)
 		samples = 10;
-	else if (samples > 1000000)
-		samples = 1000000;
+	else if (samples > gtk_adjustment_get_upper(adj))
+		samples = gtk_adjustment_get_upper(adj);
 	g_value_set_double(target_val, samples);
 
 	return TRUE;
@@ -2499,17 +4155,41 @@ void capture_profile_save(const char *filename)
 	fprintf(inifp, "domain=");
 	if (gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)) == FFT_PLOT)
 		fprintf(inifp, "%s\n", "fft");
+	else if (gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)) == WATERFALL_PLOT)
+		fprintf(inifp, "%s\n", "waterfall");
 	else if (gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)) == XY_PLOT)
 		fprintf(inifp, "%s\n", "constellation");
 	else if (gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)) == TIME_PLOT)
 		fprintf(inifp, "%s\n", "time");
 
+	tmp_int = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(deep_memory));
+	fprintf(inifp, "deep_memory=%d\n", tmp_int);
+
+	tmp_int = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(si_units));
+	fprintf(inifp, "si_units=%d\n", tmp_int);
+
+	if (deep_store.dir)
+		fprintf(inifp, "deep_memory_dir=%s\n", deep_store.dir);
+
 	tmp_int = (int)gtk_spin_button_get_value(GTK_SPIN_BUTTON(sample_count_widget));
 	fprintf(inifp, "sample_count=%d\n", tmp_int);
 
 	tmp_int = atoi(gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(fft_size_widget)));
 	fprintf(inifp, "fft_size=%d\n", tmp_int);
 
+	fprintf(inifp, "fft_planning=%s\n", fft_rigor_name(fft_plan_get_rigor()));
+	fprintf(inifp, "fft_precision=%s\n",
+			fft_plan_get_single() ? "single" : "double");
+
+	tmp_int = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(fft_avg_linear));
+	fprintf(inifp, "fft_avg_linear=%d\n", tmp_int);
+
+	tmp_int = welch_overlaps[gtk_combo_box_get_active(GTK_COMBO_BOX(fft_welch_widget))];
+	if (tmp_int < 0)
+		fprintf(inifp, "fft_welch=off\n");
+	else
+		fprintf(inifp, "fft_welch=%d\n", tmp_int);
+
 	tmp_int = gtk_spin_button_get_value(GTK_SPIN_BUTTON(fft_avg_widget));
 	fprintf(inifp, "fft_avg=%d\n", tmp_int);
 
@@ -2526,6 +4206,30 @@ void capture_profile_save(const char *filename)
 	tmp_int = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(enable_auto_scale));
 	fprintf(inifp, "enable_auto_scale=%d\n", tmp_int);
 
+	tmp_int = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(trigger_enable));
+	fprintf(inifp, "trigger_enable=%d\n", tmp_int);
+
+	tmp_string = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(trigger_edge));
+	fprintf(inifp, "trigger_edge=%s\n", tmp_string);
+	g_free(tmp_string);
+
+	tmp_string = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(trigger_source));
+	if (tmp_string)
+		fprintf(inifp, "trigger_source=%s\n", tmp_string);
+	g_free(tmp_string);
+
+	tmp_float = gtk_spin_button_get_value(GTK_SPIN_BUTTON(trigger_level));
+	fprintf(inifp, "trigger_level=%f\n", tmp_float);
+
+	tmp_float = gtk_spin_button_get_value(GTK_SPIN_BUTTON(trigger_hysteresis));
+	fprintf(inifp, "trigger_hysteresis=%f\n", tmp_float);
+
+	tmp_int = gtk_spin_button_get_value(GTK_SPIN_BUTTON(trigger_holdoff));
+	fprintf(inifp, "trigger_holdoff=%d\n", tmp_int);
+
+	tmp_int = gtk_spin_button_get_value(GTK_SPIN_BUTTON(trigger_pre));
+	fprintf(inifp, "trigger_pre=%d\n", tmp_int);
+
 	gfloat left, right, top, bottom;
 	gtk_databox_get_visible_limits(GTK_DATABOX(databox), &left, &right, &top, &bottom);
 	fprintf(inifp, "x_axis_min=%f\n", left);
@@ -2552,6 +4256,15 @@ void capture_profile_save(const char *filename)
 		if (markers[tmp_int].active)
 			fprintf(inifp, "marker.%i = %i\n", tmp_int, markers[tmp_int].bin);
 	}
+	fprintf(inifp, "marker_peak_spacing = %u\n", marker_peaks.spacing);
+	fprintf(inifp, "marker_peak_threshold = %f\n", marker_peaks.threshold);
+	fprintf(inifp, "marker_interpolation = %d\n", marker_interp);
+	fprintf(inifp, "waterfall_colormap = %s\n",
+			waterfall_colormap_name(fft_waterfall.colormap));
+	fprintf(inifp, "waterfall_min_db = %f\n",
+			gtk_spin_button_get_value(GTK_SPIN_BUTTON(waterfall_min_widget)));
+	fprintf(inifp, "waterfall_max_db = %f\n",
+			gtk_spin_button_get_value(GTK_SPIN_BUTTON(waterfall_max_widget)));
 
 	fprintf(inifp, "capture_started = %d\n", (capture_function) ? 1 : 0);
 
@@ -2691,14 +4404,59 @@ int capture_profile_handler(const char* name, const char *value)
 					gtk_combo_box_set_active(GTK_COMBO_BOX(plot_domain), TIME_PLOT);
 				else if (!strcmp(value, "fft"))
 					gtk_combo_box_set_active(GTK_COMBO_BOX(plot_domain), FFT_PLOT);
+				else if (!strcmp(value, "waterfall"))
+					gtk_combo_box_set_active(GTK_COMBO_BOX(plot_domain), WATERFALL_PLOT);
 				else if (!strcmp(value, "constellation"))
 					gtk_combo_box_set_active(GTK_COMBO_BOX(plot_domain), XY_PLOT);
+			} else if (MATCH_NAME("deep_memory")) {
+				gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(deep_memory), atoi(value));
+			} else if (MATCH_NAME("si_units")) {
+				gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(si_units), atoi(value));
+			} else if (MATCH_NAME("deep_memory_dir")) {
+				/* the store can't move while a capture writes to it */
+				if (capture_thread) {
+					printf("Can't change the deep memory directory while capturing\n");
+					ret = 0;
+				} else {
+					chunk_store_free(&deep_store);
+					chunk_store_init(&deep_store, value);
+				}
 			} else if (MATCH_NAME("sample_count")) {
 				gtk_spin_button_set_value(GTK_SPIN_BUTTON(sample_count_widget), atoi(value));
 			} else if (MATCH_NAME("fft_size")) {
 				ret = comboboxtext_set_active_by_string(GTK_COMBO_BOX(fft_size_widget), value);
 				if (ret == 0)
 					printf("found invalid fft size in .ini file\n");
+			} else if (MATCH_NAME("fft_planning")) {
+				for (i = 0; i < FFT_RIGOR_NUM; i++)
+					if (!strcmp(value, fft_rigor_name(i)))
+						break;
+				if (i < FFT_RIGOR_NUM) {
+					gtk_combo_box_set_active(GTK_COMBO_BOX(fft_planning_widget), i);
+				} else {
+					printf("found invalid FFT planning in .ini file\n");
+					ret = 0;
+				}
+			} else if (MATCH_NAME("fft_precision")) {
+				if (!strcmp(value, "single") || !strcmp(value, "double")) {
+					fft_plan_set_single(!strcmp(value, "single"));
+				} else {
+					printf("found invalid FFT precision in .ini file\n");
+					ret = 0;
+				}
+			} else if (MATCH_NAME("fft_avg_linear")) {
+				gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(fft_avg_linear), atoi(value));
+			} else if (MATCH_NAME("fft_welch")) {
+				for (i = 0; i < G_N_ELEMENTS(welch_overlaps); i++)
+					if (welch_overlaps[i] == (strcmp(value, "off") ?
+								atoi(value) : -1))
+						break;
+				if (i < G_N_ELEMENTS(welch_overlaps)) {
+					gtk_combo_box_set_active(GTK_COMBO_BOX(fft_welch_widget), i);
+				} else {
+					printf("found invalid Welch overlap in .ini file\n");
+					ret = 0;
+				}
 			} else if (MATCH_NAME("fft_avg")) {
 				gtk_spin_button_set_value(GTK_SPIN_BUTTON(fft_avg_widget), atoi(value));
 			} else if (MATCH_NAME("fft_pwr_offset")) {
@@ -2711,6 +4469,24 @@ int capture_profile_handler(const char* name, const char *value)
 				gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(show_grid), atoi(value));
 			} else if (MATCH_NAME("enable_auto_scale")) {
 				gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(enable_auto_scale), atoi(value));
+			} else if (MATCH_NAME("trigger_enable")) {
+				gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(trigger_enable), atoi(value));
+			} else if (MATCH_NAME("trigger_edge")) {
+				ret = comboboxtext_set_active_by_string(GTK_COMBO_BOX(trigger_edge), value);
+				if (ret == 0)
+					printf("found invalid trigger edge in .ini file\n");
+			} else if (MATCH_NAME("trigger_source")) {
+				ret = comboboxtext_set_active_by_string(GTK_COMBO_BOX(trigger_source), value);
+				if (ret == 0)
+					printf("found invalid trigger source in .ini file\n");
+			} else if (MATCH_NAME("trigger_level")) {
+				gtk_spin_button_set_value(GTK_SPIN_BUTTON(trigger_level), atof(value));
+			} else if (MATCH_NAME("trigger_hysteresis")) {
+				gtk_spin_button_set_value(GTK_SPIN_BUTTON(trigger_hysteresis), atof(value));
+			} else if (MATCH_NAME("trigger_holdoff")) {
+				gtk_spin_button_set_value(GTK_SPIN_BUTTON(trigger_holdoff), atoi(value));
+			} else if (MATCH_NAME("trigger_pre")) {
+				gtk_spin_button_set_value(GTK_SPIN_BUTTON(trigger_pre), atoi(value));
 			} else if (MATCH_NAME("x_axis_min")) {
 				plot_left = atof(value);
 				read_scale_params++;
@@ -2727,6 +4503,22 @@ int capture_profile_handler(const char* name, const char *value)
 				set_marker_labels((gchar *)value, MARKER_NULL);
 				for (i = 0; i <= MAX_MARKERS; i++)
 					markers[i].active = FALSE;
+			} else if (MATCH_NAME("marker_peak_spacing")) {
+				marker_peaks.spacing = atoi(value);
+			} else if (MATCH_NAME("marker_peak_threshold")) {
+				marker_peaks.threshold = atof(value);
+			} else if (MATCH_NAME("marker_interpolation")) {
+				marker_interp = !!atoi(value);
+			} else if (MATCH_NAME("waterfall_colormap")) {
+				i = waterfall_colormap_parse(value);
+				if (i < 0)
+					printf("found invalid waterfall colormap in .ini file\n");
+				else
+					gtk_combo_box_set_active(GTK_COMBO_BOX(waterfall_colormap_widget), i);
+			} else if (MATCH_NAME("waterfall_min_db")) {
+				gtk_spin_button_set_value(GTK_SPIN_BUTTON(waterfall_min_widget), atof(value));
+			} else if (MATCH_NAME("waterfall_max_db")) {
+				gtk_spin_button_set_value(GTK_SPIN_BUTTON(waterfall_max_widget), atof(value));
 			} else if (MATCH_NAME("save_png")) {
 				save_as(value, SAVE_PNG);
 			} else if (MATCH_NAME("cycle")) {
@@ -2765,6 +4557,22 @@ int capture_profile_handler(const char* name, const char *value)
 					if (atoi(value))
 						line_thickness = atoi(value);
 				}
+			} else if (MATCH_NAME("record_direct")) {
+				capture_record_direct = !!atoi(value);
+			} else if (MATCH_NAME("record_start")) {
+				if (capture_record_start(value) < 0) {
+					printf("Failed to start recording to %s\n", value);
+					ret = 0;
+				}
+			} else if (MATCH_NAME("record_stop")) {
+				capture_record_stop();
+			} else if (MATCH_NAME("stats_dump")) {
+				if (!value || stats_dump(value) < 0) {
+					printf("Failed to write statistics to %s\n", value);
+					ret = 0;
+				}
+			} else if (MATCH_NAME("stats_reset")) {
+				stats_reset();
 			} else if (MATCH_NAME("quit") || MATCH_NAME("stop")) {
 				return 0;
 			} else if (MATCH_NAME("echo")) {
@@ -2787,6 +4595,10 @@ int capture_profile_handler(const char* name, const char *value)
 					markers[i].bin = atoi(value);
 					markers[i].active = TRUE;
 				}
+			} else if (!strcmp(elems[0], "source")) {
+				if (!sample_source || sample_source_control(sample_source,
+							elems[1], value) < 0)
+					goto unhandled;
 			} else if (!strcmp(elems[0], "test")) {
 				if (!strcmp(elems[1], "message")) {
 					create_blocking_popup(GTK_MESSAGE_QUESTION, GTK_BUTTONS_CLOSE,
@@ -2845,6 +4657,7 @@ void application_quit (void)
 {
 	const char *home_dir = getenv("HOME");
 	char buf[1024];
+	int i;
 
 	/* Before we shut down, let's save the profile */
 	sprintf(buf, "%s/%s", home_dir, DEFAULT_PROFILE_NAME);
@@ -2854,16 +4667,23 @@ void application_quit (void)
 	if (capture_function > 0) {
 		g_source_remove(capture_function);
 		capture_function = 0;
-		G_TRYLOCK(buffer_full);
-		G_UNLOCK(buffer_full);
-		G_TRYLOCK(markers_copy);
-		G_UNLOCK(markers_copy);
-	}
-	if (buffer_fd >= 0) {
-		buffer_close(buffer_fd);
-		buffer_fd = -1;
+		markers_set_running(false);
 	}
+	broadcast_stop(&capture_broadcast);
+	capture_thread_join();
+	capture_source_close();
+	chunk_store_free(&deep_store);
+	g_thread_pool_free(fft_dsp_pool, FALSE, TRUE);
+	g_thread_pool_free(welch_dsp_pool, FALSE, TRUE);
+	spectrum_slot_clear(&fft_spectra);
+	waterfall_free(&fft_waterfall);
+	for (i = 0; i < CAPTURE_QUEUE_DEPTH; i++)
+		fft_plan_cache_free(&fft_plan_caches[i]);
+	g_async_queue_unref(fft_plan_free);
+	fft_plan_cleanup();
 	free_setup_check_fct_list();
+	sample_source_free(sample_source);
+	sample_source = NULL;
 
 	if (gtk_main_level())
 		gtk_main_quit();
@@ -3007,17 +4827,35 @@ static void init_application (void)
 	capture_graph = GTK_WIDGET(gtk_builder_get_object(builder, "display_capture"));
 	time_interval_widget = GTK_WIDGET(gtk_builder_get_object(builder, "time_interval"));
 	sample_count_widget = GTK_WIDGET(gtk_builder_get_object(builder, "sample_count"));
+	deep_memory = GTK_WIDGET(gtk_builder_get_object(builder, "deep_memory"));
+	si_units = GTK_WIDGET(gtk_builder_get_object(builder, "si_units"));
 	fft_size_widget = GTK_WIDGET(gtk_builder_get_object(builder, "fft_size"));
 	fft_avg_widget = GTK_WIDGET(gtk_builder_get_object(builder, "fft_avg"));
 	fft_pwr_offset_widget = GTK_WIDGET(gtk_builder_get_object(builder, "pwr_offset"));
+	fft_planning_widget = GTK_WIDGET(gtk_builder_get_object(builder, "fft_planning"));
+	fft_welch_widget = GTK_WIDGET(gtk_builder_get_object(builder, "fft_welch"));
+	fft_analyzed_widget = GTK_WIDGET(gtk_builder_get_object(builder, "fft_analyzed"));
+	fft_avg_linear = GTK_WIDGET(gtk_builder_get_object(builder, "fft_avg_linear"));
+	waterfall_area = GTK_WIDGET(gtk_builder_get_object(builder, "waterfall_area"));
+	waterfall_colormap_widget = GTK_WIDGET(gtk_builder_get_object(builder, "waterfall_colormap"));
+	waterfall_min_widget = GTK_WIDGET(gtk_builder_get_object(builder, "waterfall_min"));
+	waterfall_max_widget = GTK_WIDGET(gtk_builder_get_object(builder, "waterfall_max"));
 	plot_domain = GTK_WIDGET(gtk_builder_get_object(builder, "capture_domains"));
 	adc_freq_label = GTK_WIDGET(gtk_builder_get_object(builder, "adc_freq_label"));
 	rx_lo_freq_label = GTK_WIDGET(gtk_builder_get_object(builder, "rx_lo_freq_label"));
 	show_grid = GTK_WIDGET(gtk_builder_get_object(builder, "show_grid"));
 	enable_auto_scale = GTK_WIDGET(gtk_builder_get_object(builder, "auto_scale"));
+	trigger_enable = GTK_WIDGET(gtk_builder_get_object(builder, "trigger_enable"));
+	trigger_edge = GTK_WIDGET(gtk_builder_get_object(builder, "trigger_edge"));
+	trigger_source = GTK_WIDGET(gtk_builder_get_object(builder, "trigger_source"));
+	trigger_level = GTK_WIDGET(gtk_builder_get_object(builder, "trigger_level"));
+	trigger_hysteresis = GTK_WIDGET(gtk_builder_get_object(builder, "trigger_hysteresis"));
+	trigger_holdoff = GTK_WIDGET(gtk_builder_get_object(builder, "trigger_holdoff"));
+	trigger_pre = GTK_WIDGET(gtk_builder_get_object(builder, "trigger_pre"));
 	notebook = GTK_WIDGET(gtk_builder_get_object(builder, "notebook"));
 	device_list_widget = GTK_WIDGET(gtk_builder_get_object(builder, "input_device_list"));
 	capture_button = GTK_WIDGET(gtk_builder_get_object(builder, "capture_button"));
+	record_menu = GTK_WIDGET(gtk_builder_get_object(builder, "record_menu"));
 	hor_scale = GTK_WIDGET(gtk_builder_get_object(builder, "hor_scale"));
 	marker_label = GTK_WIDGET(gtk_builder_get_object(builder, "marker_info"));
 	plot_type = GTK_WIDGET(gtk_builder_get_object(builder, "plot_type"));
@@ -3029,6 +4867,7 @@ static void init_application (void)
 
 	dialogs_init(builder);
 	trigger_dialog_init(builder);
+	stats_dialog_init(builder);
 
 	gtk_combo_box_set_active(GTK_COMBO_BOX(fft_size_widget), 2);
 
@@ -3052,6 +4891,42 @@ static void init_application (void)
 	g_object_bind_property_full(plot_domain, "active", fft_pwr_offset_widget, "visible",
 			0, domain_is_fft, NULL, NULL, NULL);
 
+	tmp = GTK_WIDGET(gtk_builder_get_object(builder, "fft_planning_label"));
+	g_object_bind_property_full(plot_domain, "active", tmp, "visible",
+			0, domain_is_fft, NULL, NULL, NULL);
+	g_object_bind_property_full(plot_domain, "active", fft_planning_widget, "visible",
+			0, domain_is_fft, NULL, NULL, NULL);
+
+	g_object_bind_property_full(plot_domain, "active", fft_avg_linear, "visible",
+			0, domain_is_fft, NULL, NULL, NULL);
+
+	tmp = GTK_WIDGET(gtk_builder_get_object(builder, "fft_welch_label"));
+	g_object_bind_property_full(plot_domain, "active", tmp, "visible",
+			0, domain_is_fft, NULL, NULL, NULL);
+	g_object_bind_property_full(plot_domain, "active", fft_welch_widget, "visible",
+			0, domain_is_fft, NULL, NULL, NULL);
+	tmp = GTK_WIDGET(gtk_builder_get_object(builder, "fft_analyzed_label"));
+	g_object_bind_property_full(plot_domain, "active", tmp, "visible",
+			0, domain_is_fft, NULL, NULL, NULL);
+	g_object_bind_property_full(plot_domain, "active", fft_analyzed_widget, "visible",
+			0, domain_is_fft, NULL, NULL, NULL);
+
+	tmp = GTK_WIDGET(gtk_builder_get_object(builder, "waterfall_colormap_label"));
+	g_object_bind_property_full(plot_domain, "active", tmp, "visible",
+			0, domain_is_waterfall, NULL, NULL, NULL);
+	g_object_bind_property_full(plot_domain, "active", waterfall_colormap_widget, "visible",
+			0, domain_is_waterfall, NULL, NULL, NULL);
+	tmp = GTK_WIDGET(gtk_builder_get_object(builder, "waterfall_min_label"));
+	g_object_bind_property_full(plot_domain, "active", tmp, "visible",
+			0, domain_is_waterfall, NULL, NULL, NULL);
+	g_object_bind_property_full(plot_domain, "active", waterfall_min_widget, "visible",
+			0, domain_is_waterfall, NULL, NULL, NULL);
+	tmp = GTK_WIDGET(gtk_builder_get_object(builder, "waterfall_max_label"));
+	g_object_bind_property_full(plot_domain, "active", tmp, "visible",
+			0, domain_is_waterfall, NULL, NULL, NULL);
+	g_object_bind_property_full(plot_domain, "active", waterfall_max_widget, "visible",
+			0, domain_is_waterfall, NULL, NULL, NULL);
+
 	tmp = GTK_WIDGET(gtk_builder_get_object(builder, "time_interval_label"));
 	g_object_bind_property_full(plot_domain, "active", tmp, "visible",
 			0, domain_is_time, NULL, NULL, NULL);
@@ -3067,18 +4942,41 @@ static void init_application (void)
 	g_object_bind_property_full(plot_domain, "active", sample_count_widget, "visible",
 			0, domain_is_time, NULL, NULL, NULL);
 
+	g_object_bind_property_full(plot_domain, "active", deep_memory, "visible",
+			0, domain_is_time, NULL, NULL, NULL);
+	g_object_bind_property_full(plot_domain, "active", si_units, "visible",
+			0, domain_is_time, NULL, NULL, NULL);
+
 	tmp = GTK_WIDGET(gtk_builder_get_object(builder, "plot_type_label"));
 	g_object_bind_property_full(plot_domain, "active", tmp, "visible",
 		0, domain_is_time, NULL, NULL, NULL);
 	g_object_bind_property_full(plot_domain, "active", plot_type, "visible",
 		0, domain_is_time, NULL, NULL, NULL);
 
+	tmp = GTK_WIDGET(gtk_builder_get_object(builder, "frame_trigger"));
+	g_object_bind_property_full(plot_domain, "active", tmp, "visible",
+		0, domain_is_time, NULL, NULL, NULL);
+	gtk_combo_box_set_active(GTK_COMBO_BOX(trigger_edge), 0);
+
 	gtk_combo_box_set_active(GTK_COMBO_BOX(plot_domain), TIME_PLOT);
 	gtk_combo_box_set_active(GTK_COMBO_BOX(plot_type), 0);
 
 	num_samples = 1;
-	X = g_renew(gfloat, X, num_samples);
-	fft_channel = g_renew(gfloat, fft_channel, num_samples);
+	X = buffer_pool_alloc(num_samples * sizeof(gfloat));
+	fft_channel = buffer_pool_alloc(num_samples * sizeof(gfloat));
+	chunk_store_init(&deep_store, NULL);
+	fft_plan_init(getenv("HOME"));
+	fft_plan_free = g_async_queue_new();
+	for (i = 0; i < CAPTURE_QUEUE_DEPTH; i++) {
+		fft_plan_cache_init(&fft_plan_caches[i]);
+		g_async_queue_push(fft_plan_free, &fft_plan_caches[i]);
+	}
+	fft_dsp_pool = g_thread_pool_new(fft_dsp_job, NULL,
+			CLAMP(sysconf(_SC_NPROCESSORS_ONLN), 1, CAPTURE_QUEUE_DEPTH),
+			FALSE, NULL);
+	welch_dsp_pool = g_thread_pool_new(fft_dsp_job, NULL, 1, FALSE, NULL);
+	if (broadcast_init(&capture_broadcast))
+		printf("Failed to set up the capture frame broadcast\n");
 
 	/* Create a GtkDatabox widget along with scrollbars and rulers */
 	gtk_databox_create_box_with_scrollbars_and_rulers(&databox, &table,
@@ -3087,9 +4985,16 @@ static void init_application (void)
 				G_CALLBACK(marker_button), NULL);
 	g_signal_connect(GTK_DATABOX(databox), "button_release_event",
 				G_CALLBACK(marker_button), NULL);
+	g_signal_connect(databox, "expose_event", G_CALLBACK(redraw_begin), NULL);
+	g_signal_connect_after(databox, "expose_event", G_CALLBACK(redraw_end), NULL);
 	gtk_box_pack_start(GTK_BOX(capture_graph), table, TRUE, TRUE, 0);
 	gtk_widget_modify_bg(databox, GTK_STATE_NORMAL, &color_background);
 
+	/* The waterfall paints all of itself, straight from its rows */
+	g_signal_connect(waterfall_area, "expose_event",
+			G_CALLBACK(waterfall_expose), NULL);
+	waterfall_settings_changed(NULL, NULL);
+
 	if (MAX_MARKERS) {
 		marker_type = MARKER_OFF;
 		for (i = 0; i <= MAX_MARKERS; i++) {
@@ -3112,6 +5017,16 @@ static void init_application (void)
 		G_CALLBACK(show_grid_toggled), databox);
 	g_signal_connect(enable_auto_scale, "toggled",
 		G_CALLBACK(enable_auto_scale_cb), NULL);
+	g_signal_connect(deep_memory, "toggled",
+		G_CALLBACK(deep_memory_toggled), NULL);
+	g_signal_connect(fft_planning_widget, "changed",
+		G_CALLBACK(fft_planning_changed), NULL);
+	g_signal_connect(waterfall_colormap_widget, "changed",
+		G_CALLBACK(waterfall_settings_changed), NULL);
+	g_signal_connect(waterfall_min_widget, "value-changed",
+		G_CALLBACK(waterfall_settings_changed), NULL);
+	g_signal_connect(waterfall_max_widget, "value-changed",
+		G_CALLBACK(waterfall_settings_changed), NULL);
 
 	g_signal_connect(plot_domain, "changed",
 		G_CALLBACK(check_valid_setup), NULL);
@@ -3142,6 +5057,16 @@ static void init_application (void)
 			"sample_count", "sensitive", G_BINDING_INVERT_BOOLEAN);
 	g_builder_bind_property(builder, "capture_button", "active",
 			"time_interval", "sensitive", G_BINDING_INVERT_BOOLEAN);
+	g_builder_bind_property(builder, "capture_button", "active",
+			"trigger_enable", "sensitive", G_BINDING_INVERT_BOOLEAN);
+	g_builder_bind_property(builder, "capture_button", "active",
+			"trigger_source", "sensitive", G_BINDING_INVERT_BOOLEAN);
+	g_builder_bind_property(builder, "capture_button", "active",
+			"deep_memory", "sensitive", G_BINDING_INVERT_BOOLEAN);
+	g_builder_bind_property(builder, "capture_button", "active",
+			"si_units", "sensitive", G_BINDING_INVERT_BOOLEAN);
+	g_builder_bind_property(builder, "capture_button", "active",
+			"fft_welch", "sensitive", G_BINDING_INVERT_BOOLEAN);
 
 	capture_button_bind = g_object_bind_property_full(capture_button, "active", capture_button,
 			"stock-id", 0, capture_button_icon_transform, NULL, NULL, NULL);
@@ -3157,6 +5082,8 @@ static void init_application (void)
 
 	gtk_widget_show(window);
 	gtk_widget_show_all(capture_graph);
+	g_object_bind_property_full(plot_domain, "active", waterfall_area, "visible",
+			G_BINDING_SYNC_CREATE, domain_is_waterfall, NULL, NULL, NULL);
 
 }
 
@@ -3170,10 +5097,13 @@ void usage (char *program)
 
 	/* please keep this list sorted in alphabetal order */
 	printf( "Command line options:\n"
-		"\t-p\tload specific profile\n");
+		"\t-p\tload specific profile\n"
+		"\t-s\tcapture from a sample source rather than hardware:\n%s",
+		sample_source_help());
 
 	printf("\nEnvironmental variables:\n"
-		"\tOSC_FORCE_PLUGIN\tforce loading of a specfic plugin\n");
+		"\tOSC_FORCE_PLUGIN\tforce loading of a specfic plugin\n"
+		"\tOSC_SAMPLE_SOURCE\tsame as -s\n");
 
 	exit(-1);
 }
@@ -3182,13 +5112,17 @@ gint main(gint argc, char *argv[])
 {
 	int c;
 	char *profile = NULL;
+	const char *source = getenv("OSC_SAMPLE_SOURCE");
 
 	opterr = 0;
-	while ((c = getopt (argc, argv, "p:")) != -1)
+	while ((c = getopt (argc, argv, "p:s:")) != -1)
 	switch (c) {
 		case 'p':
 			profile = strdup(optarg);
 			break;
+		case 's':
+			source = optarg;
+			break;
 		case '?':
 			usage(argv[0]);
 			break;
@@ -3198,6 +5132,12 @@ gint main(gint argc, char *argv[])
 			break;
 	}
 
+	if (source && *source) {
+		sample_source = sample_source_new(source);
+		if (!sample_source)
+			usage(argv[0]);
+	}
+
 	g_thread_init (NULL);
 	gdk_threads_init ();
 	gtk_init(&argc, &argv);
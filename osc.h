@@ -10,6 +10,8 @@
 #define IIO_THREADS
 #include <gtkdatabox.h>
 
+#include "frame_broadcast.h"
+
 extern GtkWidget *capture_graph;
 extern gint capture_function;
 extern const char *current_device;
@@ -42,10 +44,12 @@ enum marker_types {
 #define TIME_PLOT 0
 #define FFT_PLOT 1
 #define XY_PLOT 2
+#define WATERFALL_PLOT 3
 
 void rx_update_labels(void);
 void dialogs_init(GtkBuilder *builder);
 void trigger_dialog_init(GtkBuilder *builder);
+void stats_dialog_init(GtkBuilder *builder);
 void trigger_update_current_device(void);
 void application_quit (void);
 
@@ -55,12 +59,24 @@ void save_as(const char *filename, int type);
 #define SAVE_MAT 4
 #define SAVE_VSA 5
 
+unsigned int capture_data_samples(void);
+unsigned int capture_data_read(unsigned int pos, gfloat ***data);
+
+int capture_record_start(const char *filename);
+void capture_record_stop(void);
+bool capture_record_active(void);
+
 void add_ch_setup_check_fct(char * device_name, void *fp);
 
 const void * plugin_get_device_by_reference(const char *device_name);
 int plugin_data_capture_size(const char *device);
 int plugin_data_capture(const char *device, void **buf, gfloat ***cooked_data,
 			struct marker_type **markers_cp);
+struct broadcast_sub * plugin_frames_subscribe(const char *device);
+struct shared_frame * plugin_frames_next(struct broadcast_sub *sub,
+		int timeout_ms);
+void plugin_frames_release(struct shared_frame *frame);
+void plugin_frames_unsubscribe(struct broadcast_sub *sub);
 int plugin_data_capture_num_active_channels(const char *device);
 int plugin_data_capture_bytes_per_sample(const char *device);
 enum marker_types plugin_get_marker_type(const char *device);
@@ -0,0 +1,151 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <math.h>
+
+#include "peak_detect.h"
+
+static void heap_down(struct peak *heap, unsigned int len, unsigned int i)
+{
+	struct peak tmp = heap[i];
+	unsigned int c;
+
+	while ((c = 2 * i + 1) < len) {
+		if (c + 1 < len && heap[c + 1].value < heap[c].value)
+			c++;
+		if (tmp.value <= heap[c].value)
+			break;
+		heap[i] = heap[c];
+		i = c;
+	}
+	heap[i] = tmp;
+}
+
+static void heap_up(struct peak *heap, unsigned int i)
+{
+	struct peak tmp = heap[i];
+
+	while (i && heap[(i - 1) / 2].value > tmp.value) {
+		heap[i] = heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	heap[i] = tmp;
+}
+
+/* The root of the heap is the lowest of the peaks kept so far */
+static void heap_offer(struct peak *heap, unsigned int *len,
+		unsigned int max, const struct peak *p)
+{
+	if (*len < max) {
+		heap[*len] = *p;
+		heap_up(heap, (*len)++);
+	} else if (p->value > heap[0].value) {
+		heap[0] = *p;
+		heap_down(heap, *len, 0);
+	}
+}
+
+/*
+ * Fills @peaks with up to @max local maxima of @data, highest first, and
+ * returns how many were found. A plateau counts once, at its first bin;
+ * both ends of the trace count if they are higher than their neighbour.
+ */
+unsigned int peak_detect(struct peak *peaks, unsigned int max,
+		const float *data, unsigned int n,
+		const struct peak_params *params)
+{
+	unsigned int spacing = params ? params->spacing : 0;
+	float threshold = params ? params->threshold : 0;
+	struct peak last, p;
+	unsigned int i, start = 0, len = 0;
+	double sum = 0;
+	int rising = 1, have_last = 0;
+
+	if (!max || !n)
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		sum += data[i];
+
+		if (i > 0 && data[i] > data[i - 1]) {
+			start = i;
+			rising = 1;
+		} else if (i > 0 && data[i] < data[i - 1]) {
+			rising = 0;
+		}
+		if (!rising || (i + 1 < n && data[i + 1] >= data[i]))
+			continue;
+
+		p.bin = start;
+		p.value = data[i];
+
+		/* Peaks too close to each other: keep the higher one */
+		if (have_last && p.bin - last.bin < spacing) {
+			if (p.value > last.value)
+				last = p;
+			continue;
+		}
+		if (have_last)
+			heap_offer(peaks, &len, max, &last);
+		last = p;
+		have_last = 1;
+	}
+	if (have_last)
+		heap_offer(peaks, &len, max, &last);
+
+	/* Sort the heap, lowest to the back */
+	for (i = len; i > 1; i--) {
+		p = peaks[0];
+		peaks[0] = peaks[i - 1];
+		peaks[i - 1] = p;
+		heap_down(peaks, i - 1, 0);
+	}
+
+	if (threshold) {
+		float floor = sum / n;
+
+		while (len && peaks[len - 1].value < floor + threshold)
+			len--;
+	}
+
+	return len;
+}
+
+/*
+ * Where the tone behind the peak at @bin of @db, a Hann windowed power
+ * spectrum in dB, really is: returns its offset from @bin in bins, and
+ * stores in @level what the peak would read with the tone on a bin centre.
+ * For a lone tone the ratio of the higher neighbour to the peak gives the
+ * offset exactly, and the window's response there the scalloping loss.
+ * Bins that are not a peak are left as they are.
+ */
+float peak_interp_hann(const float *db, unsigned int n, unsigned int bin,
+		float *level)
+{
+	float lo, hi, r, d, w;
+
+	*level = db[bin];
+	if (bin == 0 || bin + 1 >= n)
+		return 0;
+
+	lo = db[bin - 1];
+	hi = db[bin + 1];
+	if (lo > db[bin] || hi > db[bin])
+		return 0;
+
+	/* magnitude ratio, the trace being power */
+	r = powf(10.0f, ((hi > lo ? hi : lo) - db[bin]) / 20.0f);
+	d = (2.0f * r - 1.0f) / (r + 1.0f);
+	if (d <= 0.0f)
+		return 0;
+
+	/* Hann response @d bins off centre: sinc(d) / (1 - d^2) */
+	w = sinf(M_PI * d) / (M_PI * d) / (1.0f - d * d);
+	*level -= 20.0f * log10f(w);
+
+	return hi > lo ? d : -d;
+}
@@ -0,0 +1,45 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __PEAK_DETECT_H__
+#define __PEAK_DETECT_H__
+
+/*
+ * Finds the highest local maxima of a trace in a single pass, keeping
+ * the best ones in a min-heap, so the cost is one read of the trace plus
+ * a log(N) update per peak that makes the cut.
+ */
+
+/**
+ * struct peak - a local maximum
+ * @bin: index in the trace
+ * @value: the trace at @bin
+ **/
+struct peak {
+	unsigned int bin;
+	float value;
+};
+
+/**
+ * struct peak_params - what counts as a peak
+ * @spacing: a peak gives way to a higher one fewer than this many bins
+ *		away; 0 or 1 keeps every local maximum
+ * @threshold: how far above the mean of the trace a peak has to be;
+ *		0 disables the check
+ **/
+struct peak_params {
+	unsigned int spacing;
+	float threshold;
+};
+
+unsigned int peak_detect(struct peak *peaks, unsigned int max,
+		const float *data, unsigned int n,
+		const struct peak_params *params);
+float peak_interp_hann(const float *db, unsigned int n, unsigned int bin,
+		float *level);
+
+#endif
@@ -766,8 +766,8 @@ static void display_temp(void *ptr)
 static void display_cal(void *ptr)
 {
 	int size, channels, num_samples, i;
-	int8_t *buf = NULL;
-	gfloat **cooked_data = NULL;
+	struct broadcast_sub *sub;
+	struct shared_frame *frame;
 	struct marker_type *markers = NULL;
 	gfloat *channel_I, *channel_Q;
 	gfloat max_x, min_x, avg_x;
@@ -791,6 +791,10 @@ static void display_cal(void *ptr)
 		rx_marker[0].active = false;
 	}
 
+	sub = plugin_frames_subscribe(device_ref);
+	if (!sub)
+		goto display_call_ret;
+
 	while (!kill_thread) {
 		if (kill_thread) {
 			size = 0;
@@ -798,11 +802,6 @@ static void display_cal(void *ptr)
 		} else {
 			size = plugin_data_capture_size(device_ref);
 			channels = plugin_data_capture_num_active_channels(device_ref);
-			i = plugin_data_capture_bytes_per_sample(device_ref);
-			if (i)
-				num_samples = size / i;
-			else
-				num_samples = 0;
 		}
 
 		if (size != 0 && channels == 2) {
@@ -813,26 +812,36 @@ static void display_cal(void *ptr)
 				gtk_widget_hide(cal_rx);
 			gdk_threads_leave();
 
-			/* grab the data */
-			if (cal_rx_flag && cal_rx_level && plugin_get_marker_type(device_ref) == MARKER_IMAGE) {
-				do {
-					ret = plugin_data_capture(device_ref, (void **)&buf, &cooked_data, &markers);
-				} while ((ret == -EBUSY) && !kill_thread);
-			} else {
-				do {
-					ret = plugin_data_capture(device_ref, (void **)&buf, &cooked_data, NULL);
-				} while ((ret == -EBUSY) && !kill_thread);
-			}
-
-			/* If the lock is broken, then die nicely */
-			if (kill_thread || ret != 0) {
+			/* grab the data, NULL once capture is stopped */
+			frame = plugin_frames_next(sub, -1);
+			if (kill_thread || !frame) {
+				plugin_frames_release(frame);
 				size = 0;
 				kill_thread = 1;
 				break;
 			}
 
-			channel_I = cooked_data[0];
-			channel_Q = cooked_data[1];
+			/* A frame captured before the channels were changed */
+			if (frame->num_channels != 2) {
+				plugin_frames_release(frame);
+				continue;
+			}
+
+			if (cal_rx_flag && cal_rx_level && plugin_get_marker_type(device_ref) == MARKER_IMAGE) {
+				ret = plugin_data_capture(device_ref, NULL, NULL, &markers);
+
+				/* If capture stopped, then die nicely */
+				if (kill_thread || ret != 0) {
+					plugin_frames_release(frame);
+					size = 0;
+					kill_thread = 1;
+					break;
+				}
+			}
+
+			num_samples = frame->num_samples;
+			channel_I = frame->cooked[0];
+			channel_Q = frame->cooked[1];
 			avg_x = avg_y = 0.0;
 			max_x = max_y = -MAXFLOAT;
 			min_x = min_y = MAXFLOAT;
@@ -870,6 +879,8 @@ static void display_cal(void *ptr)
 				}
 			}
 
+			plugin_frames_release(frame);
+
 			avg_x /= num_samples;
 			avg_y /= num_samples;
 
@@ -942,11 +953,9 @@ static void display_cal(void *ptr)
 
 				if (attempt == 0) {
 					/* if the current value is OK, we leave it alone */
-					do {
-						ret = plugin_data_capture(device_ref, NULL, NULL, &markers);
-					} while ((ret == -EBUSY) && !kill_thread);
+					ret = plugin_data_capture(device_ref, NULL, NULL, &markers);
 
-					/* If the lock is broken, then die nicely */
+					/* If capture stopped, then die nicely */
 					if (kill_thread || ret != 0) {
 						size = 0;
 						kill_thread = 1;
@@ -980,11 +989,9 @@ static void display_cal(void *ptr)
 					usleep(delay);
 
 					/* grab the data */
-					do {
-						ret = plugin_data_capture(device_ref, NULL, NULL, &markers);
-					} while ((ret == -EBUSY) && !kill_thread);
+					ret = plugin_data_capture(device_ref, NULL, NULL, &markers);
 
-					/* If the lock is broken, then die nicely */
+					/* If capture stopped, then die nicely */
 					if (kill_thread || ret != 0) {
 						size = 0;
 						kill_thread = 1;
@@ -1040,10 +1047,12 @@ skip_rx_cal:
 		}
 	}
 
+	plugin_frames_unsubscribe(sub);
+
 display_call_ret:
 	/* free the buffers */
-	if (buf || cooked_data || markers)
-		plugin_data_capture(NULL, (void **)&buf, &cooked_data, &markers);
+	if (markers)
+		plugin_data_capture(NULL, NULL, NULL, &markers);
 
 	kill_thread = 1;
 	g_thread_exit(NULL);
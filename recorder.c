@@ -0,0 +1,408 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "iio_utils.h"
+#include "recorder.h"
+
+/*
+ * The capture thread copies frames into a fixed pool of large, page
+ * aligned chunks and queues the full ones to a writer thread, so it never
+ * waits on the disk. If the writer falls behind far enough that the pool
+ * runs dry, whole frames are dropped and counted.
+ */
+#define RECORDER_CHUNK_SIZE (1 << 20)
+#define RECORDER_MIN_CHUNKS 16
+#define RECORDER_ALIGN 4096
+
+struct recorder_chunk {
+	int8_t *data;
+	unsigned int len;
+};
+
+struct recorder {
+	int fd;
+	GThread *thread;
+	GAsyncQueue *free_chunks;
+	GAsyncQueue *full_chunks;
+	struct recorder_chunk *chunks;
+	unsigned int num_chunks;
+	struct recorder_chunk *cur;
+	struct recorder_chunk stop;
+	struct recorder_header *header;
+
+	volatile gint frames_dropped;
+	unsigned int sample_size;
+	uint64_t queued;
+	struct recorder_index *index;
+	uint64_t index_entries;
+	uint64_t index_size;
+	uint32_t block_samples;
+	bool uniform;
+
+	GMutex lock;
+	uint64_t bytes_written;
+	int error;
+};
+
+static int recorder_write_all(struct recorder *rec, const int8_t *buf,
+		unsigned int len)
+{
+	ssize_t ret;
+
+	/* O_DIRECT only takes whole blocks, which the last chunk may not be */
+	if (len % RECORDER_ALIGN) {
+		int flags = fcntl(rec->fd, F_GETFL);
+
+		if (flags >= 0 && (flags & O_DIRECT))
+			fcntl(rec->fd, F_SETFL, flags & ~O_DIRECT);
+	}
+
+	while (len) {
+		ret = write(rec->fd, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static gpointer recorder_thread(gpointer data)
+{
+	struct recorder *rec = data;
+	struct recorder_chunk *chunk;
+	int ret = 0;
+
+	for (;;) {
+		chunk = g_async_queue_pop(rec->full_chunks);
+		if (chunk == &rec->stop)
+			break;
+
+		/* after an error, keep recycling so the capture doesn't stall */
+		if (!ret)
+			ret = recorder_write_all(rec, chunk->data, chunk->len);
+
+		g_mutex_lock(&rec->lock);
+		if (ret && !rec->error) {
+			rec->error = ret;
+			fprintf(stderr, "Recording failed: %s\n", strerror(-ret));
+		} else if (!ret) {
+			rec->bytes_written += chunk->len;
+		}
+		g_mutex_unlock(&rec->lock);
+
+		chunk->len = 0;
+		g_async_queue_push(rec->free_chunks, chunk);
+	}
+
+	return NULL;
+}
+
+static void recorder_fill_header(struct recorder *rec,
+		const struct iio_channel_info *channels, unsigned int num_channels,
+		double sample_rate)
+{
+	struct recorder_header *hdr = rec->header;
+	unsigned int i, n = 0;
+
+	memset(hdr, 0, RECORDER_HEADER_SIZE);
+	memcpy(hdr->magic, RECORDER_MAGIC, sizeof(hdr->magic));
+	hdr->version = GUINT32_TO_LE(RECORDER_VERSION);
+	hdr->header_size = GUINT32_TO_LE(RECORDER_HEADER_SIZE);
+	hdr->sample_rate = sample_rate;
+
+	for (i = 0; i < num_channels && n < RECORDER_MAX_CHANNELS; i++) {
+		struct recorder_channel *ch = &hdr->channels[n];
+
+		if (!channels[i].enabled)
+			continue;
+
+		rec->sample_size += channels[i].bytes;
+		strncpy(ch->name, channels[i].name, sizeof(ch->name) - 1);
+		ch->bytes = channels[i].bytes;
+		ch->bits_used = channels[i].bits_used;
+		ch->shift = channels[i].shift;
+		ch->is_signed = channels[i].is_signed;
+		ch->big_endian = channels[i].endianness == IIO_BE;
+		ch->scale = channels[i].scale;
+		ch->offset = channels[i].offset;
+		n++;
+	}
+	hdr->num_channels = GUINT32_TO_LE(n);
+}
+
+static int recorder_write_header(struct recorder *rec)
+{
+	ssize_t ret;
+
+	ret = pwrite(rec->fd, rec->header, RECORDER_HEADER_SIZE, 0);
+	if (ret < 0)
+		return -errno;
+
+	return ret == RECORDER_HEADER_SIZE ? 0 : -EIO;
+}
+
+static void recorder_free(struct recorder *rec)
+{
+	unsigned int i;
+
+	if (rec->free_chunks)
+		g_async_queue_unref(rec->free_chunks);
+	if (rec->full_chunks)
+		g_async_queue_unref(rec->full_chunks);
+	for (i = 0; i < rec->num_chunks; i++)
+		free(rec->chunks[i].data);
+	g_free(rec->chunks);
+	g_free(rec->index);
+	free(rec->header);
+	if (rec->fd >= 0)
+		close(rec->fd);
+	g_mutex_clear(&rec->lock);
+	g_free(rec);
+}
+
+/*
+ * Start recording the enabled @channels to @path. @frame_size is the size
+ * of what will be passed to recorder_write(), so the queue can hold a few
+ * of them. With @direct, the page cache is bypassed where the filesystem
+ * supports it.
+ */
+int recorder_start(struct recorder **recp, const char *path,
+		const struct iio_channel_info *channels, unsigned int num_channels,
+		double sample_rate, unsigned int frame_size, bool direct)
+{
+	struct recorder *rec;
+	unsigned int i;
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+	int ret;
+
+	rec = g_new0(struct recorder, 1);
+	g_mutex_init(&rec->lock);
+
+	rec->fd = open(path, flags | (direct ? O_DIRECT : 0), 0644);
+	if (rec->fd < 0 && direct && errno == EINVAL)
+		rec->fd = open(path, flags, 0644);
+	if (rec->fd < 0) {
+		ret = -errno;
+		goto err;
+	}
+
+	if (posix_memalign((void **)&rec->header, RECORDER_ALIGN,
+				RECORDER_HEADER_SIZE)) {
+		rec->header = NULL;
+		ret = -ENOMEM;
+		goto err;
+	}
+	recorder_fill_header(rec, channels, num_channels, sample_rate);
+
+	ret = recorder_write_header(rec);
+	if (ret < 0)
+		goto err;
+	if (lseek(rec->fd, RECORDER_HEADER_SIZE, SEEK_SET) < 0) {
+		ret = -errno;
+		goto err;
+	}
+
+	if (!rec->sample_size) {
+		ret = -EINVAL;
+		goto err;
+	}
+	rec->uniform = true;
+
+	rec->free_chunks = g_async_queue_new();
+	rec->full_chunks = g_async_queue_new();
+
+	rec->num_chunks = MAX(RECORDER_MIN_CHUNKS,
+			4 * (frame_size / RECORDER_CHUNK_SIZE + 1));
+	rec->chunks = g_new0(struct recorder_chunk, rec->num_chunks);
+	for (i = 0; i < rec->num_chunks; i++) {
+		if (posix_memalign((void **)&rec->chunks[i].data,
+					RECORDER_ALIGN, RECORDER_CHUNK_SIZE)) {
+			rec->chunks[i].data = NULL;
+			ret = -ENOMEM;
+			goto err;
+		}
+		g_async_queue_push(rec->free_chunks, &rec->chunks[i]);
+	}
+
+	rec->thread = g_thread_new("Recorder_thread", recorder_thread, rec);
+	if (!rec->thread) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	*recp = rec;
+
+	return 0;
+
+err:
+	fprintf(stderr, "Failed to start recording to %s: %s\n",
+			path, strerror(-ret));
+	if (rec->fd >= 0)
+		unlink(path);
+	recorder_free(rec);
+	return ret;
+}
+
+static void recorder_index_block(struct recorder *rec, unsigned int len)
+{
+	struct recorder_index *entry;
+	uint32_t samples = len / rec->sample_size;
+
+	if (rec->index_entries == rec->index_size) {
+		rec->index_size = MAX(rec->index_size * 2, 1024);
+		rec->index = g_renew(struct recorder_index, rec->index,
+				rec->index_size);
+	}
+
+	/* Only a short last block keeps the blocks uniform */
+	if (rec->index_entries) {
+		if (samples > rec->block_samples ||
+				rec->index[rec->index_entries - 1].num_samples !=
+				rec->block_samples)
+			rec->uniform = false;
+	} else {
+		rec->block_samples = samples;
+	}
+
+	entry = &rec->index[rec->index_entries++];
+	entry->offset = GUINT64_TO_LE(RECORDER_HEADER_SIZE + rec->queued);
+	entry->timestamp = GUINT64_TO_LE(g_get_real_time());
+	entry->first_sample = GUINT64_TO_LE(rec->queued / rec->sample_size);
+	entry->num_samples = GUINT32_TO_LE(samples);
+	entry->reserved = 0;
+}
+
+/*
+ * Queue a frame, from the capture thread. Never blocks: if the queue
+ * can't take the whole frame, it is dropped and false is returned.
+ */
+bool recorder_write(struct recorder *rec, const void *data, unsigned int len)
+{
+	const int8_t *src = data;
+	unsigned int room, n;
+
+	len -= len % rec->sample_size;
+
+	/* Only this thread takes free chunks, so they can only grow */
+	room = rec->cur ? RECORDER_CHUNK_SIZE - rec->cur->len : 0;
+	room += g_async_queue_length(rec->free_chunks) * RECORDER_CHUNK_SIZE;
+	if (room < len) {
+		g_atomic_int_inc(&rec->frames_dropped);
+		return false;
+	}
+
+	recorder_index_block(rec, len);
+	rec->queued += len;
+
+	while (len) {
+		if (!rec->cur)
+			rec->cur = g_async_queue_try_pop(rec->free_chunks);
+
+		n = MIN(len, RECORDER_CHUNK_SIZE - rec->cur->len);
+		memcpy(rec->cur->data + rec->cur->len, src, n);
+		rec->cur->len += n;
+		src += n;
+		len -= n;
+
+		if (rec->cur->len == RECORDER_CHUNK_SIZE) {
+			g_async_queue_push(rec->full_chunks, rec->cur);
+			rec->cur = NULL;
+		}
+	}
+
+	return true;
+}
+
+void recorder_get_stats(struct recorder *rec, struct recorder_stats *stats)
+{
+	g_mutex_lock(&rec->lock);
+	stats->bytes_written = rec->bytes_written;
+	stats->error = rec->error;
+	g_mutex_unlock(&rec->lock);
+	stats->frames_dropped = g_atomic_int_get(&rec->frames_dropped);
+}
+
+/* The index goes right after the samples */
+static int recorder_write_index(struct recorder *rec)
+{
+	uint64_t offset = RECORDER_HEADER_SIZE + rec->bytes_written;
+	size_t len = rec->index_entries * sizeof(*rec->index);
+	const int8_t *buf = (const int8_t *)rec->index;
+	int flags;
+	ssize_t ret;
+
+	flags = fcntl(rec->fd, F_GETFL);
+	if (flags >= 0 && (flags & O_DIRECT))
+		fcntl(rec->fd, F_SETFL, flags & ~O_DIRECT);
+
+	while (len) {
+		ret = pwrite(rec->fd, buf, len, offset);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buf += ret;
+		offset += ret;
+		len -= ret;
+	}
+
+	rec->header->index_offset = GUINT64_TO_LE(RECORDER_HEADER_SIZE +
+			rec->bytes_written);
+	rec->header->index_entries = GUINT64_TO_LE(rec->index_entries);
+	rec->header->block_samples = GUINT32_TO_LE(rec->uniform ?
+			rec->block_samples : 0);
+
+	return 0;
+}
+
+/*
+ * Flush what is queued, fill in the final sizes in the header and close
+ * the file. The capture thread must not be calling recorder_write() any
+ * more. Returns the first error the recording ran into.
+ */
+int recorder_stop(struct recorder *rec)
+{
+	int ret;
+
+	if (rec->cur && rec->cur->len)
+		g_async_queue_push(rec->full_chunks, rec->cur);
+	rec->cur = NULL;
+
+	g_async_queue_push(rec->full_chunks, &rec->stop);
+	g_thread_join(rec->thread);
+
+	if (!rec->error && rec->index_entries) {
+		ret = recorder_write_index(rec);
+		if (ret < 0)
+			rec->error = ret;
+	}
+
+	rec->header->data_size = GUINT64_TO_LE(rec->bytes_written);
+	rec->header->frames_dropped =
+		GUINT32_TO_LE(g_atomic_int_get(&rec->frames_dropped));
+
+	ret = recorder_write_header(rec);
+	if (!rec->error)
+		rec->error = ret;
+	ret = rec->error;
+
+	recorder_free(rec);
+
+	return ret;
+}
@@ -0,0 +1,93 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __RECORDER_H__
+#define __RECORDER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct iio_channel_info;
+struct recorder;
+
+/*
+ * A recording is a header, padded to RECORDER_HEADER_SIZE, followed by
+ * the raw samples exactly as they came out of the buffer: the enabled
+ * channels interleaved, in index order. Each frame that made it to disk
+ * is a block, and once the recording is stopped, an index of the blocks
+ * follows the samples. All fields are little endian.
+ */
+#define RECORDER_MAGIC "OSCREC01"
+#define RECORDER_VERSION 1
+#define RECORDER_HEADER_SIZE 4096
+#define RECORDER_MAX_CHANNELS 64
+
+struct recorder_channel {
+	char name[32];
+	uint8_t bytes;
+	uint8_t bits_used;
+	uint8_t shift;
+	uint8_t is_signed;
+	uint8_t big_endian;
+	uint8_t reserved[3];
+	float scale;
+	float offset;
+} __attribute__((packed));
+
+struct recorder_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint64_t data_size;
+	double sample_rate;
+	uint32_t frames_dropped;
+	uint32_t num_channels;
+	uint64_t index_offset;
+	uint64_t index_entries;
+	uint32_t block_samples;
+	uint32_t reserved;
+	struct recorder_channel channels[];
+} __attribute__((packed));
+
+/**
+ * struct recorder_index - where a block is, and when it was captured
+ * @offset: file offset of the first sample of the block
+ * @timestamp: capture time, in us since the epoch
+ * @first_sample: position of the block in the recorded samples
+ * @num_samples: samples in the block
+ *
+ * If @block_samples in the header is not zero, every block but the last
+ * has that many samples, so block n is simply index entry n.
+ **/
+struct recorder_index {
+	uint64_t offset;
+	uint64_t timestamp;
+	uint64_t first_sample;
+	uint32_t num_samples;
+	uint32_t reserved;
+} __attribute__((packed));
+
+/**
+ * struct recorder_stats - how a recording is going
+ * @bytes_written: sample data on disk so far
+ * @frames_dropped: frames that didn't fit in the queue
+ * @error: first write error, or zero
+ **/
+struct recorder_stats {
+	uint64_t bytes_written;
+	unsigned int frames_dropped;
+	int error;
+};
+
+int recorder_start(struct recorder **rec, const char *path,
+		const struct iio_channel_info *channels, unsigned int num_channels,
+		double sample_rate, unsigned int frame_size, bool direct);
+bool recorder_write(struct recorder *rec, const void *data, unsigned int len);
+void recorder_get_stats(struct recorder *rec, struct recorder_stats *stats);
+int recorder_stop(struct recorder *rec);
+
+#endif
@@ -0,0 +1,117 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "ring_buffer.h"
+
+/* Backing file for the pages, unlinked as soon as it is created */
+static int ring_buffer_backing(size_t size)
+{
+	static const char *templates[] = {
+		"/dev/shm/osc-ring-XXXXXX",
+		"/tmp/osc-ring-XXXXXX",
+	};
+	char path[32];
+	unsigned int i;
+	int fd = -1;
+
+	for (i = 0; i < sizeof(templates) / sizeof(templates[0]); i++) {
+		snprintf(path, sizeof(path), "%s", templates[i]);
+		fd = mkstemp(path);
+		if (fd >= 0)
+			break;
+	}
+	if (fd < 0)
+		return -errno;
+
+	unlink(path);
+
+	if (ftruncate(fd, size) < 0) {
+		int ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	return fd;
+}
+
+/*
+ * Map a ring of at least @min_size bytes. Returns a negative error if the
+ * system doesn't let us build the double mapping, in which case the caller
+ * should fall back to plain buffers.
+ */
+int ring_buffer_init(struct ring_buffer *rb, size_t min_size)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	size_t size;
+	void *base, *addr;
+	int fd, ret;
+
+	rb->base = NULL;
+	rb->size = 0;
+
+	if (page <= 0)
+		page = 4096;
+	size = (min_size + page - 1) / page * page;
+	if (!size)
+		return -EINVAL;
+
+	fd = ring_buffer_backing(size);
+	if (fd < 0)
+		return fd;
+
+	/* Reserve the address space for both views first */
+	base = mmap(NULL, 2 * size, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		ret = -errno;
+		goto err_close;
+	}
+
+	addr = mmap(base, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_FIXED, fd, 0);
+	if (addr != base) {
+		ret = -errno;
+		goto err_unmap;
+	}
+
+	addr = mmap((int8_t *)base + size, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_FIXED, fd, 0);
+	if (addr != (int8_t *)base + size) {
+		ret = -errno;
+		goto err_unmap;
+	}
+
+	/* The mappings keep the pages alive */
+	close(fd);
+
+	rb->base = base;
+	rb->size = size;
+
+	return 0;
+
+err_unmap:
+	munmap(base, 2 * size);
+err_close:
+	close(fd);
+	fprintf(stderr, "Failed to map capture ring: %d\n", ret);
+	return ret;
+}
+
+void ring_buffer_free(struct ring_buffer *rb)
+{
+	if (rb->base)
+		munmap(rb->base, 2 * rb->size);
+
+	rb->base = NULL;
+	rb->size = 0;
+}
@@ -0,0 +1,38 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __RING_BUFFER_H__
+#define __RING_BUFFER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * struct ring_buffer - byte ring mapped twice, back to back
+ * @base: start of the first mapping, the second one follows at base + size
+ * @size: size of the ring in bytes, a multiple of the page size
+ *
+ * Because the pages at @base are visible again right after the end of the
+ * ring, any span of up to @size bytes starting inside the ring is
+ * contiguous in memory: readers and writers never have to split at the
+ * wrap point nor move data back to the front.
+ **/
+struct ring_buffer {
+	int8_t *base;
+	size_t size;
+};
+
+int ring_buffer_init(struct ring_buffer *rb, size_t min_size);
+void ring_buffer_free(struct ring_buffer *rb);
+
+/* Address of stream position @pos */
+static inline void * ring_buffer_at(const struct ring_buffer *rb, uint64_t pos)
+{
+	return rb->base + (size_t)(pos % rb->size);
+}
+
+#endif
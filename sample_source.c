@@ -0,0 +1,234 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <stdio.h>
+#include <errno.h>
+#include <glib.h>
+
+#include "iio_utils.h"
+#include "sample_source.h"
+
+/* How far behind a paced source may fall before it stops catching up */
+#define PACER_MAX_BACKLOG_US 1000000
+/* Don't wake up more often than this (us) to hand out a few samples */
+#define PACER_MIN_SLEEP_US 2000
+
+static const struct sample_source_ops *sample_source_backends[] = {
+	&synth_source_ops,
+	&file_source_ops,
+	&replay_source_ops,
+};
+
+const char * sample_source_help(void)
+{
+	return	"\tsynth[:key=value,...]\tsynthetic tones and noise, keys:\n"
+		"\t\tchannels, bits, storage (8, 16 or 32), shift, rate,\n"
+		"\t\ttone (Hz, repeat for more tones), amplitude (0..1),\n"
+		"\t\tnoise (0..1), paced (0 to run as fast as possible)\n"
+		"\tfile:path[,key=value,...]\treplay raw interleaved samples,\n"
+		"\t\tkeys: channels, bits, storage, shift, rate, loop, paced\n"
+		"\treplay:path[,key=value,...]\tplay back a recording, keys:\n"
+		"\t\tspeed (1 is real time, 0 as fast as possible), loop,\n"
+		"\t\tstart (s); speed, loop and seek (s) can be changed with\n"
+		"\t\tsource.<key> in a profile\n";
+}
+
+/*
+ * @spec is "backend[:args]". Returns NULL, after saying why, if the backend
+ * is unknown or doesn't like its arguments.
+ */
+struct sample_source * sample_source_new(const char *spec)
+{
+	const struct sample_source_ops *ops = NULL;
+	struct sample_source *src;
+	const char *args;
+	size_t len;
+	unsigned int i;
+	int ret;
+
+	args = strchr(spec, ':');
+	len = args ? (size_t)(args - spec) : strlen(spec);
+	args = args ? args + 1 : "";
+
+	for (i = 0; i < G_N_ELEMENTS(sample_source_backends); i++) {
+		if (strlen(sample_source_backends[i]->name) == len &&
+				!strncmp(sample_source_backends[i]->name, spec, len)) {
+			ops = sample_source_backends[i];
+			break;
+		}
+	}
+	if (!ops) {
+		fprintf(stderr, "Unknown sample source '%s'\n", spec);
+		return NULL;
+	}
+
+	src = g_new0(struct sample_source, 1);
+	src->ops = ops;
+	src->device = g_strdup(ops->name);
+
+	ret = ops->init(src, args);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to set up sample source '%s': %s\n",
+				spec, strerror(-ret));
+		g_free(src->device);
+		g_free(src);
+		return NULL;
+	}
+
+	return src;
+}
+
+void sample_source_free(struct sample_source *src)
+{
+	if (!src)
+		return;
+
+	src->ops->exit(src);
+	if (src->channels)
+		free_channel_array(src->channels, src->num_channels);
+	g_free(src->device);
+	g_free(src);
+}
+
+/* A copy of the channels, to be freed with free_channel_array() */
+int sample_source_get_channels(struct sample_source *src,
+		struct iio_channel_info **channels, unsigned int *num_channels)
+{
+	struct iio_channel_info *ci;
+	unsigned int i;
+
+	*num_channels = 0;
+	ci = malloc(sizeof(*ci) * src->num_channels);
+	if (!ci)
+		return -ENOMEM;
+
+	for (i = 0; i < src->num_channels; i++) {
+		ci[i] = src->channels[i];
+		ci[i].name = strdup(src->channels[i].name);
+		ci[i].generic_name = strdup(src->channels[i].generic_name);
+	}
+
+	*channels = ci;
+	*num_channels = src->num_channels;
+
+	return 0;
+}
+
+/* Describe @num_channels identical signed little endian voltage channels */
+int sample_source_set_layout(struct sample_source *src,
+		unsigned int num_channels, unsigned int bits,
+		unsigned int storage, unsigned int shift)
+{
+	struct iio_channel_info *ci;
+	unsigned int i;
+
+	if (!num_channels || !bits || (storage != 8 && storage != 16 &&
+			storage != 32) || bits + shift > storage)
+		return -EINVAL;
+
+	if (src->channels)
+		free_channel_array(src->channels, src->num_channels);
+	src->num_channels = 0;
+
+	ci = calloc(num_channels, sizeof(*ci));
+	if (!ci)
+		return -ENOMEM;
+
+	for (i = 0; i < num_channels; i++) {
+		if (asprintf(&ci[i].name, "in_voltage%u", i) < 0)
+			ci[i].name = NULL;
+		ci[i].generic_name = strdup("in_voltage");
+		ci[i].scale = 1.0;
+		ci[i].offset = 0;
+		ci[i].index = i;
+		ci[i].bytes = storage / 8;
+		ci[i].bits_used = bits;
+		ci[i].shift = shift;
+		ci[i].mask = bits == 64 ? ~0ULL : (1ULL << bits) - 1;
+		ci[i].is_signed = 1;
+		ci[i].enabled = 1;
+		ci[i].endianness = IIO_LE;
+	}
+
+	src->channels = ci;
+	src->num_channels = num_channels;
+
+	return 0;
+}
+
+/* Call @fn for each "key=value" of the comma separated @args */
+int sample_source_for_each_arg(struct sample_source *src, const char *args,
+		int (*fn)(struct sample_source *, const char *, const char *))
+{
+	gchar **list, **arg;
+	int ret = 0;
+
+	list = g_strsplit(args, ",", 0);
+	for (arg = list; *arg && !ret; arg++) {
+		char *value = strchr(*arg, '=');
+
+		if (**arg == '\0')
+			continue;
+		if (value)
+			*value++ = '\0';
+
+		ret = fn(src, *arg, value ? value : "");
+		if (ret == -EINVAL)
+			fprintf(stderr, "Bad sample source argument '%s'\n", *arg);
+	}
+	g_strfreev(list);
+
+	return ret;
+}
+
+void sample_pacer_start(struct sample_pacer *pacer, double rate)
+{
+	pacer->rate = rate;
+	pacer->start = g_get_monotonic_time();
+	pacer->produced = 0;
+}
+
+/*
+ * How many samples, up to @max, may be produced right now. If none are due
+ * yet, sleep until some are (or @timeout_ms at most) and return 0. Nothing
+ * is counted until sample_pacer_produced() says how many actually were.
+ */
+unsigned int sample_pacer_due(struct sample_pacer *pacer,
+		unsigned int max, int timeout_ms)
+{
+	gint64 now, elapsed, wait;
+	guint64 due;
+
+	if (pacer->rate <= 0)
+		return max;
+
+	now = g_get_monotonic_time();
+	elapsed = now - pacer->start;
+
+	/* A reader that went away for a while doesn't get a burst back */
+	if (elapsed - pacer->produced * 1e6 / pacer->rate > PACER_MAX_BACKLOG_US) {
+		pacer->start = now;
+		pacer->produced = 0;
+		elapsed = 0;
+	}
+
+	due = elapsed * pacer->rate / 1e6;
+	if (due <= pacer->produced) {
+		wait = (pacer->produced + 1) * 1e6 / pacer->rate - elapsed;
+		wait = MAX(wait, PACER_MIN_SLEEP_US);
+		wait = MIN(wait, (gint64)timeout_ms * 1000);
+		g_usleep(wait);
+		return 0;
+	}
+
+	return MIN(due - pacer->produced, max);
+}
+
+void sample_pacer_produced(struct sample_pacer *pacer, unsigned int n)
+{
+	pacer->produced += n;
+}
@@ -0,0 +1,125 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __SAMPLE_SOURCE_H__
+#define __SAMPLE_SOURCE_H__
+
+#include <stdbool.h>
+#include <errno.h>
+#include <glib.h>
+
+struct iio_channel_info;
+struct sample_source;
+
+/**
+ * struct sample_source_ops - a backend samples can be captured from
+ * @name: what the backend is called on the command line
+ * @init: parse the backend arguments and describe the channels
+ * @exit: free what @init allocated
+ * @open: start streaming the enabled channels of @channels
+ * @close: stop streaming
+ * @read: copy up to @len bytes of whole samples into @buf, waiting at most
+ *	@timeout_ms for them. Returns the number of bytes, 0 if there was
+ *	nothing yet, or a negative error
+ * @control: change a setting while streaming, optional. Called from the
+ *	GUI thread while @read may be running in the capture thread
+ **/
+struct sample_source_ops {
+	const char *name;
+	int (*init)(struct sample_source *src, const char *args);
+	void (*exit)(struct sample_source *src);
+	int (*open)(struct sample_source *src,
+			const struct iio_channel_info *channels,
+			unsigned int num_channels, unsigned int num_samples);
+	void (*close)(struct sample_source *src);
+	int (*read)(struct sample_source *src, void *buf, unsigned int len,
+			int timeout_ms);
+	int (*control)(struct sample_source *src, const char *key,
+			const char *value);
+};
+
+/**
+ * struct sample_source - an instance of a backend
+ * @ops: the backend
+ * @device: name the source shows up as in the device list
+ * @sample_rate: samples per second, per channel
+ * @channels: channels offered to the user, in index order
+ * @num_channels: number of entries in @channels
+ * @fixed_layout: the channels can't be turned on and off
+ * @priv: backend data
+ **/
+struct sample_source {
+	const struct sample_source_ops *ops;
+	char *device;
+	double sample_rate;
+	struct iio_channel_info *channels;
+	unsigned int num_channels;
+	bool fixed_layout;
+	void *priv;
+};
+
+/**
+ * struct sample_pacer - hold a source to its sample rate
+ * @rate: samples per second, zero to go as fast as the reader takes them
+ * @start: monotonic time of the first sample, in us
+ * @produced: samples handed out since @start
+ **/
+struct sample_pacer {
+	double rate;
+	gint64 start;
+	guint64 produced;
+};
+
+extern const struct sample_source_ops synth_source_ops;
+extern const struct sample_source_ops file_source_ops;
+extern const struct sample_source_ops replay_source_ops;
+
+struct sample_source * sample_source_new(const char *spec);
+void sample_source_free(struct sample_source *src);
+const char * sample_source_help(void);
+
+int sample_source_get_channels(struct sample_source *src,
+		struct iio_channel_info **channels, unsigned int *num_channels);
+int sample_source_set_layout(struct sample_source *src,
+		unsigned int num_channels, unsigned int bits,
+		unsigned int storage, unsigned int shift);
+int sample_source_for_each_arg(struct sample_source *src, const char *args,
+		int (*fn)(struct sample_source *, const char *, const char *));
+
+void sample_pacer_start(struct sample_pacer *pacer, double rate);
+unsigned int sample_pacer_due(struct sample_pacer *pacer,
+		unsigned int max, int timeout_ms);
+void sample_pacer_produced(struct sample_pacer *pacer, unsigned int n);
+
+static inline int sample_source_open(struct sample_source *src,
+		const struct iio_channel_info *channels,
+		unsigned int num_channels, unsigned int num_samples)
+{
+	return src->ops->open(src, channels, num_channels, num_samples);
+}
+
+static inline void sample_source_close(struct sample_source *src)
+{
+	src->ops->close(src);
+}
+
+static inline int sample_source_read(struct sample_source *src,
+		void *buf, unsigned int len, int timeout_ms)
+{
+	return src->ops->read(src, buf, len, timeout_ms);
+}
+
+static inline int sample_source_control(struct sample_source *src,
+		const char *key, const char *value)
+{
+	if (!src->ops->control)
+		return -ENOTSUP;
+
+	return src->ops->control(src, key, value);
+}
+
+#endif
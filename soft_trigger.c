@@ -0,0 +1,135 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <errno.h>
+#include <stdbool.h>
+#include <glib.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(HAVE_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "soft_trigger.h"
+
+/*
+ * The search walks the samples in blocks. A block is only looked at one
+ * sample at a time if it can change the state: it has a sample below the
+ * re-arm threshold while the trigger is not armed, or one at or past the
+ * level while it is. Everything else is skipped after a vector compare.
+ */
+#define TRIGGER_BLOCK 64
+
+/*
+ * Samples are multiplied by @sign so that a falling edge looks like a
+ * rising one. Tells whether any of the @n samples at @data is below @low,
+ * and whether any is at or above @high.
+ */
+static void trigger_block_flags(const gfloat *data, unsigned int n,
+		gfloat sign, gfloat low, gfloat high, bool *any_low, bool *any_high)
+{
+	unsigned int i = 0;
+	bool lo = false, hi = false;
+
+#if defined(__SSE2__)
+	__m128 s = _mm_set1_ps(sign);
+	__m128 l = _mm_set1_ps(low);
+	__m128 h = _mm_set1_ps(high);
+	__m128 ml = _mm_setzero_ps();
+	__m128 mh = _mm_setzero_ps();
+	__m128 v;
+
+	for (; i + 4 <= n; i += 4) {
+		v = _mm_mul_ps(_mm_loadu_ps(data + i), s);
+		ml = _mm_or_ps(ml, _mm_cmplt_ps(v, l));
+		mh = _mm_or_ps(mh, _mm_cmpge_ps(v, h));
+	}
+	lo = _mm_movemask_ps(ml) != 0;
+	hi = _mm_movemask_ps(mh) != 0;
+#elif defined(__ARM_NEON) && defined(HAVE_NEON)
+	float32x4_t s = vdupq_n_f32(sign);
+	float32x4_t l = vdupq_n_f32(low);
+	float32x4_t h = vdupq_n_f32(high);
+	uint32x4_t ml = vdupq_n_u32(0);
+	uint32x4_t mh = vdupq_n_u32(0);
+	uint32x2_t t;
+	float32x4_t v;
+
+	for (; i + 4 <= n; i += 4) {
+		v = vmulq_f32(vld1q_f32(data + i), s);
+		ml = vorrq_u32(ml, vcltq_f32(v, l));
+		mh = vorrq_u32(mh, vcgeq_f32(v, h));
+	}
+	t = vorr_u32(vget_low_u32(ml), vget_high_u32(ml));
+	lo = (vget_lane_u32(t, 0) | vget_lane_u32(t, 1)) != 0;
+	t = vorr_u32(vget_low_u32(mh), vget_high_u32(mh));
+	hi = (vget_lane_u32(t, 0) | vget_lane_u32(t, 1)) != 0;
+#endif
+
+	for (; i < n; i++) {
+		lo |= sign * data[i] < low;
+		hi |= sign * data[i] >= high;
+	}
+
+	*any_low = lo;
+	*any_high = hi;
+}
+
+void soft_trigger_reset(struct soft_trigger *trig)
+{
+	trig->rearm_at = 0;
+}
+
+/*
+ * Look for the first edge in @data at an index between @from and @to
+ * (excluded). @first is the stream position of @data[0], used for the
+ * holdoff. The signal has to be seen on the far side of the hysteresis
+ * band before an edge counts, so noise riding on a slow edge can't set
+ * the trigger off early. Returns the index of the first sample past the
+ * level, or -ENOENT.
+ */
+int soft_trigger_find(struct soft_trigger *trig, const gfloat *data,
+		unsigned int from, unsigned int to, guint64 first)
+{
+	gfloat sign = trig->edge == SOFT_TRIGGER_FALLING ? -1.0f : 1.0f;
+	gfloat high = sign * trig->level;
+	gfloat low = high - ABS(trig->hysteresis);
+	bool armed = false, any_low, any_high;
+	unsigned int i = 0, j, end;
+	gfloat v;
+
+	if (trig->rearm_at > first) {
+		if (trig->rearm_at - first >= to)
+			return -ENOENT;
+		i = trig->rearm_at - first;
+	}
+
+	for (; i < to; i = end) {
+		end = MIN(i + TRIGGER_BLOCK, to);
+
+		trigger_block_flags(data + i, end - i, sign, low, high,
+				&any_low, &any_high);
+		if (armed ? !any_high : !any_low)
+			continue;
+
+		for (j = i; j < end; j++) {
+			v = sign * data[j];
+			if (!armed) {
+				armed = v < low;
+			} else if (v >= high) {
+				if (j >= from) {
+					trig->rearm_at = first + j + trig->holdoff;
+					return j;
+				}
+				armed = false;
+			}
+		}
+	}
+
+	return -ENOENT;
+}
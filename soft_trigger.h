@@ -0,0 +1,38 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __SOFT_TRIGGER_H__
+#define __SOFT_TRIGGER_H__
+
+#include <glib.h>
+
+enum soft_trigger_edge {
+	SOFT_TRIGGER_RISING,
+	SOFT_TRIGGER_FALLING,
+};
+
+/**
+ * struct soft_trigger - edge trigger on one demuxed channel
+ * @edge: direction the signal has to cross @level in
+ * @level: trigger level, in the units of the demuxed samples
+ * @hysteresis: how far back past @level the signal has to go to re-arm
+ * @holdoff: samples after a trigger during which crossings are ignored
+ * @rearm_at: stream position, in samples, at which the holdoff ends
+ **/
+struct soft_trigger {
+	enum soft_trigger_edge edge;
+	gfloat level;
+	gfloat hysteresis;
+	unsigned int holdoff;
+	guint64 rearm_at;
+};
+
+void soft_trigger_reset(struct soft_trigger *trig);
+int soft_trigger_find(struct soft_trigger *trig, const gfloat *data,
+		unsigned int from, unsigned int to, guint64 first);
+
+#endif
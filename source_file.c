@@ -0,0 +1,210 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include "iio_utils.h"
+#include "sample_source.h"
+
+/*
+ * Replay of raw captures: the file holds nothing but interleaved samples
+ * of all the channels, with the layout given on the command line. Since
+ * the file decides which channels are there, they can't be turned off.
+ */
+struct file_source {
+	char *path;
+	unsigned int channels, bits, storage, shift;
+	bool loop;
+	bool paced;
+
+	int fd;
+	off_t pos;
+	off_t end;
+	unsigned int sample_size;
+	bool done;
+	struct sample_pacer pacer;
+};
+
+static int file_arg(struct sample_source *src, const char *key,
+		const char *value)
+{
+	struct file_source *file = src->priv;
+	char *end;
+	double val;
+
+	/* the first argument is the path */
+	if (!file->path) {
+		if (*value)
+			return -EINVAL;
+		file->path = g_strdup(key);
+		return 0;
+	}
+
+	val = strtod(value, &end);
+	if (end == value || *end != '\0' || val < 0)
+		return -EINVAL;
+
+	if (!strcmp(key, "channels") && val >= 1)
+		file->channels = val;
+	else if (!strcmp(key, "bits") && val >= 1)
+		file->bits = val;
+	else if (!strcmp(key, "storage"))
+		file->storage = val;
+	else if (!strcmp(key, "shift"))
+		file->shift = val;
+	else if (!strcmp(key, "rate") && val > 0)
+		src->sample_rate = val;
+	else if (!strcmp(key, "loop"))
+		file->loop = val != 0;
+	else if (!strcmp(key, "paced"))
+		file->paced = val != 0;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+static void file_exit(struct sample_source *src)
+{
+	struct file_source *file = src->priv;
+
+	if (!file)
+		return;
+
+	g_free(file->path);
+	g_free(file);
+	src->priv = NULL;
+}
+
+static int file_init(struct sample_source *src, const char *args)
+{
+	struct file_source *file;
+	int ret;
+
+	file = g_new0(struct file_source, 1);
+	file->channels = 2;
+	file->bits = 16;
+	file->storage = 16;
+	file->loop = true;
+	file->paced = true;
+	file->fd = -1;
+	src->sample_rate = 1000000;
+	src->fixed_layout = true;
+	src->priv = file;
+
+	ret = sample_source_for_each_arg(src, args, file_arg);
+	if (ret < 0)
+		goto err;
+
+	if (!file->path || access(file->path, R_OK) < 0) {
+		ret = file->path ? -errno : -EINVAL;
+		goto err;
+	}
+
+	ret = sample_source_set_layout(src, file->channels, file->bits,
+			file->storage, file->shift);
+	if (ret < 0)
+		goto err;
+
+	g_free(src->device);
+	src->device = g_strdup_printf("file:%s", file->path);
+
+	return 0;
+
+err:
+	file_exit(src);
+	return ret;
+}
+
+static int file_open(struct sample_source *src,
+		const struct iio_channel_info *channels,
+		unsigned int num_channels, unsigned int num_samples)
+{
+	struct file_source *file = src->priv;
+	struct stat st;
+
+	file->fd = open(file->path, O_RDONLY);
+	if (file->fd < 0)
+		return -errno;
+
+	if (fstat(file->fd, &st) < 0) {
+		int ret = -errno;
+
+		close(file->fd);
+		file->fd = -1;
+		return ret;
+	}
+
+	/* a truncated last sample would put every later one out of step */
+	file->sample_size = file->channels * file->storage / 8;
+	file->end = st.st_size - st.st_size % file->sample_size;
+	file->pos = 0;
+	file->done = false;
+
+	sample_pacer_start(&file->pacer, file->paced ? src->sample_rate : 0);
+
+	return 0;
+}
+
+static void file_close(struct sample_source *src)
+{
+	struct file_source *file = src->priv;
+
+	if (file->fd >= 0)
+		close(file->fd);
+	file->fd = -1;
+}
+
+static int file_read(struct sample_source *src, void *buf, unsigned int len,
+		int timeout_ms)
+{
+	struct file_source *file = src->priv;
+	unsigned int n;
+	ssize_t ret;
+
+	if (file->pos >= file->end) {
+		if (!file->loop || !file->end) {
+			if (!file->done)
+				printf("End of %s\n", file->path);
+			file->done = true;
+			g_usleep(timeout_ms * 1000);
+			return 0;
+		}
+		file->pos = 0;
+	}
+
+	n = MIN(len / file->sample_size,
+			(file->end - file->pos) / file->sample_size);
+	n = sample_pacer_due(&file->pacer, n, timeout_ms);
+	if (!n)
+		return 0;
+
+	ret = pread(file->fd, buf, n * file->sample_size, file->pos);
+	if (ret < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	/* a short read only counts for the samples it did return */
+	ret -= ret % file->sample_size;
+	file->pos += ret;
+	sample_pacer_produced(&file->pacer, ret / file->sample_size);
+
+	return ret;
+}
+
+const struct sample_source_ops file_source_ops = {
+	.name = "file",
+	.init = file_init,
+	.exit = file_exit,
+	.open = file_open,
+	.close = file_close,
+	.read = file_read,
+};
@@ -0,0 +1,458 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include "iio_utils.h"
+#include "recorder.h"
+#include "sample_source.h"
+
+/*
+ * Playback of a recording made with the recorder. The file is read through
+ * a window mapped from it, so recordings much larger than the address
+ * space work too. The block index makes seeking O(1) for the usual case of
+ * uniform blocks (a binary search otherwise), and seeks always land on a
+ * block boundary, where the original frames started.
+ */
+#define REPLAY_WINDOW (64 << 20)
+
+struct replay_source {
+	char *path;
+	double speed;
+	bool loop;
+	double start;
+
+	int fd;
+	uint64_t file_size;
+	uint64_t data_start;
+	uint64_t data_end;
+	unsigned int sample_size;
+	struct recorder_index *index;
+	uint64_t entries;
+	uint32_t block_samples;
+
+	int8_t *window;
+	uint64_t window_start;
+	size_t window_len;
+
+	/* shared with the GUI thread */
+	GMutex lock;
+	uint64_t pos;
+	bool restart;
+	bool done;
+
+	struct sample_pacer pacer;
+};
+
+static int replay_arg(struct sample_source *src, const char *key,
+		const char *value)
+{
+	struct replay_source *replay = src->priv;
+	char *end;
+	double val;
+
+	if (!replay->path) {
+		if (*value)
+			return -EINVAL;
+		replay->path = g_strdup(key);
+		return 0;
+	}
+
+	val = strtod(value, &end);
+	if (end == value || *end != '\0' || val < 0)
+		return -EINVAL;
+
+	if (!strcmp(key, "speed"))
+		replay->speed = val;
+	else if (!strcmp(key, "loop"))
+		replay->loop = val != 0;
+	else if (!strcmp(key, "start"))
+		replay->start = val;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+static int replay_read_header(struct sample_source *src)
+{
+	struct replay_source *replay = src->priv;
+	struct recorder_header *hdr;
+	struct iio_channel_info *ci;
+	unsigned int i, num_channels;
+	uint64_t data_size, index_offset;
+	struct stat st;
+	int ret;
+
+	if (fstat(replay->fd, &st) < 0)
+		return -errno;
+	replay->file_size = st.st_size;
+
+	hdr = g_malloc0(RECORDER_HEADER_SIZE);
+	if (pread(replay->fd, hdr, RECORDER_HEADER_SIZE, 0) != RECORDER_HEADER_SIZE ||
+			memcmp(hdr->magic, RECORDER_MAGIC, sizeof(hdr->magic)) ||
+			GUINT32_FROM_LE(hdr->version) != RECORDER_VERSION) {
+		fprintf(stderr, "%s is not a recording\n", replay->path);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	num_channels = GUINT32_FROM_LE(hdr->num_channels);
+	if (!num_channels || num_channels > RECORDER_MAX_CHANNELS) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	ci = calloc(num_channels, sizeof(*ci));
+	if (!ci) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	replay->sample_size = 0;
+	for (i = 0; i < num_channels; i++) {
+		const struct recorder_channel *ch = &hdr->channels[i];
+
+		ci[i].name = strndup(ch->name, sizeof(ch->name));
+		if (iioutils_break_up_name(ci[i].name, &ci[i].generic_name))
+			ci[i].generic_name = strdup(ci[i].name);
+		ci[i].scale = ch->scale;
+		ci[i].offset = ch->offset;
+		ci[i].index = i;
+		ci[i].bytes = ch->bytes;
+		ci[i].bits_used = ch->bits_used;
+		ci[i].shift = ch->shift;
+		ci[i].mask = ch->bits_used >= 64 ? ~0ULL :
+			(1ULL << ch->bits_used) - 1;
+		ci[i].is_signed = ch->is_signed;
+		ci[i].enabled = 1;
+		ci[i].endianness = ch->big_endian ? IIO_BE : IIO_LE;
+		replay->sample_size += ch->bytes;
+	}
+	src->channels = ci;
+	src->num_channels = num_channels;
+	src->sample_rate = hdr->sample_rate;
+
+	if (!replay->sample_size) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	/* A recording that was never stopped has no sizes and no index */
+	replay->data_start = GUINT32_FROM_LE(hdr->header_size);
+	data_size = GUINT64_FROM_LE(hdr->data_size);
+	if (!data_size || replay->data_start + data_size > replay->file_size)
+		data_size = replay->file_size - replay->data_start;
+	data_size -= data_size % replay->sample_size;
+	replay->data_end = replay->data_start + data_size;
+
+	index_offset = GUINT64_FROM_LE(hdr->index_offset);
+	replay->entries = GUINT64_FROM_LE(hdr->index_entries);
+	replay->block_samples = GUINT32_FROM_LE(hdr->block_samples);
+	if (replay->entries && index_offset + replay->entries *
+			sizeof(*replay->index) <= replay->file_size) {
+		size_t len = replay->entries * sizeof(*replay->index);
+
+		replay->index = g_malloc(len);
+		if (pread(replay->fd, replay->index, len, index_offset) != len) {
+			g_free(replay->index);
+			replay->index = NULL;
+		}
+	}
+	if (!replay->index)
+		replay->entries = 0;
+
+	for (i = 0; i < replay->entries; i++) {
+		struct recorder_index *entry = &replay->index[i];
+
+		entry->offset = GUINT64_FROM_LE(entry->offset);
+		entry->timestamp = GUINT64_FROM_LE(entry->timestamp);
+		entry->first_sample = GUINT64_FROM_LE(entry->first_sample);
+		entry->num_samples = GUINT32_FROM_LE(entry->num_samples);
+	}
+
+	ret = 0;
+out:
+	g_free(hdr);
+	return ret;
+}
+
+static void replay_exit(struct sample_source *src)
+{
+	struct replay_source *replay = src->priv;
+
+	if (!replay)
+		return;
+
+	if (replay->fd >= 0)
+		close(replay->fd);
+	g_mutex_clear(&replay->lock);
+	g_free(replay->index);
+	g_free(replay->path);
+	g_free(replay);
+	src->priv = NULL;
+}
+
+static int replay_init(struct sample_source *src, const char *args)
+{
+	struct replay_source *replay;
+	int ret;
+
+	replay = g_new0(struct replay_source, 1);
+	replay->speed = 1.0;
+	replay->loop = true;
+	replay->fd = -1;
+	g_mutex_init(&replay->lock);
+	src->fixed_layout = true;
+	src->priv = replay;
+
+	ret = sample_source_for_each_arg(src, args, replay_arg);
+	if (ret < 0)
+		goto err;
+	if (!replay->path) {
+		ret = -EINVAL;
+		goto err;
+	}
+
+	replay->fd = open(replay->path, O_RDONLY);
+	if (replay->fd < 0) {
+		ret = -errno;
+		goto err;
+	}
+
+	ret = replay_read_header(src);
+	if (ret < 0)
+		goto err;
+
+	g_free(src->device);
+	src->device = g_strdup_printf("replay:%s", replay->path);
+
+	return 0;
+
+err:
+	if (src->channels)
+		free_channel_array(src->channels, src->num_channels);
+	src->channels = NULL;
+	src->num_channels = 0;
+	replay_exit(src);
+	return ret;
+}
+
+/* Byte offset of the block holding @sample */
+static uint64_t replay_block_offset(struct replay_source *replay,
+		uint64_t sample)
+{
+	uint64_t lo, hi, mid, offset;
+
+	if (!replay->entries) {
+		offset = replay->data_start + sample * replay->sample_size;
+		return MIN(offset, replay->data_end);
+	}
+
+	if (replay->block_samples) {
+		lo = MIN(sample / replay->block_samples, replay->entries - 1);
+	} else {
+		lo = 0;
+		hi = replay->entries - 1;
+		while (lo < hi) {
+			mid = (lo + hi + 1) / 2;
+			if (replay->index[mid].first_sample <= sample)
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
+	}
+
+	return replay->index[lo].offset;
+}
+
+static void replay_seek(struct replay_source *replay, double rate,
+		double seconds)
+{
+	uint64_t pos = replay_block_offset(replay, seconds * rate);
+
+	g_mutex_lock(&replay->lock);
+	replay->pos = pos;
+	replay->done = false;
+	replay->restart = true;
+	g_mutex_unlock(&replay->lock);
+}
+
+static void replay_print_position(struct replay_source *replay, double rate)
+{
+	uint64_t sample, i;
+	char when[32] = "";
+	time_t t;
+
+	g_mutex_lock(&replay->lock);
+	sample = (replay->pos - replay->data_start) / replay->sample_size;
+	g_mutex_unlock(&replay->lock);
+
+	if (replay->entries) {
+		i = replay->block_samples ?
+			MIN(sample / replay->block_samples, replay->entries - 1) : 0;
+		while (!replay->block_samples && i + 1 < replay->entries &&
+				replay->index[i + 1].first_sample <= sample)
+			i++;
+		t = replay->index[i].timestamp / 1000000;
+		strftime(when, sizeof(when), " (captured %F %T)", localtime(&t));
+	}
+
+	printf("Replay at %.6f s%s\n", sample / rate, when);
+}
+
+static int replay_open(struct sample_source *src,
+		const struct iio_channel_info *channels,
+		unsigned int num_channels, unsigned int num_samples)
+{
+	struct replay_source *replay = src->priv;
+
+	replay->window = NULL;
+	replay_seek(replay, src->sample_rate, replay->start);
+
+	return 0;
+}
+
+static void replay_close(struct sample_source *src)
+{
+	struct replay_source *replay = src->priv;
+
+	if (replay->window)
+		munmap(replay->window, replay->window_len);
+	replay->window = NULL;
+}
+
+/* Make sure the window covers @offset, returns how much of it does */
+static size_t replay_map(struct replay_source *replay, uint64_t offset)
+{
+	long page = sysconf(_SC_PAGESIZE);
+
+	if (replay->window && offset >= replay->window_start &&
+			offset < replay->window_start + replay->window_len)
+		return replay->window_start + replay->window_len - offset;
+
+	if (replay->window)
+		munmap(replay->window, replay->window_len);
+
+	replay->window_start = offset - offset % page;
+	replay->window_len = MIN(REPLAY_WINDOW,
+			replay->data_end - replay->window_start);
+	replay->window = mmap(NULL, replay->window_len, PROT_READ, MAP_SHARED,
+			replay->fd, replay->window_start);
+	if (replay->window == MAP_FAILED) {
+		replay->window = NULL;
+		return 0;
+	}
+	madvise(replay->window, replay->window_len, MADV_SEQUENTIAL);
+
+	return replay->window_start + replay->window_len - offset;
+}
+
+static int replay_read(struct sample_source *src, void *buf, unsigned int len,
+		int timeout_ms)
+{
+	struct replay_source *replay = src->priv;
+	unsigned int n, max, chunk;
+	int8_t *out = buf;
+	size_t avail;
+	int ret = 0;
+
+	g_mutex_lock(&replay->lock);
+	if (replay->restart) {
+		sample_pacer_start(&replay->pacer,
+				src->sample_rate * replay->speed);
+		replay->restart = false;
+	}
+	if (replay->pos >= replay->data_end && replay->loop)
+		replay->pos = replay->data_start;
+	max = MIN(len, replay->data_end - replay->pos) / replay->sample_size;
+	if (!max && !replay->done) {
+		printf("End of %s\n", replay->path);
+		replay->done = true;
+	}
+	g_mutex_unlock(&replay->lock);
+
+	if (!max) {
+		g_usleep(timeout_ms * 1000);
+		return 0;
+	}
+
+	n = sample_pacer_due(&replay->pacer, max, timeout_ms);
+	if (!n)
+		return 0;
+
+	g_mutex_lock(&replay->lock);
+
+	/* a seek may have moved us in the meantime */
+	len = MIN(n * replay->sample_size, replay->data_end - replay->pos);
+	while (len) {
+		avail = replay_map(replay, replay->pos);
+		if (!avail) {
+			ret = -EIO;
+			break;
+		}
+		chunk = MIN(len, avail);
+		memcpy(out, replay->window + (replay->pos - replay->window_start),
+				chunk);
+		out += chunk;
+		replay->pos += chunk;
+		len -= chunk;
+	}
+
+	g_mutex_unlock(&replay->lock);
+
+	sample_pacer_produced(&replay->pacer,
+			(out - (int8_t *)buf) / replay->sample_size);
+
+	return ret ? ret : out - (int8_t *)buf;
+}
+
+static int replay_control(struct sample_source *src, const char *key,
+		const char *value)
+{
+	struct replay_source *replay = src->priv;
+	char *end;
+	double val = strtod(value, &end);
+
+	if (end == value || val < 0)
+		return -EINVAL;
+
+	if (!strcmp(key, "seek")) {
+		replay_seek(replay, src->sample_rate, val);
+		replay_print_position(replay, src->sample_rate);
+	} else if (!strcmp(key, "speed")) {
+		g_mutex_lock(&replay->lock);
+		replay->speed = val;
+		replay->restart = true;
+		g_mutex_unlock(&replay->lock);
+	} else if (!strcmp(key, "loop")) {
+		g_mutex_lock(&replay->lock);
+		replay->loop = val != 0;
+		g_mutex_unlock(&replay->lock);
+	} else {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+const struct sample_source_ops replay_source_ops = {
+	.name = "replay",
+	.init = replay_init,
+	.exit = replay_exit,
+	.open = replay_open,
+	.close = replay_close,
+	.read = replay_read,
+	.control = replay_control,
+};
@@ -0,0 +1,247 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+#include <glib.h>
+
+#include "iio_utils.h"
+#include "sample_source.h"
+
+#define SYNTH_MAX_TONES 8
+
+/*
+ * Each tone is a phasor rotated once per sample, rather than calling
+ * sin()/cos() for every sample of every channel. Channel n sees the sum
+ * of the tones shifted by n * 90 degrees, so pairs of channels look like
+ * I/Q.
+ */
+struct synth_tone {
+	double freq;
+	double re, im;
+	double rot_re, rot_im;
+};
+
+struct synth_source {
+	unsigned int channels, bits, storage, shift;
+	double amplitude;
+	double noise;
+	bool paced;
+	unsigned int num_tones;
+	struct synth_tone tones[SYNTH_MAX_TONES];
+
+	unsigned int num_enabled;
+	unsigned int *enabled;
+	guint32 seed;
+	struct sample_pacer pacer;
+};
+
+static int synth_arg(struct sample_source *src, const char *key,
+		const char *value)
+{
+	struct synth_source *synth = src->priv;
+	char *end;
+	double val = strtod(value, &end);
+
+	if (end == value || *end != '\0' || val < 0)
+		return -EINVAL;
+
+	if (!strcmp(key, "channels") && val >= 1)
+		synth->channels = val;
+	else if (!strcmp(key, "bits") && val >= 1)
+		synth->bits = val;
+	else if (!strcmp(key, "storage"))
+		synth->storage = val;
+	else if (!strcmp(key, "shift"))
+		synth->shift = val;
+	else if (!strcmp(key, "rate") && val > 0)
+		src->sample_rate = val;
+	else if (!strcmp(key, "amplitude") && val <= 1)
+		synth->amplitude = val;
+	else if (!strcmp(key, "noise") && val <= 1)
+		synth->noise = val;
+	else if (!strcmp(key, "paced"))
+		synth->paced = val != 0;
+	else if (!strcmp(key, "tone") && synth->num_tones < SYNTH_MAX_TONES)
+		synth->tones[synth->num_tones++].freq = val;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+static int synth_init(struct sample_source *src, const char *args)
+{
+	struct synth_source *synth;
+	int ret;
+
+	synth = g_new0(struct synth_source, 1);
+	synth->channels = 2;
+	synth->bits = 12;
+	synth->storage = 16;
+	synth->amplitude = 0.5;
+	synth->noise = 0.01;
+	synth->paced = true;
+	src->sample_rate = 1000000;
+	src->priv = synth;
+
+	ret = sample_source_for_each_arg(src, args, synth_arg);
+	if (ret < 0)
+		goto err;
+
+	/* same as the old DEBUG generator: a cycle every 200 samples */
+	if (!synth->num_tones)
+		synth->tones[synth->num_tones++].freq = src->sample_rate / 200;
+
+	ret = sample_source_set_layout(src, synth->channels, synth->bits,
+			synth->storage, synth->shift);
+	if (ret < 0)
+		goto err;
+
+	return 0;
+
+err:
+	g_free(synth);
+	src->priv = NULL;
+	return ret;
+}
+
+static void synth_exit(struct sample_source *src)
+{
+	struct synth_source *synth = src->priv;
+
+	g_free(synth->enabled);
+	g_free(synth);
+}
+
+static int synth_open(struct sample_source *src,
+		const struct iio_channel_info *channels,
+		unsigned int num_channels, unsigned int num_samples)
+{
+	struct synth_source *synth = src->priv;
+	unsigned int i;
+
+	g_free(synth->enabled);
+	synth->enabled = g_new(unsigned int, num_channels);
+	synth->num_enabled = 0;
+	for (i = 0; i < num_channels; i++)
+		if (channels[i].enabled)
+			synth->enabled[synth->num_enabled++] = channels[i].index;
+
+	for (i = 0; i < synth->num_tones; i++) {
+		double w = 2 * G_PI * synth->tones[i].freq / src->sample_rate;
+
+		synth->tones[i].re = 1.0;
+		synth->tones[i].im = 0.0;
+		synth->tones[i].rot_re = cos(w);
+		synth->tones[i].rot_im = sin(w);
+	}
+
+	synth->seed = 0x12345678;
+	sample_pacer_start(&synth->pacer, synth->paced ? src->sample_rate : 0);
+
+	return 0;
+}
+
+static void synth_close(struct sample_source *src)
+{
+}
+
+/* xorshift, uniform in [-1, 1) */
+static inline double synth_rand(guint32 *seed)
+{
+	guint32 x = *seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*seed = x;
+
+	return (x >> 8) * (2.0 / 16777216.0) - 1.0;
+}
+
+static int synth_read(struct sample_source *src, void *buf, unsigned int len,
+		int timeout_ms)
+{
+	struct synth_source *synth = src->priv;
+	unsigned int bytes = synth->storage / 8;
+	unsigned int n, s, c, t;
+	double full_scale = (double)((1ULL << (synth->bits - 1)) - 1);
+	int8_t *out = buf;
+
+	if (!synth->num_enabled)
+		return 0;
+
+	n = sample_pacer_due(&synth->pacer,
+			len / (bytes * synth->num_enabled), timeout_ms);
+
+	for (s = 0; s < n; s++) {
+		double sum_re = 0, sum_im = 0;
+
+		for (t = 0; t < synth->num_tones; t++) {
+			struct synth_tone *tone = &synth->tones[t];
+			double re = tone->re;
+
+			sum_re += re;
+			sum_im += tone->im;
+			tone->re = re * tone->rot_re - tone->im * tone->rot_im;
+			tone->im = re * tone->rot_im + tone->im * tone->rot_re;
+		}
+
+		for (c = 0; c < synth->num_enabled; c++) {
+			unsigned int index = synth->enabled[c];
+			double v = (index & 1) ? sum_im : sum_re;
+			guint32 raw;
+
+			if (index & 2)
+				v = -v;
+			v = v * synth->amplitude / synth->num_tones +
+				synth->noise * 0.5 * (synth_rand(&synth->seed) +
+						synth_rand(&synth->seed));
+			v = CLAMP(v, -1.0, 1.0);
+
+			/* sign extended over the storage, as the converters do */
+			raw = (guint32)(gint32)lrint(v * full_scale) << synth->shift;
+
+			switch (bytes) {
+			case 1:
+				*out = raw;
+				break;
+			case 2:
+				*(uint16_t *)out = GUINT16_TO_LE(raw);
+				break;
+			case 4:
+				*(uint32_t *)out = GUINT32_TO_LE(raw);
+				break;
+			}
+			out += bytes;
+		}
+	}
+
+	/* keep the rounding errors of the rotations from growing the tones */
+	for (t = 0; t < synth->num_tones; t++) {
+		struct synth_tone *tone = &synth->tones[t];
+		double mag = hypot(tone->re, tone->im);
+
+		tone->re /= mag;
+		tone->im /= mag;
+	}
+
+	sample_pacer_produced(&synth->pacer, n);
+
+	return n * bytes * synth->num_enabled;
+}
+
+const struct sample_source_ops synth_source_ops = {
+	.name = "synth",
+	.init = synth_init,
+	.exit = synth_exit,
+	.open = synth_open,
+	.close = synth_close,
+	.read = synth_read,
+};
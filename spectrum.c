@@ -0,0 +1,95 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <glib.h>
+
+#include "spectrum.h"
+#include "buffer_pool.h"
+
+/* Only guards which frame a slot points to, never the frames themselves */
+G_LOCK_DEFINE_STATIC(spectrum_slot);
+
+/* Room for @traces traces of @bins bins and @max_peaks peaks, one reference */
+struct spectrum * spectrum_new(unsigned int bins, unsigned int traces,
+		unsigned int max_peaks)
+{
+	struct spectrum *s;
+
+	s = g_try_new0(struct spectrum, 1);
+	if (!s)
+		return NULL;
+
+	s->refs = 1;
+	s->bins = bins;
+	s->traces = traces;
+	s->db = buffer_pool_alloc((size_t)bins * traces * sizeof(gfloat));
+	s->peaks = g_try_new(struct peak, max_peaks ? max_peaks : 1);
+	if (!s->db || !s->peaks) {
+		spectrum_unref(s);
+		return NULL;
+	}
+
+	return s;
+}
+
+void spectrum_unref(struct spectrum *s)
+{
+	if (!s || !g_atomic_int_dec_and_test(&s->refs))
+		return;
+
+	buffer_pool_free(s->db);
+	g_free(s->peaks);
+	g_free(s);
+}
+
+/* Takes over the caller's reference to @s */
+void spectrum_publish(struct spectrum_slot *slot, struct spectrum *s)
+{
+	struct spectrum *old;
+
+	G_LOCK(spectrum_slot);
+	old = slot->latest;
+	if (old && old->seq > s->seq) {
+		old = s;
+	} else {
+		slot->latest = s;
+	}
+	G_UNLOCK(spectrum_slot);
+
+	spectrum_unref(old);
+}
+
+/*
+ * A reference to the newest spectrum, if it is newer than the one
+ * numbered @seen, or NULL.
+ */
+struct spectrum * spectrum_latest(struct spectrum_slot *slot, guint64 seen)
+{
+	struct spectrum *s;
+
+	G_LOCK(spectrum_slot);
+	s = slot->latest;
+	if (s && s->seq > seen)
+		g_atomic_int_inc(&s->refs);
+	else
+		s = NULL;
+	G_UNLOCK(spectrum_slot);
+
+	return s;
+}
+
+void spectrum_slot_clear(struct spectrum_slot *slot)
+{
+	struct spectrum *old;
+
+	G_LOCK(spectrum_slot);
+	old = slot->latest;
+	slot->latest = NULL;
+	G_UNLOCK(spectrum_slot);
+
+	spectrum_unref(old);
+}
@@ -0,0 +1,60 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __SPECTRUM_H__
+#define __SPECTRUM_H__
+
+#include <glib.h>
+
+#include "peak_detect.h"
+
+/*
+ * Spectra are computed away from the GTK thread and handed to the display
+ * as immutable frames: a DSP worker fills a new one and publishes it, and
+ * nobody writes to it after that. The display takes a reference to the
+ * newest one whenever it redraws, and whoever drops the last reference
+ * frees it. A slot only ever holds the newest frame; one published late,
+ * after a newer one, is dropped.
+ */
+
+/**
+ * struct spectrum - a published spectrum, read-only once published
+ * @refs: references, held by the slot and by each reader
+ * @seq: publication number, increasing with every frame
+ * @bins: bins per trace
+ * @traces: number of traces in @db, one after the other
+ * @db: the traces, in dB, in display order
+ * @peaks: the highest peaks of the first trace, highest first
+ * @num_peaks: number of entries in @peaks
+ **/
+struct spectrum {
+	volatile gint refs;
+	guint64 seq;
+	unsigned int bins;
+	unsigned int traces;
+	gfloat *db;
+	struct peak *peaks;
+	unsigned int num_peaks;
+};
+
+/**
+ * struct spectrum_slot - where the newest spectrum is published
+ * @latest: the newest spectrum, NULL if none since the slot was cleared
+ **/
+struct spectrum_slot {
+	struct spectrum *latest;
+};
+
+struct spectrum * spectrum_new(unsigned int bins, unsigned int traces,
+		unsigned int max_peaks);
+void spectrum_unref(struct spectrum *s);
+
+void spectrum_publish(struct spectrum_slot *slot, struct spectrum *s);
+struct spectrum * spectrum_latest(struct spectrum_slot *slot, guint64 seen);
+void spectrum_slot_clear(struct spectrum_slot *slot);
+
+#endif
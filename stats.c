@@ -0,0 +1,245 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <glib.h>
+
+#include "stats.h"
+
+static const char *stage_names[STATS_NUM_STAGES] = {
+	[STATS_READ] = "read",
+	[STATS_DEMUX] = "demux",
+	[STATS_TRIGGER] = "trigger",
+	[STATS_FFT] = "fft",
+	[STATS_POWER] = "power",
+	[STATS_AVERAGE] = "average",
+	[STATS_MARKERS] = "markers",
+	[STATS_AUTOSCALE] = "autoscale",
+	[STATS_DECIMATE] = "decimate",
+	[STATS_REDRAW] = "redraw",
+};
+
+static const char *counter_names[STATS_NUM_COUNTERS] = {
+	[STATS_BYTES] = "bytes",
+	[STATS_SAMPLES] = "samples",
+	[STATS_SHORT_READS] = "short reads",
+	[STATS_OVERRUNS] = "overruns",
+	[STATS_EAGAIN] = "EAGAIN",
+	[STATS_EAGAIN_STREAKS] = "EAGAIN streaks",
+	[STATS_FRAMES] = "frames captured",
+	[STATS_FRAMES_DROPPED] = "frames dropped",
+	[STATS_FRAMES_DISPLAYED] = "frames displayed",
+	[STATS_SHOTS] = "one-shot captures",
+	[STATS_RECORD_BYTES] = "bytes recorded",
+	[STATS_RECORD_DROPPED] = "frames not recorded",
+	[STATS_SHARED_FRAMES] = "frames shared with plugins",
+	[STATS_SHARED_DROPPED] = "frames not shared",
+	[STATS_ANALYZED_SAMPLES] = "samples analyzed",
+};
+
+/* The capture thread, the DSP workers and the GUI all update these */
+G_LOCK_DEFINE_STATIC(stats);
+static struct stats_snapshot stats;
+static guint64 stats_start;
+
+guint64 stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (guint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned int hist_bucket(guint64 ns)
+{
+	guint64 us = ns / 1000;
+	unsigned int b = 0;
+
+	while (us && b < STATS_HIST_BUCKETS - 1) {
+		us >>= 1;
+		b++;
+	}
+
+	return b;
+}
+
+/* Account for a run of @stage that took @ns */
+void stats_stage_time(enum stats_stage stage, guint64 ns)
+{
+	struct stats_stage_data *s = &stats.stages[stage];
+
+	G_LOCK(stats);
+	s->count++;
+	s->total_ns += ns;
+	if (ns > s->max_ns)
+		s->max_ns = ns;
+	s->hist[hist_bucket(ns)]++;
+	G_UNLOCK(stats);
+}
+
+/* Account for a run of @stage that began at @start, from stats_now() */
+void stats_stage_end(enum stats_stage stage, guint64 start)
+{
+	stats_stage_time(stage, stats_now() - start);
+}
+
+void stats_count(enum stats_counter counter, guint64 n)
+{
+	G_LOCK(stats);
+	stats.counters[counter] += n;
+	G_UNLOCK(stats);
+}
+
+guint64 stats_counter_get(enum stats_counter counter)
+{
+	guint64 n;
+
+	G_LOCK(stats);
+	n = stats.counters[counter];
+	G_UNLOCK(stats);
+
+	return n;
+}
+
+void stats_reset(void)
+{
+	G_LOCK(stats);
+	memset(&stats, 0, sizeof(stats));
+	stats_start = stats_now();
+	G_UNLOCK(stats);
+}
+
+void stats_get(struct stats_snapshot *snap)
+{
+	G_LOCK(stats);
+	*snap = stats;
+	if (!stats_start)
+		stats_start = stats_now();
+	snap->elapsed_ns = stats_now() - stats_start;
+	G_UNLOCK(stats);
+
+	buffer_pool_get_stats(&snap->pool);
+}
+
+/* Upper bound, in us, of the bucket holding the @pct percentile */
+static guint64 hist_percentile(const struct stats_stage_data *s,
+		unsigned int pct)
+{
+	guint64 want, sum = 0;
+	unsigned int b;
+
+	if (!s->count)
+		return 0;
+
+	want = (s->count * pct + 99) / 100;
+	for (b = 0; b < STATS_HIST_BUCKETS - 1; b++) {
+		sum += s->hist[b];
+		if (sum >= want)
+			break;
+	}
+
+	return 1ULL << b;
+}
+
+gchar * stats_format(const struct stats_snapshot *snap)
+{
+	double secs = snap->elapsed_ns / 1e9;
+	GString *str = g_string_new(NULL);
+	unsigned int i, b;
+
+	if (secs <= 0)
+		secs = 1;
+
+	g_string_append_printf(str, "Elapsed: %.1f s\n\n", secs);
+
+	g_string_append_printf(str, "%-20s %14s %12s\n", "Counter", "total", "per second");
+	for (i = 0; i < STATS_NUM_COUNTERS; i++)
+		g_string_append_printf(str, "%-20s %14llu %12.1f\n", counter_names[i],
+				(unsigned long long)snap->counters[i],
+				snap->counters[i] / secs);
+
+	/* only the FFT view analyzes samples */
+	if (snap->counters[STATS_SAMPLES] && snap->counters[STATS_ANALYZED_SAMPLES])
+		g_string_append_printf(str, "\nAnalyzed: %.1f %% of the samples\n",
+				100.0 * snap->counters[STATS_ANALYZED_SAMPLES] /
+				snap->counters[STATS_SAMPLES]);
+
+	g_string_append_printf(str, "\nBuffer pool: %llu hits, %llu allocations, "
+			"%.1f MiB in use, %.1f MiB cached, %.1f MiB peak\n",
+			(unsigned long long)snap->pool.hits,
+			(unsigned long long)snap->pool.misses,
+			snap->pool.in_use / 1048576.0,
+			snap->pool.cached / 1048576.0,
+			snap->pool.peak / 1048576.0);
+
+	g_string_append_printf(str, "\n%-10s %10s %10s %10s %10s %10s\n", "Stage",
+			"count", "avg (us)", "p50 (<us)", "p99 (<us)", "max (us)");
+	for (i = 0; i < STATS_NUM_STAGES; i++) {
+		const struct stats_stage_data *s = &snap->stages[i];
+
+		g_string_append_printf(str, "%-10s %10llu %10.1f %10llu %10llu %10.1f\n",
+				stage_names[i], (unsigned long long)s->count,
+				s->count ? s->total_ns / 1e3 / s->count : 0.0,
+				(unsigned long long)hist_percentile(s, 50),
+				(unsigned long long)hist_percentile(s, 99),
+				s->max_ns / 1e3);
+	}
+
+	g_string_append(str, "\nLatency histograms (us: count)\n");
+	for (i = 0; i < STATS_NUM_STAGES; i++) {
+		const struct stats_stage_data *s = &snap->stages[i];
+
+		if (!s->count)
+			continue;
+
+		g_string_append_printf(str, "%-10s", stage_names[i]);
+		for (b = 0; b < STATS_HIST_BUCKETS; b++) {
+			if (!s->hist[b])
+				continue;
+			if (b == 0)
+				g_string_append(str, " <1");
+			else if (b == STATS_HIST_BUCKETS - 1)
+				g_string_append_printf(str, " >=%llu", 1ULL << (b - 1));
+			else
+				g_string_append_printf(str, " %llu-%llu",
+						1ULL << (b - 1), 1ULL << b);
+			g_string_append_printf(str, ":%llu",
+					(unsigned long long)s->hist[b]);
+		}
+		g_string_append_c(str, '\n');
+	}
+
+	return g_string_free(str, FALSE);
+}
+
+/* Append the current figures to @filename */
+int stats_dump(const char *filename)
+{
+	struct stats_snapshot snap;
+	gchar *text;
+	FILE *f;
+	int ret = 0;
+
+	f = fopen(filename, "a");
+	if (!f)
+		return -errno;
+
+	stats_get(&snap);
+	text = stats_format(&snap);
+	if (fputs(text, f) < 0 || fputc('\n', f) < 0)
+		ret = -EIO;
+	g_free(text);
+
+	if (fclose(f) && !ret)
+		ret = -errno;
+
+	return ret;
+}
@@ -0,0 +1,96 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <glib.h>
+
+#include "buffer_pool.h"
+
+/*
+ * Counters and latency histograms for the capture pipeline. Stages are
+ * timed with stats_now() / stats_stage_end() from whichever thread runs
+ * them; the figures can be looked at in the statistics window or written
+ * to a file from a profile.
+ */
+
+enum stats_stage {
+	STATS_READ,
+	STATS_DEMUX,
+	STATS_TRIGGER,
+	STATS_FFT,
+	STATS_POWER,
+	STATS_AVERAGE,
+	STATS_MARKERS,
+	STATS_AUTOSCALE,
+	STATS_DECIMATE,
+	STATS_REDRAW,
+	STATS_NUM_STAGES
+};
+
+enum stats_counter {
+	STATS_BYTES,
+	STATS_SAMPLES,
+	STATS_SHORT_READS,
+	STATS_OVERRUNS,
+	STATS_EAGAIN,
+	STATS_EAGAIN_STREAKS,
+	STATS_FRAMES,
+	STATS_FRAMES_DROPPED,
+	STATS_FRAMES_DISPLAYED,
+	STATS_SHOTS,
+	STATS_RECORD_BYTES,
+	STATS_RECORD_DROPPED,
+	STATS_SHARED_FRAMES,
+	STATS_SHARED_DROPPED,
+	STATS_ANALYZED_SAMPLES,
+	STATS_NUM_COUNTERS
+};
+
+/* Bucket 0 is below 1 us, bucket n from 2^(n-1) us, the last one open */
+#define STATS_HIST_BUCKETS 21
+
+/**
+ * struct stats_stage_data - timings of one pipeline stage
+ * @count: number of times the stage ran
+ * @total_ns: time spent in it
+ * @max_ns: longest single run
+ * @hist: runs per log2 microsecond bucket
+ **/
+struct stats_stage_data {
+	guint64 count;
+	guint64 total_ns;
+	guint64 max_ns;
+	guint64 hist[STATS_HIST_BUCKETS];
+};
+
+/**
+ * struct stats_snapshot - copy of all the figures at one point in time
+ * @elapsed_ns: time since the last reset
+ * @stages: per stage timings
+ * @counters: event counters
+ * @pool: buffer pool figures, which are never reset
+ **/
+struct stats_snapshot {
+	guint64 elapsed_ns;
+	struct stats_stage_data stages[STATS_NUM_STAGES];
+	guint64 counters[STATS_NUM_COUNTERS];
+	struct buffer_pool_stats pool;
+};
+
+guint64 stats_now(void);
+void stats_stage_end(enum stats_stage stage, guint64 start);
+void stats_stage_time(enum stats_stage stage, guint64 ns);
+void stats_count(enum stats_counter counter, guint64 n);
+guint64 stats_counter_get(enum stats_counter counter);
+void stats_reset(void);
+void stats_get(struct stats_snapshot *snap);
+gchar * stats_format(const struct stats_snapshot *snap);
+int stats_dump(const char *filename);
+
+#endif
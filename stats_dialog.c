@@ -0,0 +1,86 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <gtk/gtk.h>
+
+#include "osc.h"
+#include "stats.h"
+
+#define STATS_REFRESH_MS 500
+#define STATS_RESPONSE_RESET 1
+
+static GtkWidget *stats_dialog;
+static GtkWidget *stats_text;
+static GtkWidget *stats_menu;
+static guint stats_timer;
+
+static gboolean stats_dialog_refresh(gpointer data)
+{
+	struct stats_snapshot snap;
+	GtkTextBuffer *buf;
+	gchar *text;
+
+	if (!gtk_widget_get_visible(stats_dialog)) {
+		stats_timer = 0;
+		return FALSE;
+	}
+
+	stats_get(&snap);
+	text = stats_format(&snap);
+	buf = gtk_text_view_get_buffer(GTK_TEXT_VIEW(stats_text));
+	gtk_text_buffer_set_text(buf, text, -1);
+	g_free(text);
+
+	return TRUE;
+}
+
+static void stats_dialog_response(GtkDialog *dialog, gint response,
+		gpointer data)
+{
+	if (response == STATS_RESPONSE_RESET) {
+		stats_reset();
+		stats_dialog_refresh(NULL);
+		return;
+	}
+
+	gtk_widget_hide(stats_dialog);
+}
+
+static void stats_dialog_show(void)
+{
+	gtk_window_present(GTK_WINDOW(stats_dialog));
+
+	stats_dialog_refresh(NULL);
+	if (!stats_timer)
+		stats_timer = g_timeout_add(STATS_REFRESH_MS,
+				stats_dialog_refresh, NULL);
+}
+
+void stats_dialog_init(GtkBuilder *builder)
+{
+	PangoFontDescription *font;
+
+	stats_dialog = GTK_WIDGET(gtk_builder_get_object(builder, "stats_dialog"));
+	stats_text = GTK_WIDGET(gtk_builder_get_object(builder, "stats_text"));
+	stats_menu = GTK_WIDGET(gtk_builder_get_object(builder, "stats_menu"));
+
+	/* The report is laid out in columns */
+	font = pango_font_description_from_string("Monospace");
+	gtk_widget_modify_font(stats_text, font);
+	pango_font_description_free(font);
+
+	g_signal_connect(stats_dialog, "response",
+		G_CALLBACK(stats_dialog_response), NULL);
+	g_signal_connect(stats_dialog, "delete-event",
+		G_CALLBACK(gtk_widget_hide_on_delete), NULL);
+
+	g_signal_connect(stats_menu, "activate", G_CALLBACK(stats_dialog_show),
+		NULL);
+}
@@ -0,0 +1,174 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+/*
+ * Checks the specialized demux kernels against the generic one: random
+ * captures of every layout they handle are split by both, with and
+ * without conversion to SI units, and the results compared. Fails if
+ * any of them differ.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+
+#include "../iio_utils.h"
+#include "../demux.h"
+
+#define MAX_CHANNELS 4
+#define MAX_SAMPLES 256
+/* out arrays are this long, so that demux_run() has to wrap around */
+#define OUT_SIZE 257
+
+/**
+ * struct layout - a sample format the specialized kernels handle
+ * @bytes: storage size
+ * @bits: significant bits
+ * @shift: where they start in the storage
+ **/
+struct layout {
+	unsigned int bytes;
+	unsigned int bits;
+	unsigned int shift;
+};
+
+static const struct layout layouts[] = {
+	{ 2, 16, 0 },
+	{ 2, 12, 0 },
+	{ 2, 12, 4 },
+	{ 2, 14, 2 },
+	{ 4, 32, 0 },
+	{ 4, 24, 0 },
+	{ 4, 24, 8 },
+	{ 4, 18, 6 },
+};
+
+static const unsigned int channel_counts[] = { 1, 2, 4 };
+
+/* The specialized kernels only take signed channels, anything else is generic */
+static demux_kernel generic_kernel(void)
+{
+	struct iio_channel_info ch;
+	struct demux_plan plan;
+
+	memset(&ch, 0, sizeof(ch));
+	ch.enabled = 1;
+	ch.bytes = 2;
+	ch.bits_used = 16;
+	ch.mask = 0xffff;
+	ch.endianness = IIO_LE;
+	demux_plan_build(&plan, &ch, 1);
+
+	return plan.kernel;
+}
+
+static void setup_channels(struct iio_channel_info *ch, unsigned int nch,
+		const struct layout *l)
+{
+	unsigned int i;
+
+	memset(ch, 0, sizeof(*ch) * (MAX_CHANNELS + 1));
+	for (i = 0; i < nch; i++) {
+		ch[i].enabled = 1;
+		ch[i].bytes = l->bytes;
+		ch[i].bits_used = l->bits;
+		ch[i].shift = l->shift;
+		ch[i].mask = l->bits == 32 ? 0xffffffffu : (1u << l->bits) - 1;
+		ch[i].is_signed = 1;
+		ch[i].endianness = IIO_LE;
+		ch[i].scale = 0.25f + 0.5f * i;
+		ch[i].offset = -3.0f + i;
+	}
+	/* a disabled channel takes no room in the stream */
+	ch[nch] = ch[0];
+	ch[nch].enabled = 0;
+}
+
+static bool same(gfloat a, gfloat b, bool convert)
+{
+	if (!convert)
+		return a == b;
+	/* (raw + offset) * scale and raw * scale + offset * scale round apart */
+	return fabsf(a - b) <= 1e-6f * fmaxf(fabsf(a), 1.0f);
+}
+
+static int compare(const struct demux_plan *plan, demux_kernel generic,
+		const void *data, unsigned int num_sam, unsigned int offset)
+{
+	static gfloat out[2][MAX_CHANNELS][OUT_SIZE];
+	gfloat *fast[MAX_CHANNELS], *ref[MAX_CHANNELS];
+	struct demux_plan ref_plan = *plan;
+	unsigned int i, k;
+
+	ref_plan.kernel = generic;
+	for (k = 0; k < MAX_CHANNELS; k++) {
+		fast[k] = out[0][k];
+		ref[k] = out[1][k];
+	}
+	memset(out, 0, sizeof(out));
+
+	demux_run(plan, data, fast, num_sam, offset, OUT_SIZE);
+	demux_run(&ref_plan, data, ref, num_sam, offset, OUT_SIZE);
+
+	for (k = 0; k < plan->num_enabled; k++)
+		for (i = 0; i < OUT_SIZE; i++)
+			if (!same(fast[k][i], ref[k][i], plan->convert)) {
+				fprintf(stderr, "%s, %u channels, %u samples at %u%s: "
+						"channel %u [%u] is %g, not %g\n",
+						plan->name, plan->num_enabled, num_sam,
+						offset, plan->convert ? ", SI units" : "",
+						k, i, fast[k][i], ref[k][i]);
+				return 1;
+			}
+
+	return 0;
+}
+
+int main(void)
+{
+	struct iio_channel_info ch[MAX_CHANNELS + 1];
+	static uint8_t data[MAX_SAMPLES * MAX_CHANNELS * 4];
+	demux_kernel generic = generic_kernel();
+	struct demux_plan plan;
+	unsigned int l, c, n, i, convert, runs = 0;
+	int fails = 0;
+
+	srand(1);
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = rand();
+
+	for (l = 0; l < G_N_ELEMENTS(layouts); l++)
+	for (c = 0; c < G_N_ELEMENTS(channel_counts); c++) {
+		setup_channels(ch, channel_counts[c], &layouts[l]);
+		demux_plan_build(&plan, ch, channel_counts[c] + 1);
+		if (plan.kernel == generic) {
+			fprintf(stderr, "%u channels of %u/%u>>%u got the generic kernel\n",
+					channel_counts[c], layouts[l].bits,
+					layouts[l].bytes * 8, layouts[l].shift);
+			fails++;
+			continue;
+		}
+
+		for (convert = 0; convert < 2; convert++) {
+			demux_plan_convert(&plan, convert);
+			/* every tail length, then a few long runs */
+			for (n = 1; n <= MAX_SAMPLES; n = n < 40 ? n + 1 : n + 37) {
+				fails += compare(&plan, generic, data, n, 0);
+				fails += compare(&plan, generic, data, n, 3 * n + 1);
+				runs += 2;
+			}
+		}
+	}
+
+	printf("demux: %u runs, %d mismatches\n", runs, fails);
+
+	return fails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,238 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+/*
+ * Times the FFT kernels against the plain loops they replaced, over the
+ * usual FFT sizes, and checks that both give the same result. Prints the
+ * time per bin of each and the speed-up.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <time.h>
+
+#include "../fft_kernels.h"
+
+#define MAX_BINS 65536
+/* each timing repeats a kernel for at least this long, best of ROUNDS */
+#define MIN_NS 20000000.0
+#define ROUNDS 5
+
+static const unsigned int sizes[] = { 1024, 4096, 16384, 65536 };
+
+static float src[2 * MAX_BINS], db[MAX_BINS], trace[MAX_BINS];
+static float out[2][MAX_BINS];
+static double src_d[2 * MAX_BINS];
+
+/* The loops as they were before the kernels */
+
+static void __attribute__((noinline)) ref_power_db(float *dst,
+		const float *in, unsigned int n, float offset)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = 10 * log10f(in[2 * i] * in[2 * i] +
+				in[2 * i + 1] * in[2 * i + 1]) + offset;
+}
+
+static void __attribute__((noinline)) ref_power_db_d(float *dst,
+		const double *in, unsigned int n, double offset)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = 10 * log10(in[2 * i] * in[2 * i] +
+				in[2 * i + 1] * in[2 * i + 1]) + offset;
+}
+
+static void __attribute__((noinline)) ref_avg_max(float *t, const float *in,
+		unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		if (t[i] <= in[i])
+			t[i] = in[i];
+}
+
+static void __attribute__((noinline)) ref_avg_min(float *t, const float *in,
+		unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		if (t[i] >= in[i])
+			t[i] = in[i];
+}
+
+static void __attribute__((noinline)) ref_avg_exp(float *t, const float *in,
+		unsigned int n, float a)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		t[i] = t[i] * (1.0f - a) + in[i] * a;
+}
+
+static void __attribute__((noinline)) ref_vec_add(float *sum,
+		const float *in, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		sum[i] += in[i];
+}
+
+static void __attribute__((noinline)) ref_vec_scale(float *dst,
+		const float *in, unsigned int n, float k)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = in[i] * k;
+}
+
+enum kernel {
+	POWER_DB,
+	POWER_DB_D,
+	AVG_MAX,
+	AVG_MIN,
+	AVG_EXP,
+	VEC_ADD,
+	VEC_SCALE,
+	KERNELS
+};
+
+static const char * const kernel_names[KERNELS] = {
+	[POWER_DB] = "fft_power_db",
+	[POWER_DB_D] = "fft_power_db_d",
+	[AVG_MAX] = "fft_avg_max",
+	[AVG_MIN] = "fft_avg_min",
+	[AVG_EXP] = "fft_avg_exp",
+	[VEC_ADD] = "fft_vec_add",
+	[VEC_SCALE] = "fft_vec_scale",
+};
+
+/* The averages work in place, so they start from the same trace each time */
+static void run(enum kernel k, int ref, float *dst, unsigned int n)
+{
+	switch (k) {
+	case POWER_DB:
+		(ref ? ref_power_db : fft_power_db)(dst, src, n, -3.0f);
+		break;
+	case POWER_DB_D:
+		(ref ? ref_power_db_d : fft_power_db_d)(dst, src_d, n, -3.0);
+		break;
+	case AVG_MAX:
+		memcpy(dst, trace, n * sizeof(*dst));
+		(ref ? ref_avg_max : fft_avg_max)(dst, db, n);
+		break;
+	case AVG_MIN:
+		memcpy(dst, trace, n * sizeof(*dst));
+		(ref ? ref_avg_min : fft_avg_min)(dst, db, n);
+		break;
+	case AVG_EXP:
+		memcpy(dst, trace, n * sizeof(*dst));
+		(ref ? ref_avg_exp : fft_avg_exp)(dst, db, n, 0.1f);
+		break;
+	case VEC_ADD:
+		memcpy(dst, trace, n * sizeof(*dst));
+		(ref ? ref_vec_add : fft_vec_add)(dst, db, n);
+		break;
+	case VEC_SCALE:
+		(ref ? ref_vec_scale : fft_vec_scale)(dst, db, n, 0.25f);
+		break;
+	default:
+		break;
+	}
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Best nanoseconds per bin over ROUNDS */
+static double time_kernel(enum kernel k, int ref, unsigned int n)
+{
+	double start, elapsed, best = HUGE_VAL;
+	unsigned int r, iters;
+
+	for (r = 0; r < ROUNDS; r++) {
+		iters = 0;
+		start = now_ns();
+		do {
+			run(k, ref, out[ref], n);
+			iters++;
+			elapsed = now_ns() - start;
+		} while (elapsed < MIN_NS);
+		if (elapsed / iters < best)
+			best = elapsed / iters;
+	}
+
+	return best / n;
+}
+
+/* Largest difference between the kernel and the loop, relative to 1 dB */
+static double max_error(enum kernel k, unsigned int n)
+{
+	double e, max = 0.0;
+	unsigned int i;
+
+	run(k, 0, out[0], n);
+	run(k, 1, out[1], n);
+	for (i = 0; i < n; i++) {
+		e = fabs(out[0][i] - out[1][i]) / fmax(fabs(out[1][i]), 1.0);
+		if (e > max)
+			max = e;
+	}
+
+	return max;
+}
+
+int main(void)
+{
+	double ref_ns, ns, err;
+	unsigned int i, s, k;
+	int fails = 0;
+
+	srand(1);
+	/* spectra from well below the noise floor up to full scale */
+	for (i = 0; i < 2 * MAX_BINS; i++) {
+		src[i] = (rand() / (float)RAND_MAX - 0.5f) *
+			powf(10.0f, rand() % 10 - 6);
+		src_d[i] = src[i];
+	}
+	for (i = 0; i < MAX_BINS; i++) {
+		db[i] = -120.0f + 120.0f * rand() / RAND_MAX;
+		trace[i] = -120.0f + 120.0f * rand() / RAND_MAX;
+	}
+
+	printf("%-16s %6s %12s %12s %8s %10s\n", "kernel", "bins",
+			"loop ns/bin", "ns/bin", "speed-up", "max error");
+	for (k = 0; k < KERNELS; k++)
+		for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			err = max_error(k, sizes[s]);
+			ref_ns = time_kernel(k, 1, sizes[s]);
+			ns = time_kernel(k, 0, sizes[s]);
+			printf("%-16s %6u %12.3f %12.3f %7.2fx %10.2g\n",
+					kernel_names[k], sizes[s], ref_ns, ns,
+					ref_ns / ns, err);
+			/* the log approximation is good to a few ulp */
+			if (err > 1e-5)
+				fails++;
+		}
+
+	return fails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
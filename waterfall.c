@@ -0,0 +1,239 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <errno.h>
+#include <string.h>
+#include <glib.h>
+#include <cairo.h>
+
+#include "waterfall.h"
+#include "buffer_pool.h"
+
+/* Guards the rows and the colours against pushes from the DSP workers */
+G_LOCK_DEFINE_STATIC(waterfall);
+
+/**
+ * struct colormap_stop - a colour the map passes through
+ * @pos: where, from 0 to 1
+ * @r: red, from 0 to 1
+ * @g: green, from 0 to 1
+ * @b: blue, from 0 to 1
+ **/
+struct colormap_stop {
+	float pos, r, g, b;
+};
+
+static const struct colormap_stop jet_stops[] = {
+	{ 0.0f,   0.0f, 0.0f, 0.5f },
+	{ 0.125f, 0.0f, 0.0f, 1.0f },
+	{ 0.375f, 0.0f, 1.0f, 1.0f },
+	{ 0.625f, 1.0f, 1.0f, 0.0f },
+	{ 0.875f, 1.0f, 0.0f, 0.0f },
+	{ 1.0f,   0.5f, 0.0f, 0.0f },
+};
+
+static const struct colormap_stop hot_stops[] = {
+	{ 0.0f,   0.0f, 0.0f, 0.0f },
+	{ 0.375f, 1.0f, 0.0f, 0.0f },
+	{ 0.75f,  1.0f, 1.0f, 0.0f },
+	{ 1.0f,   1.0f, 1.0f, 1.0f },
+};
+
+static const struct colormap_stop gray_stops[] = {
+	{ 0.0f, 0.0f, 0.0f, 0.0f },
+	{ 1.0f, 1.0f, 1.0f, 1.0f },
+};
+
+static const struct {
+	const char *name;
+	const struct colormap_stop *stops;
+	unsigned int num_stops;
+} colormaps[WATERFALL_COLORMAPS] = {
+	[WATERFALL_JET] = { "jet", jet_stops, G_N_ELEMENTS(jet_stops) },
+	[WATERFALL_HOT] = { "hot", hot_stops, G_N_ELEMENTS(hot_stops) },
+	[WATERFALL_GRAY] = { "gray", gray_stops, G_N_ELEMENTS(gray_stops) },
+};
+
+static void waterfall_clear(struct waterfall *w)
+{
+	unsigned int x, y;
+
+	for (y = 0; y < w->height; y++)
+		for (x = 0; x < w->width; x++)
+			w->pixels[y * w->stride + x] = w->lut[0];
+	w->top = 0;
+}
+
+/* Drops the history whenever the size changes; 0 by 0 frees the rows */
+int waterfall_resize(struct waterfall *w, unsigned int width,
+		unsigned int height)
+{
+	guint32 *pixels = NULL;
+	cairo_surface_t *surface = NULL;
+	int stride = 0;
+
+	if (w->width == width && w->height == height)
+		return 0;
+
+	if (width && height) {
+		stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, width);
+		if (stride < 0)
+			return -EINVAL;
+		pixels = buffer_pool_alloc((size_t)stride * height);
+		if (!pixels)
+			return -ENOMEM;
+		surface = cairo_image_surface_create_for_data(
+				(unsigned char *)pixels, CAIRO_FORMAT_RGB24,
+				width, height, stride);
+		if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+			cairo_surface_destroy(surface);
+			buffer_pool_free(pixels);
+			return -ENOMEM;
+		}
+	}
+
+	G_LOCK(waterfall);
+	if (w->surface)
+		cairo_surface_destroy(w->surface);
+	buffer_pool_free(w->pixels);
+	w->pixels = pixels;
+	w->surface = surface;
+	w->width = pixels ? width : 0;
+	w->height = pixels ? height : 0;
+	w->stride = stride / sizeof(guint32);
+	waterfall_clear(w);
+	G_UNLOCK(waterfall);
+
+	return 0;
+}
+
+void waterfall_free(struct waterfall *w)
+{
+	waterfall_resize(w, 0, 0);
+}
+
+void waterfall_set_colormap(struct waterfall *w, enum waterfall_colormap map)
+{
+	const struct colormap_stop *s, *stops;
+	unsigned int i, j = 0;
+	guint32 lut[256];
+	float pos, f;
+
+	if (map >= WATERFALL_COLORMAPS)
+		map = WATERFALL_JET;
+	stops = colormaps[map].stops;
+
+	for (i = 0; i < G_N_ELEMENTS(lut); i++) {
+		pos = i / (float)(G_N_ELEMENTS(lut) - 1);
+		while (j + 2 < colormaps[map].num_stops && stops[j + 1].pos < pos)
+			j++;
+		s = &stops[j];
+		f = (pos - s[0].pos) / (s[1].pos - s[0].pos);
+		f = CLAMP(f, 0.0f, 1.0f);
+		lut[i] = (guint32)((s[0].r + f * (s[1].r - s[0].r)) * 255.0f + 0.5f) << 16 |
+			(guint32)((s[0].g + f * (s[1].g - s[0].g)) * 255.0f + 0.5f) << 8 |
+			(guint32)((s[0].b + f * (s[1].b - s[0].b)) * 255.0f + 0.5f);
+	}
+
+	G_LOCK(waterfall);
+	w->colormap = map;
+	memcpy(w->lut, lut, sizeof(lut));
+	G_UNLOCK(waterfall);
+}
+
+/* Levels from @min_db to @max_db span the whole colour map */
+void waterfall_set_range(struct waterfall *w, float min_db, float max_db)
+{
+	if (max_db <= min_db)
+		max_db = min_db + 1.0f;
+
+	G_LOCK(waterfall);
+	w->min_db = min_db;
+	w->scale = (G_N_ELEMENTS(w->lut) - 1) / (max_db - min_db);
+	G_UNLOCK(waterfall);
+}
+
+const char * waterfall_colormap_name(enum waterfall_colormap map)
+{
+	if (map >= WATERFALL_COLORMAPS)
+		return NULL;
+	return colormaps[map].name;
+}
+
+int waterfall_colormap_parse(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < WATERFALL_COLORMAPS; i++)
+		if (!strcmp(name, colormaps[i].name))
+			return i;
+	return -EINVAL;
+}
+
+/*
+ * Writes @db as the newest row. When there are more bins than columns,
+ * each column shows the highest of its bins, so narrow tones stay visible;
+ * otherwise it shows the nearest bin.
+ */
+void waterfall_push(struct waterfall *w, const float *db, unsigned int bins)
+{
+	guint32 *row;
+	unsigned int x, lo, hi;
+	float v, idx;
+
+	if (!bins)
+		return;
+
+	G_LOCK(waterfall);
+	if (!w->pixels) {
+		G_UNLOCK(waterfall);
+		return;
+	}
+
+	w->top = (w->top + w->height - 1) % w->height;
+	row = w->pixels + w->top * w->stride;
+
+	lo = 0;
+	for (x = 0; x < w->width; x++) {
+		hi = (guint64)(x + 1) * bins / w->width;
+		v = db[lo];
+		while (++lo < hi)
+			if (db[lo] > v)
+				v = db[lo];
+		lo = hi;
+
+		idx = (v - w->min_db) * w->scale;
+		if (!(idx > 0.0f))
+			idx = 0.0f;
+		else if (idx > G_N_ELEMENTS(w->lut) - 1)
+			idx = G_N_ELEMENTS(w->lut) - 1;
+		row[x] = w->lut[(unsigned int)idx];
+	}
+	G_UNLOCK(waterfall);
+}
+
+/* Newest row at the top, scrolled into place instead of redrawn */
+void waterfall_draw(struct waterfall *w, cairo_t *cr)
+{
+	G_LOCK(waterfall);
+	if (w->surface) {
+		cairo_surface_mark_dirty(w->surface);
+
+		cairo_set_source_surface(cr, w->surface, 0, -(double)w->top);
+		cairo_rectangle(cr, 0, 0, w->width, w->height - w->top);
+		cairo_fill(cr);
+
+		if (w->top) {
+			cairo_set_source_surface(cr, w->surface, 0,
+					w->height - w->top);
+			cairo_rectangle(cr, 0, w->height - w->top,
+					w->width, w->top);
+			cairo_fill(cr);
+		}
+	}
+	G_UNLOCK(waterfall);
+}
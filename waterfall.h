@@ -0,0 +1,68 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __WATERFALL_H__
+#define __WATERFALL_H__
+
+#include <glib.h>
+#include <cairo.h>
+
+/*
+ * A waterfall keeps its history only as pixels: every spectrum pushed to it
+ * is decimated to the width of the view, turned into colours through a
+ * lookup table and written as one row of a ring of image rows, as tall as
+ * the view. Nothing is ever moved; the ring is drawn in two pieces, split
+ * at the newest row, so it scrolls by offset. Pushing may happen on any
+ * thread, everything else is for the GTK thread.
+ */
+
+enum waterfall_colormap {
+	WATERFALL_JET,
+	WATERFALL_HOT,
+	WATERFALL_GRAY,
+	WATERFALL_COLORMAPS
+};
+
+/**
+ * struct waterfall - a ring of coloured spectrum rows
+ * @width: columns, the width of the view
+ * @height: rows, the height of the view
+ * @stride: distance between two rows, in pixels
+ * @pixels: the rows, in CAIRO_FORMAT_RGB24
+ * @surface: cairo image surface on top of @pixels
+ * @top: the row holding the newest spectrum
+ * @colormap: the colour map @lut was built from
+ * @lut: colour for each of the 256 steps between @min_db and the top
+ * @min_db: level shown with the first colour
+ * @scale: colour steps per dB
+ **/
+struct waterfall {
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;
+	guint32 *pixels;
+	cairo_surface_t *surface;
+	unsigned int top;
+	enum waterfall_colormap colormap;
+	guint32 lut[256];
+	float min_db;
+	float scale;
+};
+
+int waterfall_resize(struct waterfall *w, unsigned int width,
+		unsigned int height);
+void waterfall_free(struct waterfall *w);
+
+void waterfall_set_colormap(struct waterfall *w, enum waterfall_colormap map);
+void waterfall_set_range(struct waterfall *w, float min_db, float max_db);
+const char * waterfall_colormap_name(enum waterfall_colormap map);
+int waterfall_colormap_parse(const char *name);
+
+void waterfall_push(struct waterfall *w, const float *db, unsigned int bins);
+void waterfall_draw(struct waterfall *w, cairo_t *cr);
+
+#endif
@@ -0,0 +1,94 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <errno.h>
+#include <string.h>
+#include <glib.h>
+
+#include "welch.h"
+#include "buffer_pool.h"
+
+/* Segments of @seg_len samples, each starting @overlap_pct % before the end of the previous */
+int welch_init(struct welch *w, unsigned int seg_len,
+		unsigned int overlap_pct, unsigned int sample_size)
+{
+	memset(w, 0, sizeof(*w));
+
+	if (!seg_len || !sample_size || overlap_pct >= 100)
+		return -EINVAL;
+
+	w->seg_len = seg_len;
+	w->hop = MAX(seg_len - seg_len * overlap_pct / 100, 1);
+	w->sample_size = sample_size;
+	w->seg = buffer_pool_alloc((size_t)seg_len * sample_size);
+	if (!w->seg)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void welch_free(struct welch *w)
+{
+	buffer_pool_free(w->seg);
+	memset(w, 0, sizeof(*w));
+}
+
+/* A segment ending at stream position @end is ready */
+static void welch_emit(struct welch *w, const void *seg, guint64 end,
+		welch_segment_fn segment, void *priv)
+{
+	segment(seg, priv);
+	w->analyzed += end - MAX(end - w->seg_len, w->covered);
+	w->covered = end;
+}
+
+/*
+ * Feed @n samples starting at stream position @pos, calling @segment for
+ * each segment completed. Returns how many there were.
+ */
+unsigned int welch_feed(struct welch *w, const void *data, unsigned int n,
+		guint64 pos, welch_segment_fn segment, void *priv)
+{
+	const char *p = data;
+	unsigned int take, keep, count = 0;
+	size_t ss = w->sample_size;
+
+	if (pos != w->next_pos)
+		w->fill = 0;
+	w->next_pos = pos + n;
+
+	while (n) {
+		if (!w->fill && n >= w->seg_len) {
+			welch_emit(w, p, pos + w->seg_len, segment, priv);
+			count++;
+			p += w->hop * ss;
+			pos += w->hop;
+			n -= w->hop;
+			continue;
+		}
+
+		take = MIN(n, w->seg_len - w->fill);
+		memcpy((char *)w->seg + w->fill * ss, p, take * ss);
+		w->fill += take;
+		p += take * ss;
+		pos += take;
+		n -= take;
+
+		if (w->fill < w->seg_len)
+			break;
+
+		welch_emit(w, w->seg, pos, segment, priv);
+		count++;
+
+		/* the overlap is the start of the next segment */
+		keep = w->seg_len - w->hop;
+		memmove(w->seg, (char *)w->seg + w->hop * ss, keep * ss);
+		w->fill = keep;
+	}
+
+	return count;
+}
@@ -0,0 +1,51 @@
+/**
+ * Copyright (C) 2014 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __WELCH_H__
+#define __WELCH_H__
+
+#include <glib.h>
+
+/*
+ * Cuts a continuous stream of interleaved samples into overlapping
+ * segments for a Welch power spectrum. Frames are fed in stream order;
+ * a segment lying within a frame is handed over in place, one spanning
+ * two frames is assembled in a buffer of its own. A gap in the stream
+ * drops the partial segment and starts over.
+ */
+
+/**
+ * struct welch - segmenting state
+ * @seg_len: samples per segment
+ * @hop: samples from the start of a segment to the start of the next
+ * @sample_size: bytes per sample, all channels
+ * @seg: the segment being assembled
+ * @fill: samples in @seg so far
+ * @next_pos: where in the stream, in samples, the next frame should start
+ * @covered: end of the last segment handed over, in samples
+ * @analyzed: samples that went into at least one segment
+ **/
+struct welch {
+	unsigned int seg_len;
+	unsigned int hop;
+	unsigned int sample_size;
+	void *seg;
+	unsigned int fill;
+	guint64 next_pos;
+	guint64 covered;
+	guint64 analyzed;
+};
+
+typedef void (*welch_segment_fn)(const void *seg, void *priv);
+
+int welch_init(struct welch *w, unsigned int seg_len,
+		unsigned int overlap_pct, unsigned int sample_size);
+void welch_free(struct welch *w);
+unsigned int welch_feed(struct welch *w, const void *data, unsigned int n,
+		guint64 pos, welch_segment_fn segment, void *priv);
+
+#endif